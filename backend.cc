@@ -2,14 +2,15 @@
 
 #include "bytes.hh"
 
-#include <vector>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
 
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
-using std::vector;
 using std::uint8_t;
 
 using std::cerr;
@@ -68,9 +69,9 @@ char hex(uint8_t b) {
 }
 
 constexpr auto code(const reg64& r) -> nu8 { return r.id & 7; }
-constexpr auto code(const lreg8& r) -> nu8 { return r.id; }
-constexpr auto code(const reg16& r) -> nu8 { return static_cast<u8>(r); }
-constexpr auto code(const reg32& r) -> nu8 { return static_cast<u8>(r); }
+constexpr auto code(const lreg8& r) -> nu8 { return r.id & 7; }
+constexpr auto code(const reg16& r) -> nu8 { return static_cast<u8>(r) & 7; }
+constexpr auto code(const reg32& r) -> nu8 { return static_cast<u8>(r) & 7; }
 constexpr auto code(const reg8& r) -> nu8 { return static_cast<u8>(r); }
 constexpr auto code(const dreg8& r) -> nu8 { return static_cast<u8>(r); }
 
@@ -97,19 +98,6 @@ void put_one(Stream& s, u64 ofs, u8 byte) {
   s[u32(ofs)] = static_cast<char>(byte);
 }
 
-// Create an 8-bit relative reference to placholder `ph` at offset `ofs` in
-// backend `b`.
-static void rel8(Backend& b, placeholder ph, offset ofs) {
-  auto it = b.labels.find(ph);
-  if (it != b.labels.end()) {
-    auto rel = static_cast<i64>(it->second - (ofs + 1));
-    check(rel < 128 && rel > -128);
-    put_one(b.output, ofs, static_cast<u8>(rel));
-  } else {
-    b.refs8[ph].emplace_back(ofs);
-  }
-}
-
 u8* data_ptr(Stream& s, u64 ofs) {
   return reinterpret_cast<u8*>(&s[u32(ofs)]);
 }
@@ -118,47 +106,67 @@ u8 const* data_ptr(Stream const& s, u64 ofs) {
   return (u8 const*) (&s[u32(ofs)]);
 }
 
-// Create a 32-bit relative reference to placholder `ph` at offset `ofs` in
-// backend `b`.
-static void rel32(Backend& b, placeholder ph, offset ofs) {
-  auto it = b.labels.find(ph);
-  if (it != b.labels.end()) {
-    auto rel = as_i32(it->second - (ofs + 4));
-    encode(rel, data_ptr(b.output, ofs));
-  } else {
-    b.refs32[ph].emplace_back(ofs);
+// Make room for placeholders below `count`, e.g. those of another block.
+static void cover(Backend& b, u32 count) {
+  while (len(b.labels) < count) {
+    b.labels.push(Backend::unplaced);
+    b.pending.push(Backend::no_fixup);
   }
 }
 
+// Write the distance from the reference at `ofs` to offset `x`.
+static void patch(Backend& b, offset x, offset ofs, bool rel8) {
+  if (rel8)
+    put_one(b.output, ofs, static_cast<u8>(as_i8(x - (ofs + 1))));
+  else
+    encode(as_i32(x - (ofs + 4)), data_ptr(b.output, ofs));
+}
+
+// Create a relative reference to placholder `ph` at offset `ofs` in backend
+// `b`, of 8 or 32 bits.
+static void reference(Backend& b, placeholder ph, offset ofs, bool rel8) {
+  cover(b, ph.val + 1);
+  if (b.labels[ph.val] != Backend::unplaced) {
+    b.fixups.push({u32(ofs), Backend::no_fixup, ph, rel8});
+    return patch(b, b.labels[ph.val], ofs, rel8);
+  }
+  b.fixups.push({u32(ofs), b.pending[ph.val], ph, rel8});
+  b.pending[ph.val] = len(b.fixups) - 1;
+}
+
+static void rel8(Backend& b, placeholder ph, offset ofs) {
+  reference(b, ph, ofs, true);
+}
+
+static void rel32(Backend& b, placeholder ph, offset ofs) {
+  reference(b, ph, ofs, false);
+}
+
 // Define a label for placeholder `p` at offset `x`.
 static void label(Backend& b, placeholder p, offset x) {
-  b.labels.emplace(p, x);
-  auto it8 = b.refs8.find(p);
-  if (it8 != b.refs8.end()) {
-    for (auto loc: it8->second) {
-      auto ofs = as_i8(x - (loc + 1));
-      put_one(b.output, loc, ofs & 0xff);
-    }
-    b.refs8.erase(it8);
-  }
-  auto it32 = b.refs32.find(p);
-  if (it32 != b.refs32.end()) {
-    for (auto loc: it32->second) {
-      auto ofs = as_i32(x - (loc + 4));
-      encode(ofs, data_ptr(b.output, loc));
-    }
-    b.refs32.erase(it32);
-  }
+  cover(b, p.val + 1);
+  check(b.labels[p.val] == Backend::unplaced);
+  b.labels[p.val] = x;
+  for (u32 i = b.pending[p.val]; i != Backend::no_fixup; i = b.fixups[i].next)
+    patch(b, x, b.fixups[i].at, b.fixups[i].rel8);
+  b.pending[p.val] = Backend::no_fixup;
 }
 
 void Backend::label(placeholder x) {
   lang::label(*this, x, len(output));
+  // Code after a label may be jumped to, so must not be merged with code
+  // before it.
+  recent.kind = Recent::None;
 }
 
 static auto g_prefix(reg64 r1, reg64 r2) -> u8 {
   return 0x48_uc | 0x04_uc * (r1.id >= 8) | (r2.id >= 8);
 }
 
+static auto g_prefix(reg64 r1, dreg8) -> u8 {
+  return r1.id >= 8 ? 0x41_uc : 0x40_uc;
+}
+
 void write(Stream& v, auto... x) {
   v.reserve((... + encode_upper_bound(x)));
   auto it = data_ptr(v, len(v));
@@ -166,43 +174,72 @@ void write(Stream& v, auto... x) {
   v.size = u32(reinterpret_cast<char*>(it) - v.begin());
 }
 
+// Writes the REX prefix, if any, that a form without REX.W needs to name
+// registers 8 to 15 in its reg (`r`) and r/m or base (`b`) fields.
+static void rex(Stream& s, u32 r, u32 b) {
+  if (r >= 8 || b >= 8)
+    write(s, 0x40_uc | 0x04_uc * (r >= 8) | (b >= 8));
+}
+
+// The peephole window, if it holds an instruction of kind `k`.
+static Backend::Recent* window(Backend& b, Backend::Recent::Kind k) {
+  auto& r = b.recent;
+  return b.peephole && r.kind == k && r.end == len(b.output) ? &r : nullptr;
+}
+
+// Notes that the instruction from `at` to the end of the output is of kind
+// `k`.
+static void remember(
+    Backend& b, Backend::Recent::Kind k, u32 at, reg64 r1 = {}, reg64 r2 = {},
+    i32 n = 0) {
+  b.recent = {k, r1, r2, n, at, len(b.output)};
+}
+
+// Drops the instruction in the peephole window.
+static void retract(Backend& b) {
+  b.output.size = b.recent.at;
+  b.recent.kind = Backend::Recent::None;
+}
+
 void Backend::sub(reg64 r1, reg64 r2) {
   write(output, g_prefix(r2, r1), 0x29_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
 }
 
 void Backend::sub(reg64 r, uint8_t a) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0x83_uc, 0xe8_uc | code(r), a);
 }
 
 void Backend::sub(reg16 r, uint8_t a) {
-  write(output, 0x66_uc, 0x83_uc, 0xe8_uc | code(r), a);
+  write(output, 0x66_uc);
+  rex(output, 0, r);
+  write(output, 0x83_uc, 0xe8_uc | code(r), a);
 }
 
 void Backend::neg(reg64 r) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0xf7_uc, 0xd8_uc | code(r));
 }
 
 void Backend::shl(reg64 r, uint8_t a) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0xc1_uc, 0xe0_uc | code(r), a);
 }
 
 void Backend::shl(reg16 r, uint8_t a) {
+  write(output, 0x66_uc);
+  rex(output, 0, r);
   write(output, 0xc1_uc, 0xe0_uc | code(r), a);
 }
 
 void Backend::shr(reg16 r, uint8_t a) {
+  write(output, 0x66_uc);
+  rex(output, 0, r);
   if (a == 1) {
-    write(output, 0x66_uc, 0xd1_uc, 0xe8_uc | code(r));
+    write(output, 0xd1_uc, 0xe8_uc | code(r));
   } else {
-    write(output, 0x66_uc, 0xc1_uc, 0xe8_uc | code(r), a);
+    write(output, 0xc1_uc, 0xe8_uc | code(r), a);
   }
 }
 
 void Backend::sar(reg64 r, uint8_t a) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0xc1_uc, 0xf8_uc | code(r), a);
 }
 
@@ -211,12 +248,17 @@ void Backend::cqo() {
 }
 
 void Backend::push(reg64 r) {
-  check(r.id < 8);
+  u32 at = len(output);
+  if (r.id >= 8)
+    write(output, 0x41_uc);
   write(output, 0x50_uc | code(r));
+  remember(*this, Recent::Push, at, r);
 }
 
 void Backend::push(reg16 r) {
-  write(output, 0x66_uc, 0x50_uc | code(r));
+  write(output, 0x66_uc);
+  rex(output, 0, r);
+  write(output, 0x50_uc | code(r));
 }
 
 void Backend::push(uint8_t n) {
@@ -224,11 +266,12 @@ void Backend::push(uint8_t n) {
 }
 
 void Backend::push(uint32_t n) {
+  if (peephole && is_8bit(i32(n)))
+    return push(u8(n));
   write(output, 0x68_uc, n);
 }
 
 void Backend::div(reg64 r) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0xf7_uc, 0xf0_uc | code(r));
 }
 
@@ -237,6 +280,7 @@ void Backend::idiv(reg64 r) {
 }
 
 void Backend::idiv(reg32 r) {
+  rex(output, 0, r);
   write(output, 0xf7_uc, 0xf8_uc | code(r));
 }
 
@@ -248,16 +292,20 @@ void Backend::imul(reg64 r) {
   write(output, 0x48_uc | (r.id >= 8), 0xf7_uc, 0xe8_uc | code(r));
 }
 
+void Backend::imul(reg64 r1, reg64 r2) {
+  write(output, g_prefix(r1, r2), 0x0f_uc, 0xaf_uc, 0xc0_uc | (code(r1) << 3) | code(r2));
+}
+
 void Backend::cmp(reg64 r1, reg64 r2) {
   write(output, g_prefix(r2, r1), 0x39_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
 }
 
 void Backend::cmp(reg64 r, uint8_t n) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0x83_uc, 0xf8_uc | code(r), n);
 }
 
 void Backend::cmp(reg32 r, uint8_t n) {
+  rex(output, 0, r);
   write(output, 0x83_uc, 0xf8_uc | code(r), n);
 }
 
@@ -265,13 +313,19 @@ void Backend::cmp(reg8 r, uint8_t n) {
   write(output, 0x80_uc, 0xf8_uc | code(r), n);
 }
 
+void Backend::cmp(lreg8 r, uint8_t n) {
+  if (r.id >= 4)
+    write(output, 0x40_uc | (r.id >= 8));
+  write(output, 0x80_uc, 0xf8_uc | code(r), n);
+}
+
 void Backend::sete(reg8 r) {
   write(output, 0x0f_uc, 0x94_uc, 0xc0_uc | code(r));
 }
 
 void Backend::sete(lreg8 r) {
   if (r.id >= 4)
-    write(output, 0x40_uc);
+    write(output, 0x40_uc | (r.id >= 8));
   write(output, 0x0f_uc, 0x94_uc, 0xc0_uc | code(r));
 }
 
@@ -285,7 +339,7 @@ void Backend::setne(reg8 r) {
 
 void Backend::setne(lreg8 r) {
   if (r.id >= 4)
-    write(output, 0x40_uc);
+    write(output, 0x40_uc | (r.id >= 8));
   write(output, 0x0f_uc, 0x95_uc, 0xc0_uc | code(r));
 }
 
@@ -294,6 +348,16 @@ void Backend::setne(dreg8 r) {
 }
 
 void Backend::add(reg64 r, int32_t n) {
+  if (auto w = r == rsp ? window(*this, Recent::AddRsp) : nullptr) {
+    i64 sum = i64(w->n) + n;
+    if (sum == i32(sum)) {
+      retract(*this);
+      if (sum)
+        add(rsp, i32(sum));
+      return;
+    }
+  }
+  u32 at = len(output);
   write(output, 0x48_uc | (r.id >= 8));
   if (is_8bit(n)) {
     write(output, 0x83_uc, 0xc0_uc | code(r), static_cast<u8>(n));
@@ -304,12 +368,17 @@ void Backend::add(reg64 r, int32_t n) {
       write(output, 0x81_uc, 0xc0_uc | code(r), n);
     }
   }
+  if (r == rsp)
+    remember(*this, Recent::AddRsp, at, r, {}, n);
 }
 
 void Backend::add(reg16 r, uint16_t n) {
   if (r == ax)
     todo("add special case for add(ax, ...)"_s);
-  write(output, 0x66_uc, 0x81_uc, 0xc0_uc | code(r), n);
+  write(output, 0x66_uc);
+  rex(output, 0, r);
+  // A u16 would be written promoted to 32 bits.
+  write(output, 0x81_uc, 0xc0_uc | code(r), u8(n), u8(n >> 8));
 }
 
 void Backend::add(reg64 r1, reg64 r2) {
@@ -340,16 +409,23 @@ void Backend::add(reg64 r1, indir<reg64> r2) {
   write(output, g_prefix(r1, r2.r), 0x03_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
 }
 
+void Backend::cmp(reg64 r1, indir<reg64> r2) {
+  write(output, g_prefix(r1, r2.r), 0x3b_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
 void Backend::test(reg64 r1, reg64 r2) {
   write(output, g_prefix(r2, r1), 0x85_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
 }
 
 void Backend::test(reg32 r1, reg32 r2) {
+  rex(output, r2, r1);
   write(output, 0x85_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
 }
 
 void Backend::test(reg16 r1, reg16 r2) {
-  write(output, 0x66_uc, 0x85_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
+  write(output, 0x66_uc);
+  rex(output, r2, r1);
+  write(output, 0x85_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
 }
 
 void Backend::jmp(rel8_linkable_address a) {
@@ -373,6 +449,21 @@ void Backend::jge(rel8_linkable_address a) {
   rel8(*this, a.ph, len(output) - 1);
 }
 
+void Backend::jcc(cond_t c, rel32_linkable_address a) {
+  write(output, 0x0f_uc, 0x80_uc | nu8(c), u32(0));
+  rel32(*this, a.ph, len(output) - 4);
+}
+
+void Backend::jmp(relaxed_linkable_address a) {
+  jumps.push({len(output), a.ph, 0xeb});
+  write(output, 0xeb_uc, u8(0));
+}
+
+void Backend::jcc(cond_t c, relaxed_linkable_address a) {
+  jumps.push({len(output), a.ph, 0x70_uc | nu8(c)});
+  write(output, 0x70_uc | nu8(c), u8(0));
+}
+
 void Backend::je(rel8_linkable_address a) {
   write(output, 0x74_uc, u8(0));
   rel8(*this, a.ph, len(output) - 1);
@@ -394,6 +485,11 @@ void Backend::jne(rel32_linkable_address a) {
 }
 
 void Backend::pop(reg64 r) {
+  if (auto w = window(*this, Recent::Push)) {
+    reg64 pushed = w->a;
+    retract(*this);
+    return mov(r, pushed);
+  }
   if (r.id >= 8) write(output, 0x41_uc);
   write(output, 0x58_uc | code(r));
 }
@@ -405,6 +501,14 @@ void Backend::mov(reg64 r, uint32_t n) {
 void Backend::mov(reg64 r, int32_t n) { mov(r, static_cast<uint32_t>(n)); }
 
 void Backend::mov(reg64 r, uint64_t n) {
+  if (peephole && n == u32(n)) {
+    // Writing the 32-bit register zero-extends.
+    if (r.id >= 8)
+      write(output, 0x41_uc);
+    return write(output, 0xb8_uc | code(r), u32(n));
+  }
+  if (peephole && i64(n) == i32(n))
+    return mov(r, u32(n));
   write(output, 0x48_uc | (r.id >= 8), 0xb8_uc | code(r), n);
 }
 
@@ -439,16 +543,35 @@ void Backend::xchg(reg64 r1, reg64 r2) {
 }
 
 void Backend::mov(reg64 r1, reg64 r2) {
+  if (peephole && r1 == r2)
+    return;
+  auto w = window(*this, Recent::Move);
+  if (w && ((w->a == r2 && w->b == r1) || (w->a == r1 && w->b == r2)))
+    return;
+  u32 at = len(output);
   auto prefix = g_prefix(r2, r1);
   write(output, prefix, 0x89_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
+  remember(*this, Recent::Move, at, r1, r2);
 }
 
+// With a REX prefix, codes 4 to 7 name spl to dil instead of ah to bh.
 void Backend::mov(reg8 r1, indir<reg64> r2) {
+  if (r2.r.id >= 8) {
+    check(r1 < ah);
+    write(output, 0x41_uc);
+  }
   write(output, 0x8a_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
 }
 
 void Backend::mov(dreg8 r1, indir<reg64> r2) {
-  write(output, 0x40_uc, 0x8a_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+  write(output, g_prefix(r2.r, r1), 0x8a_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::mov(lreg8 r1, indir<reg64> r2) {
+  // Any REX prefix makes 4 to 7 name spl to dil.
+  if (r1.id >= 4 || r2.r.id >= 8)
+    write(output, 0x40_uc | 0x04_uc * (r1.id >= 8) | (r2.r.id >= 8));
+  write(output, 0x8a_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
 }
 
 void Backend::mov(reg64 r1, indir<reg64> r2) {
@@ -472,39 +595,72 @@ void Backend::mov(indir<reg64> r, uint8_t n) {
 }
 
 void Backend::mov(indir<reg64> r1, reg8 r2) {
-  if (r1.r.id >= 8)
+  if (r1.r.id >= 8) {
+    check(r2 < ah);
     write(output, 0x41_uc);
+  }
   write(output, 0x88_uc, IndirBundle {r1, code(r2) << 3 | code(r1.r)});
 }
 
-auto g_prefix(reg64 r1, dreg8 r2) -> uint8_t {
-  return r1.id >= 8 ? 0x41_uc : 0x40_uc;
-}
-
 void Backend::mov(indir<reg64> r1, dreg8 r2) {
   write(output, g_prefix(r1.r, r2), 0x88_uc, IndirBundle {r1, code(r2) << 3 | code(r1.r)});
 }
 
+void Backend::mov(indir<reg64> r1, lreg8 r2) {
+  // Any REX prefix makes 4 to 7 name spl to dil.
+  if (r2.id >= 4 || r1.r.id >= 8)
+    write(output, 0x40_uc | 0x04_uc * (r2.id >= 8) | (r1.r.id >= 8));
+  write(output, 0x88_uc, IndirBundle {r1, code(r2) << 3 | code(r1.r)});
+}
+
 void Backend::mov(reg32 r1, indir<reg64> r2) {
-  check(is_8bit(r2.ofs));  // why is this here?
-  check(r2.r.id < 8);  // why is this here?
+  rex(output, r1, r2.r.id);
+  write(output, 0x8b_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::movzx(reg32 r1, indir<reg64> r2) {
+  rex(output, r1, r2.r.id);
+  write(output, 0x0f_uc, 0xb6_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::movzx8(reg64 r1, indir<reg64> r2) {
+  write(output, g_prefix(r1, r2.r), 0x0f_uc, 0xb6_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::movzx16(reg64 r1, indir<reg64> r2) {
+  write(output, g_prefix(r1, r2.r), 0x0f_uc, 0xb7_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::movsx8(reg64 r1, indir<reg64> r2) {
+  write(output, g_prefix(r1, r2.r), 0x0f_uc, 0xbe_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::movsx16(reg64 r1, indir<reg64> r2) {
+  write(output, g_prefix(r1, r2.r), 0x0f_uc, 0xbf_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+void Backend::movsx32(reg64 r1, indir<reg64> r2) {
+  write(output, g_prefix(r1, r2.r), 0x63_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
+}
+
+// Writing a 32-bit register clears the upper half, so REX.W is not needed.
+void Backend::mov32(reg64 r1, indir<reg64> r2) {
+  if (r1.id >= 8 || r2.r.id >= 8)
+    write(output, 0x40_uc | 0x04_uc * (r1.id >= 8) | (r2.r.id >= 8));
   write(output, 0x8b_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
 }
 
 void Backend::mov(reg64 r, rel32_linkable_address a) {
-  check(r.id < 8);
-  write(output, 0x48_uc | (r.id >= 8), 0x8d_uc, 0x00_uc | (code(r) << 3) | 0b101_uc, u32(0));
+  write(output, 0x48_uc | 0x04_uc * (r.id >= 8), 0x8d_uc, 0x00_uc | (code(r) << 3) | 0b101_uc, u32(0));
   rel32(*this, a.ph, len(output) - 4);
 }
 
 // TODO: Turn this into explicit lea from rip.
 void Backend::lea(reg64 r, int32_t ofs) {
-  check(r.id < 8);  // why is this here?
-  write(output, 0x48_uc | (r.id >= 8), 0x8d_uc, 0x00_uc | (code(r) << 3) | 0b101_uc, ofs);
+  write(output, 0x48_uc | 0x04_uc * (r.id >= 8), 0x8d_uc, 0x00_uc | (code(r) << 3) | 0b101_uc, ofs);
 }
 
 void Backend::lea(reg64 r1, indir<reg64> r2) {
-  check(r1.id < 16 && r2.r.id < 16); // why is this here?
   write(output, g_prefix(r1, r2.r), 0x8d_uc, IndirBundle {r2, code(r1) << 3 | code(r2.r)});
 }
 
@@ -524,13 +680,201 @@ void Backend::call(reg64 r) {
 }
 
 void Backend::xor_(reg64 r, uint8_t n) {
-  check(r.id < 8);
   write(output, 0x48_uc | (r.id >= 8), 0x83_uc, 0xf0_uc | code(r), n);
 }
 
 void Backend::xor_(reg64 r1, reg64 r2) {
-  check(r1.id < 8 && r2.id < 8);
-  write(output, 0x48_uc, 0x31_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
+  write(output, g_prefix(r2, r1), 0x31_uc, 0xc0_uc | (code(r2) << 3) | code(r1));
+}
+
+// Vector instructions are told apart by a mandatory prefix and an opcode
+// map as well as the opcode. VEX encodes both in fewer bits.
+enum VectorPrefix: u8 { NP, P66, PF3, PF2 };
+enum VectorMap: u8 { M0F = 1, M0F38 = 2, M0F3A = 3 };
+
+struct VectorOp {
+  VectorPrefix prefix;
+  VectorMap map;
+  u8 op;
+  bool w;
+};
+
+static u8 rm_id(u8 r) { return r; }
+static u8 rm_id(indir<reg64> m) { return m.r.id; }
+static u8 rm_id(rel32_linkable_address) { return 0; }
+
+static void modrm(Backend& b, u8 reg, u8 rm) {
+  write(b.output, 0xc0_uc | nu8(reg & 7) << 3 | nu8(rm & 7));
+}
+
+static void modrm(Backend& b, u8 reg, indir<reg64> m) {
+  write(b.output, IndirBundle {m, nu8(reg & 7) << 3 | code(m.r)});
+}
+
+// Relative to rip, which is the end of the instruction as long as no
+// immediate follows.
+static void modrm(Backend& b, u8 reg, rel32_linkable_address a) {
+  write(b.output, 0x05_uc | nu8(reg & 7) << 3, u32(0));
+  rel32(b, a.ph, len(b.output) - 4);
+}
+
+template <class Rm>
+static void sse(Backend& b, VectorOp o, u8 reg, Rm rm) {
+  static constexpr u8 prefixes[] {0, 0x66, 0xf3, 0xf2};
+  if (o.prefix != NP)
+    write(b.output, prefixes[o.prefix]);
+  auto rex = 0x40_uc | 0x08_uc * o.w | 0x04_uc * (reg >= 8) | (rm_id(rm) >= 8);
+  if (rex != 0x40)
+    write(b.output, rex);
+  write(b.output, 0x0f_uc);
+  if (o.map != M0F)
+    write(b.output, o.map == M0F38 ? 0x38_uc : 0x3a_uc);
+  write(b.output, o.op);
+  modrm(b, reg, rm);
+}
+
+// VEX holds the inverted REX bits, the second source `v` (unused is 0) and
+// whether the operation is on 256 bits. The 2-byte form suffices unless
+// REX.W, REX.B or another map is needed.
+template <class Rm>
+static void vex(Backend& b, VectorOp o, bool wide, u8 reg, u8 v, Rm rm) {
+  auto last = 0x08_uc * o.w | nu8(~v & 15) << 3 | 0x04_uc * wide | nu8(o.prefix);
+  bool r = reg >= 8;
+  bool rm_b = rm_id(rm) >= 8;
+  if (o.map == M0F && !o.w && !rm_b) {
+    write(b.output, 0xc5_uc, 0x80_uc * !r | (last & 0x7f_uc));
+  } else {
+    write(b.output, 0xc4_uc, 0x80_uc * !r | 0x40_uc | 0x20_uc * !rm_b | nu8(o.map));
+    write(b.output, last);
+  }
+  write(b.output, o.op);
+  modrm(b, reg, rm);
+}
+
+#define SSE_BINARY(name, prefix, map, op) \
+  void Backend::name(xmm r1, xmm r2) { sse(*this, {prefix, map, op, false}, r1.id, r2.id); }
+
+#define AVX_BINARY(name, prefix, map, op) \
+  void Backend::name(ymm r1, ymm r2, ymm r3) { \
+    vex(*this, {prefix, map, op, false}, true, r1.id, r2.id, r3.id); \
+  }
+
+#define SSE_MOVE(name, prefix, load, store) \
+  void Backend::name(xmm r1, indir<reg64> r2) { \
+    sse(*this, {prefix, M0F, load, false}, r1.id, r2); \
+  } \
+  void Backend::name(indir<reg64> r1, xmm r2) { \
+    sse(*this, {prefix, M0F, store, false}, r2.id, r1); \
+  }
+
+#define AVX_MOVE(name, prefix, load, store) \
+  void Backend::name(ymm r1, indir<reg64> r2) { \
+    vex(*this, {prefix, M0F, load, false}, true, r1.id, 0, r2); \
+  } \
+  void Backend::name(indir<reg64> r1, ymm r2) { \
+    vex(*this, {prefix, M0F, store, false}, true, r2.id, 0, r1); \
+  }
+
+SSE_MOVE(movdqu, PF3, 0x6f, 0x7f)
+SSE_MOVE(movups, NP, 0x10, 0x11)
+SSE_MOVE(movss, PF3, 0x10, 0x11)
+SSE_MOVE(movsd, PF2, 0x10, 0x11)
+AVX_MOVE(vmovdqu, PF3, 0x6f, 0x7f)
+AVX_MOVE(vmovups, NP, 0x10, 0x11)
+
+void Backend::movdqu(xmm r, rel32_linkable_address a) {
+  sse(*this, {PF3, M0F, 0x6f, false}, r.id, a);
+}
+
+void Backend::vmovdqu(ymm r, rel32_linkable_address a) {
+  vex(*this, {PF3, M0F, 0x6f, false}, true, r.id, 0, a);
+}
+
+void Backend::vbroadcastss(ymm r1, indir<reg64> r2) {
+  vex(*this, {P66, M0F38, 0x18, false}, true, r1.id, 0, r2);
+}
+
+void Backend::movq(xmm r1, reg64 r2) { sse(*this, {P66, M0F, 0x6e, true}, r1.id, r2.id); }
+void Backend::movq(reg64 r1, xmm r2) { sse(*this, {P66, M0F, 0x7e, true}, r2.id, r1.id); }
+
+SSE_BINARY(movaps, NP, M0F, 0x28)
+SSE_BINARY(pshufb, P66, M0F38, 0x00)
+SSE_BINARY(paddd, P66, M0F, 0xfe)
+SSE_BINARY(paddq, P66, M0F, 0xd4)
+SSE_BINARY(psubd, P66, M0F, 0xfa)
+SSE_BINARY(pand, P66, M0F, 0xdb)
+SSE_BINARY(por, P66, M0F, 0xeb)
+SSE_BINARY(pxor, P66, M0F, 0xef)
+SSE_BINARY(pcmpeqb, P66, M0F, 0x74)
+SSE_BINARY(pcmpeqd, P66, M0F, 0x76)
+SSE_BINARY(pcmpgtd, P66, M0F, 0x66)
+SSE_BINARY(addps, NP, M0F, 0x58)
+SSE_BINARY(subps, NP, M0F, 0x5c)
+SSE_BINARY(mulps, NP, M0F, 0x59)
+SSE_BINARY(divps, NP, M0F, 0x5e)
+SSE_BINARY(minps, NP, M0F, 0x5d)
+SSE_BINARY(maxps, NP, M0F, 0x5f)
+SSE_BINARY(addpd, P66, M0F, 0x58)
+SSE_BINARY(subpd, P66, M0F, 0x5c)
+SSE_BINARY(mulpd, P66, M0F, 0x59)
+SSE_BINARY(divpd, P66, M0F, 0x5e)
+SSE_BINARY(addss, PF3, M0F, 0x58)
+SSE_BINARY(mulss, PF3, M0F, 0x59)
+SSE_BINARY(addsd, PF2, M0F, 0x58)
+SSE_BINARY(mulsd, PF2, M0F, 0x59)
+SSE_BINARY(cvtss2sd, PF3, M0F, 0x5a)
+
+AVX_BINARY(vpshufb, P66, M0F38, 0x00)
+AVX_BINARY(vpaddd, P66, M0F, 0xfe)
+AVX_BINARY(vpaddq, P66, M0F, 0xd4)
+AVX_BINARY(vpsubd, P66, M0F, 0xfa)
+AVX_BINARY(vpand, P66, M0F, 0xdb)
+AVX_BINARY(vpor, P66, M0F, 0xeb)
+AVX_BINARY(vpxor, P66, M0F, 0xef)
+AVX_BINARY(vpcmpeqb, P66, M0F, 0x74)
+AVX_BINARY(vpcmpeqd, P66, M0F, 0x76)
+AVX_BINARY(vpcmpgtd, P66, M0F, 0x66)
+AVX_BINARY(vaddps, NP, M0F, 0x58)
+AVX_BINARY(vsubps, NP, M0F, 0x5c)
+AVX_BINARY(vmulps, NP, M0F, 0x59)
+AVX_BINARY(vdivps, NP, M0F, 0x5e)
+AVX_BINARY(vminps, NP, M0F, 0x5d)
+AVX_BINARY(vmaxps, NP, M0F, 0x5f)
+
+#undef SSE_BINARY
+#undef AVX_BINARY
+#undef SSE_MOVE
+#undef AVX_MOVE
+
+void Backend::pshufd(xmm r1, xmm r2, u8 order) {
+  sse(*this, {P66, M0F, 0x70, false}, r1.id, r2.id);
+  write(output, order);
+}
+
+void Backend::cmpps(xmm r1, xmm r2, cmp_t c) {
+  check(c <= cmp_ord);
+  sse(*this, {NP, M0F, 0xc2, false}, r1.id, r2.id);
+  write(output, u8(c));
+}
+
+void Backend::vcmpps(ymm r1, ymm r2, ymm r3, cmp_t c) {
+  vex(*this, {NP, M0F, 0xc2, false}, true, r1.id, r2.id, r3.id);
+  write(output, u8(c));
+}
+
+void Backend::pmovmskb(reg64 r1, xmm r2) { sse(*this, {P66, M0F, 0xd7, false}, r1.id, r2.id); }
+void Backend::movmskps(reg64 r1, xmm r2) { sse(*this, {NP, M0F, 0x50, false}, r1.id, r2.id); }
+
+void Backend::vpmovmskb(reg64 r1, ymm r2) {
+  vex(*this, {P66, M0F, 0xd7, false}, true, r1.id, 0, r2.id);
+}
+
+void Backend::vmovmskps(reg64 r1, ymm r2) {
+  vex(*this, {NP, M0F, 0x50, false}, true, r1.id, 0, r2.id);
+}
+
+void Backend::vzeroupper() {
+  write(output, 0xc5_uc, 0xf8_uc, 0x77_uc);
 }
 
 void Backend::ret() {
@@ -554,7 +898,94 @@ void Backend::dump_output() {
   }
 }
 
-placeholder Backend::ph() { return {placeholder_counter++}; }
+// Where offset `x` moves to, given the total growth `grown[i]` of the
+// jumps before jump i.
+static u32 moved(Backend const& b, Span<u32> grown, offset x) {
+  u32 lo {}, hi = len(b.jumps);
+  while (lo < hi) {
+    u32 mid = (lo + hi) / 2;
+    if (b.jumps[mid].at < x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return u32(x) + grown[lo];
+}
+
+void Backend::relax() {
+  u32 n = len(jumps);
+  if (!n)
+    return;
+  // How many bytes each jump grows by: none, or to its rel32 form.
+  Array<u32> growth(n);
+  Array<u32> grown(n + 1);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (u32 i {}; i < n; ++i)
+      grown[i + 1] = grown[i] + growth[i];
+    for (u32 i {}; i < n; ++i) {
+      auto& j = jumps[i];
+      if (growth[i])
+        continue;
+      auto target = j.ph.val < len(labels) ? labels[j.ph.val] : unplaced;
+      bool fits = false;
+      if (target != unplaced) {
+        i64 from = moved(*this, grown, j.at) + 2;
+        fits = is_8bit(i32(moved(*this, grown, target) - from));
+      }
+      if (!fits) {
+        growth[i] = j.opcode == 0xeb ? 3 : 4;
+        changed = true;
+      }
+    }
+  }
+
+  // A rel8 reference can't be lengthened, so must stay in reach of its
+  // label; one that doesn't should be a relaxed jump instead.
+  for (auto& f: fixups) {
+    auto target = labels[f.ph.val];
+    if (f.rel8 && target != unplaced)
+      check(is_8bit(i32(moved(*this, grown, target) - (moved(*this, grown, f.at) + 1))));
+  }
+
+  List<char> old {output.span()};
+  output.size = 0;
+  recent.kind = Recent::None;
+  output.reserve(len(old) + grown[n]);
+  Array<u32> disp(n);
+  u32 copied {};
+  for (u32 i {}; i < n; ++i) {
+    auto& j = jumps[i];
+    write_from(output, data_ptr(old, copied), j.at - copied);
+    if (!growth[i])
+      write(output, j.opcode, u8(0));
+    else if (j.opcode == 0xeb)
+      write(output, 0xe9_uc, u32(0));
+    else
+      write(output, 0x0f_uc, 0x80_uc | nu8(u8(j.opcode & 0xf)), u32(0));
+    disp[i] = len(output) - (growth[i] ? 4 : 1);
+    copied = j.at + 2;
+  }
+  write_from(output, data_ptr(old, copied), len(old) - copied);
+
+  for (auto& x: labels)
+    if (x != unplaced)
+      x = moved(*this, grown, x);
+  for (auto& f: fixups) {
+    f.at = moved(*this, grown, f.at);
+    if (labels[f.ph.val] != unplaced)
+      patch(*this, labels[f.ph.val], f.at, f.rel8);
+  }
+  List<RelaxedJump> sized {::exchange(jumps, List<RelaxedJump> {})};
+  for (u32 i {}; i < n; ++i)
+    reference(*this, sized[i].ph, disp[i], !growth[i]);
+}
+
+placeholder Backend::ph() {
+  u32 x = len(labels);
+  cover(*this, x + 1);
+  return {x};
+}
 
 void append(Backend& b1, const Backend& b2) {
   auto& b1o = b1.output;
@@ -562,28 +993,904 @@ void append(Backend& b1, const Backend& b2) {
   auto b1n = len(b1o);
 
   write_from(b1o, b2o);
+  cover(b1, len(b2.labels));
+
+  // Inherit all references and jumps from b2, then all its labels.
+  for (auto& f: b2.fixups)
+    reference(b1, f.ph, b1n + f.at, f.rel8);
+  for (auto j: b2.jumps)
+    b1.jumps.push({b1n + j.at, j.ph, j.opcode});
+  for (u32 p {}; p < len(b2.labels); ++p)
+    if (b2.labels[p] != Backend::unplaced)
+      label(b1, {p}, b1n + b2.labels[p]);
+}
+
+CodeArena::CodeArena(): page_size(u32(getpagesize())) {}
+
+CodeArena::~CodeArena() {
+  for (auto& r: regions)
+    munmap(r.base, usize(r.pages) * page_size);
+}
+
+static CodeArena::Region& region_of(CodeArena& a, char const* p) {
+  for (auto& r: a.regions)
+    if (p >= r.base && p < r.base + usize(r.pages) * a.page_size)
+      return r;
+  unreachable;
+}
+
+static u32 rounded(u32 size) { return (size + 15) & ~15u; }
+
+static char* page_after(CodeArena& a, char* p) {
+  auto x = reinterpret_cast<uptr>(p);
+  return reinterpret_cast<char*>((x + a.page_size - 1) & ~uptr(a.page_size - 1));
+}
+
+// Adds `size` bytes from `p` to the live counts of the pages they touch,
+// or takes them away.
+static void count_live(CodeArena& a, char* p, u32 size, bool add) {
+  auto& r = region_of(a, p);
+  for (u32 done {}; done < size;) {
+    u32 page = u32(p + done - r.base) / a.page_size;
+    u32 n = (page + 1) * a.page_size - u32(p + done - r.base);
+    n = n < size - done ? n : size - done;
+    r.live[page] = add ? r.live[page] + n : r.live[page] - n;
+    done += n;
+  }
+}
+
+// Returns free pages to the list, merging them with neighbours in the
+// same region.
+static void release(CodeArena& a, char* at, u32 pages) {
+  if (!pages)
+    return;
+  auto* region = &region_of(a, at);
+  for (u32 i {}; i < len(a.free_pages);) {
+    auto run = a.free_pages[i];
+    bool before = run.at + usize(run.pages) * a.page_size == at;
+    bool after = at + usize(pages) * a.page_size == run.at;
+    if ((before || after) && &region_of(a, run.at) == region) {
+      at = before ? run.at : at;
+      pages += run.pages;
+      a.free_pages[i] = a.free_pages.last();
+      a.free_pages.pop();
+    } else {
+      ++i;
+    }
+  }
+  a.free_pages.push({at, pages});
+}
+
+static void close_span(CodeArena& a) {
+  if (!a.batch)
+    return;
+  char* used = page_after(a, a.at);
+  if (used != a.batch)
+    a.written.push({a.batch, u32((used - a.batch) / a.page_size)});
+  release(a, used, u32((a.end - used) / a.page_size));
+  a.batch = a.at = a.end = nullptr;
+}
+
+// Makes at least `size` bytes writable for the current batch.
+static void open_span(CodeArena& a, u32 size) {
+  close_span(a);
+  u32 need = (size + a.page_size - 1) / a.page_size;
+  u32 k {};
+  while (k < len(a.free_pages) && a.free_pages[k].pages < need)
+    ++k;
+  if (k == len(a.free_pages)) {
+    static constexpr u32 region_pages = 256;
+    u32 pages = need > region_pages ? need : region_pages;
+    usize bytes = usize(pages) * a.page_size;
+    void* base = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(base != MAP_FAILED);
+    a.regions.push({(char*) base, pages, Array<u32>(pages)});
+    a.free_pages.push({(char*) base, pages});
+  }
 
-  // Inherit all references from b2.
-  for (auto& [ph, locs]: b2.refs8)
-    for (auto loc: locs)
-      rel8(b1, ph, b1n + loc);
-  for (auto& [ph, locs]: b2.refs32)
-    for (auto loc: locs)
-      rel32(b1, ph, b1n + loc);
+  // Take a few pages more than needed, so small routines share them.
+  auto& run = a.free_pages[k];
+  u32 take = need > 16 ? need : 16;
+  take = take < run.pages ? take : run.pages;
+  a.batch = a.at = run.at;
+  a.end = run.at + usize(take) * a.page_size;
+  check(!mprotect(a.batch, usize(take) * a.page_size, PROT_READ | PROT_WRITE));
+  run.at = a.end;
+  run.pages -= take;
+  if (!run.pages) {
+    run = a.free_pages.last();
+    a.free_pages.pop();
+  }
+}
+
+void* CodeArena::add(Str code) {
+  u32 size = rounded(len(code) ? len(code) : 1);
+  if (!at || u32(end - at) < size)
+    open_span(*this, size);
+  char* p = at;
+  memcpy(p, code.begin(), len(code));
+  count_live(*this, p, size, true);
+  at += size;
+  return p;
+}
+
+void CodeArena::seal() {
+  // The rest of the span is left writable for the next batch, which starts
+  // on the next page.
+  char* used = batch ? page_after(*this, at) : nullptr;
+  if (used != batch)
+    written.push({batch, u32((used - batch) / page_size)});
+  for (auto run: written) {
+    check(!mprotect(run.at, usize(run.pages) * page_size, PROT_READ | PROT_EXEC));
+    // Routines freed before the seal leave pages with nothing in them.
+    auto& r = region_of(*this, run.at);
+    for (u32 i {}; i < run.pages; ++i) {
+      char* page = run.at + usize(i) * page_size;
+      if (!r.live[u32((page - r.base) / page_size)])
+        release(*this, page, 1);
+    }
+  }
+  written.size = 0;
+  if (batch)
+    batch = at = used;
+}
+
+void CodeArena::free(void* code, u32 size) {
+  char* p = (char*) code;
+  size = rounded(size ? size : 1);
+  count_live(*this, p, size, false);
+  auto& r = region_of(*this, p);
+  u32 first = u32((p - r.base) / page_size);
+  u32 last = u32((p + size - 1 - r.base) / page_size);
+  for (u32 i = first; i <= last; ++i) {
+    char* page = r.base + usize(i) * page_size;
+    // Pages of the current batch are dealt with when it is sealed.
+    bool open = batch && page >= batch && page < end;
+    bool unsealed = false;
+    for (auto run: written)
+      unsealed |= page >= run.at && page < run.at + usize(run.pages) * page_size;
+    if (!r.live[i] && !open && !unsealed)
+      release(*this, page, 1);
+  }
+}
+
+CodeArena& code_arena() {
+  static CodeArena arena;
+  return arena;
+}
+
+#ifdef __linux__
+
+namespace {
+
+// The open perf outputs, or null while disabled.
+struct PerfLog {
+  int map;
+  int dump;
+  // The jitdump file is mapped executable so that perf records where it is.
+  void* marker;
+  u64 code_index;
+};
+
+PerfLog* perf_log;
+
+u64 monotonic_ns() {
+  timespec t;
+  check(!clock_gettime(CLOCK_MONOTONIC, &t));
+  return u64(t.tv_sec) * 1000000000 + u64(t.tv_nsec);
+}
+
+void write_all(int fd, Str s) {
+  while (len(s)) {
+    iptr n = ::write(fd, s.begin(), len(s));
+    check(n > 0);
+    s = {s.begin() + n, s.end()};
+  }
+}
+
+template <class T>
+void put(Stream& s, T x) {
+  memcpy(s.reserve(sizeof(x)), &x, sizeof(x));
+  s.size += u32(sizeof(x));
+}
+
+void print_hex(u64 x, Print& p) {
+  static constexpr char hex[] = "0123456789abcdef";
+  u32 n = 1;
+  while (n < 16 && x >> (4 * n))
+    ++n;
+  char* out = p.chars.reserve(n);
+  for (u32 i {}; i < n; ++i)
+    out[n - 1 - i] = hex[(x >> (4 * i)) & 15];
+  p.chars.size += n;
+}
+
+// Readable too, since the jitdump file is mapped.
+int create(String const& path) {
+  int fd = open(path.begin(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  check(fd >= 0);
+  return fd;
+}
+
+String perf_path(char const* kind, char const* suffix) {
+  Print p;
+  sprint(p, "/tmp/", kind, '-', u32(getpid()), suffix, '\0');
+  return p.chars.take();
+}
+
+// A routine just added at `at`, as a map line and a jitdump JIT_CODE_LOAD
+// record.
+void log_routine(PerfLog& log, void* at, Str code, Str name) {
+  Print line;
+  auto hex = [](u64 x) { return [=](Print& p) { print_hex(x, p); }; };
+  sprint(line, hex(u64(at)), ' ', hex(len(code)), ' ', name, '\n');
+  write_all(log.map, line.chars.span());
+  if (log.dump < 0)
+    return;
+  Stream r;
+  u32 size = 16 + 40 + len(name) + 1 + len(code);
+  put(r, u32(0));
+  put(r, size);
+  put(r, monotonic_ns());
+  put(r, u32(getpid()));
+  put(r, u32(gettid()));
+  put(r, u64(at));
+  put(r, u64(at));
+  put(r, u64(len(code)));
+  put(r, log.code_index++);
+  extend(r, name);
+  r.push('\0');
+  extend(r, code);
+  write_all(log.dump, r.span());
+}
+
+}
+
+void enable_perf_map(bool jitdump) {
+  if (perf_log)
+    disable_perf_map();
+  perf_log = new PerfLog {create(perf_path("perf", ".map")), -1, nullptr, 0};
+  if (!jitdump)
+    return;
+  auto& log = *perf_log;
+  log.dump = create(perf_path("jit", ".dump"));
+  Stream h;
+  put(h, u32(0x4a695444));
+  put(h, u32(1));
+  put(h, u32(40));
+  put(h, u32(62)); // EM_X86_64
+  put(h, u32(0));
+  put(h, u32(getpid()));
+  put(h, monotonic_ns());
+  put(h, u64(0));
+  write_all(log.dump, h.span());
+  log.marker = mmap(
+      nullptr, usize(getpagesize()), PROT_READ | PROT_EXEC, MAP_PRIVATE, log.dump, 0);
+  check(log.marker != MAP_FAILED);
+}
+
+void disable_perf_map() {
+  if (!perf_log)
+    return;
+  auto& log = *perf_log;
+  check(!close(log.map));
+  if (log.dump >= 0) {
+    check(!munmap(log.marker, usize(getpagesize())));
+    check(!close(log.dump));
+  }
+  delete ::exchange(perf_log, nullptr);
+}
+
+#else
+
+// perf runs only on Linux.
+void enable_perf_map(bool) {}
+
+void disable_perf_map() {}
 
-  // Inherit all labels from b2.
-  for (auto [ph, ofs]: b2.labels)
-    label(b1, ph, b1n + ofs);
+#endif
+
+Executable::Executable(Str code, Str name): Executable(code_arena(), code, name) {
+  arena.seal();
 }
 
-Executable::Executable(Str output) {
-  data = mmap(0, len(output), PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  size = len(output);
-  memcpy(data, output.base, len(output));
+Executable::Executable(CodeArena& arena_, Str code, Str name):
+  arena(arena_), data(arena.add(code)), size(len(code)) {
+#ifdef __linux__
+  if (perf_log && len(name))
+    log_routine(*perf_log, data, code, name);
+#else
+  (void) name;
+#endif
 }
 
 Executable::~Executable() {
-  munmap(data, size);
+  arena.free(data, size);
+}
+
 }
 
+using namespace lang;
+
+namespace {
+
+struct Encoding {
+  Str text;
+  Str bytes;
+  void (*emit)(Backend&);
+};
+
+// Every instruction form with low and extended registers, and the special
+// cases of ModRM: rsp and r12 bases need a SIB byte, rbp and r13 bases
+// need a displacement. The bytes are as llvm-mc assembles `text`.
+Encoding const encodings[] {
+    {"sub rcx, 5"_s, "48 83 e9 05"_s, [](Backend& b) { b.sub(rcx, u8(5)); }},
+    {"neg rcx"_s, "48 f7 d9"_s, [](Backend& b) { b.neg(rcx); }},
+    {"shl rcx, 3"_s, "48 c1 e1 03"_s, [](Backend& b) { b.shl(rcx, u8(3)); }},
+    {"sar rcx, 3"_s, "48 c1 f9 03"_s, [](Backend& b) { b.sar(rcx, u8(3)); }},
+    {"push rcx"_s, "51"_s, [](Backend& b) { b.push(rcx); }},
+    {"pop rcx"_s, "59"_s, [](Backend& b) { b.pop(rcx); }},
+    {"div rcx"_s, "48 f7 f1"_s, [](Backend& b) { b.div(rcx); }},
+    {"idiv rcx"_s, "48 f7 f9"_s, [](Backend& b) { b.idiv(rcx); }},
+    {"mul rcx"_s, "48 f7 e1"_s, [](Backend& b) { b.mul(rcx); }},
+    {"imul rcx"_s, "48 f7 e9"_s, [](Backend& b) { b.imul(rcx); }},
+    {"cmp rcx, 7"_s, "48 83 f9 07"_s, [](Backend& b) { b.cmp(rcx, u8(7)); }},
+    {"cmp rdx, qword ptr [rcx + 8]"_s, "48 3b 51 08"_s, [](Backend& b) { b.cmp(rdx, rcx[8]); }},
+    {"xor rcx, 7"_s, "48 83 f1 07"_s, [](Backend& b) { b.xor_(rcx, u8(7)); }},
+    {"add rcx, 7"_s, "48 83 c1 07"_s, [](Backend& b) { b.add(rcx, 7); }},
+    {"add rcx, 1000"_s, "48 81 c1 e8 03 00 00"_s, [](Backend& b) { b.add(rcx, 1000); }},
+    {"jmp rcx"_s, "ff e1"_s, [](Backend& b) { b.jmp(rcx); }},
+    {"call rcx"_s, "ff d1"_s, [](Backend& b) { b.call(rcx); }},
+    {"mov rcx, 1000"_s, "48 c7 c1 e8 03 00 00"_s, [](Backend& b) { b.mov(rcx, 1000u); }},
+    {"movabs rcx, 0x1122334455667788"_s, "48 b9 88 77 66 55 44 33 22 11"_s, [](Backend& b) { b.mov(rcx, u64(0x1122334455667788)); }},
+    {"lea rcx, [rip + 16]"_s, "48 8d 0d 10 00 00 00"_s, [](Backend& b) { b.lea(rcx, 16); }},
+    {"lea rcx, [rip]"_s, "48 8d 0d 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.mov(rcx, rel32(l)); b.label(l); }},
+    {"sub r13, 5"_s, "49 83 ed 05"_s, [](Backend& b) { b.sub(r13, u8(5)); }},
+    {"neg r13"_s, "49 f7 dd"_s, [](Backend& b) { b.neg(r13); }},
+    {"shl r13, 3"_s, "49 c1 e5 03"_s, [](Backend& b) { b.shl(r13, u8(3)); }},
+    {"sar r13, 3"_s, "49 c1 fd 03"_s, [](Backend& b) { b.sar(r13, u8(3)); }},
+    {"push r13"_s, "41 55"_s, [](Backend& b) { b.push(r13); }},
+    {"pop r13"_s, "41 5d"_s, [](Backend& b) { b.pop(r13); }},
+    {"div r13"_s, "49 f7 f5"_s, [](Backend& b) { b.div(r13); }},
+    {"idiv r13"_s, "49 f7 fd"_s, [](Backend& b) { b.idiv(r13); }},
+    {"mul r13"_s, "49 f7 e5"_s, [](Backend& b) { b.mul(r13); }},
+    {"imul r13"_s, "49 f7 ed"_s, [](Backend& b) { b.imul(r13); }},
+    {"cmp r13, 7"_s, "49 83 fd 07"_s, [](Backend& b) { b.cmp(r13, u8(7)); }},
+    {"cmp r13, qword ptr [r12 - 200]"_s, "4d 3b ac 24 38 ff ff ff"_s, [](Backend& b) { b.cmp(r13, r12[-200]); }},
+    {"xor r13, 7"_s, "49 83 f5 07"_s, [](Backend& b) { b.xor_(r13, u8(7)); }},
+    {"add r13, 7"_s, "49 83 c5 07"_s, [](Backend& b) { b.add(r13, 7); }},
+    {"add r13, 1000"_s, "49 81 c5 e8 03 00 00"_s, [](Backend& b) { b.add(r13, 1000); }},
+    {"jmp r13"_s, "41 ff e5"_s, [](Backend& b) { b.jmp(r13); }},
+    {"call r13"_s, "41 ff d5"_s, [](Backend& b) { b.call(r13); }},
+    {"mov r13, 1000"_s, "49 c7 c5 e8 03 00 00"_s, [](Backend& b) { b.mov(r13, 1000u); }},
+    {"movabs r13, 0x1122334455667788"_s, "49 bd 88 77 66 55 44 33 22 11"_s, [](Backend& b) { b.mov(r13, u64(0x1122334455667788)); }},
+    {"lea r13, [rip + 16]"_s, "4c 8d 2d 10 00 00 00"_s, [](Backend& b) { b.lea(r13, 16); }},
+    {"lea r13, [rip]"_s, "4c 8d 2d 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.mov(r13, rel32(l)); b.label(l); }},
+    {"add rax, 1000"_s, "48 05 e8 03 00 00"_s, [](Backend& b) { b.add(rax, 1000); }},
+    {"shl cx, 3"_s, "66 c1 e1 03"_s, [](Backend& b) { b.shl(cx, u8(3)); }},
+    {"add rax, rcx"_s, "48 01 c8"_s, [](Backend& b) { b.add(rax, rcx); }},
+    {"sub rax, rcx"_s, "48 29 c8"_s, [](Backend& b) { b.sub(rax, rcx); }},
+    {"cmp rax, rcx"_s, "48 39 c8"_s, [](Backend& b) { b.cmp(rax, rcx); }},
+    {"test rax, rcx"_s, "48 85 c8"_s, [](Backend& b) { b.test(rax, rcx); }},
+    {"xor rax, rcx"_s, "48 31 c8"_s, [](Backend& b) { b.xor_(rax, rcx); }},
+    {"mov rax, rcx"_s, "48 89 c8"_s, [](Backend& b) { b.mov(rax, rcx); }},
+    {"imul rax, rcx"_s, "48 0f af c1"_s, [](Backend& b) { b.imul(rax, rcx); }},
+    {"xchg rax, rcx"_s, "48 91"_s, [](Backend& b) { b.xchg(rax, rcx); }},
+    {"add rcx, r9"_s, "4c 01 c9"_s, [](Backend& b) { b.add(rcx, r9); }},
+    {"sub rcx, r9"_s, "4c 29 c9"_s, [](Backend& b) { b.sub(rcx, r9); }},
+    {"cmp rcx, r9"_s, "4c 39 c9"_s, [](Backend& b) { b.cmp(rcx, r9); }},
+    {"test rcx, r9"_s, "4c 85 c9"_s, [](Backend& b) { b.test(rcx, r9); }},
+    {"xor rcx, r9"_s, "4c 31 c9"_s, [](Backend& b) { b.xor_(rcx, r9); }},
+    {"mov rcx, r9"_s, "4c 89 c9"_s, [](Backend& b) { b.mov(rcx, r9); }},
+    {"imul rcx, r9"_s, "49 0f af c9"_s, [](Backend& b) { b.imul(rcx, r9); }},
+    {"xchg rcx, r9"_s, "49 87 c9"_s, [](Backend& b) { b.xchg(rcx, r9); }},
+    {"add r10, rdx"_s, "49 01 d2"_s, [](Backend& b) { b.add(r10, rdx); }},
+    {"sub r10, rdx"_s, "49 29 d2"_s, [](Backend& b) { b.sub(r10, rdx); }},
+    {"cmp r10, rdx"_s, "49 39 d2"_s, [](Backend& b) { b.cmp(r10, rdx); }},
+    {"test r10, rdx"_s, "49 85 d2"_s, [](Backend& b) { b.test(r10, rdx); }},
+    {"xor r10, rdx"_s, "49 31 d2"_s, [](Backend& b) { b.xor_(r10, rdx); }},
+    {"mov r10, rdx"_s, "49 89 d2"_s, [](Backend& b) { b.mov(r10, rdx); }},
+    {"imul r10, rdx"_s, "4c 0f af d2"_s, [](Backend& b) { b.imul(r10, rdx); }},
+    {"xchg r10, rdx"_s, "4c 87 d2"_s, [](Backend& b) { b.xchg(r10, rdx); }},
+    {"add r11, r14"_s, "4d 01 f3"_s, [](Backend& b) { b.add(r11, r14); }},
+    {"sub r11, r14"_s, "4d 29 f3"_s, [](Backend& b) { b.sub(r11, r14); }},
+    {"cmp r11, r14"_s, "4d 39 f3"_s, [](Backend& b) { b.cmp(r11, r14); }},
+    {"test r11, r14"_s, "4d 85 f3"_s, [](Backend& b) { b.test(r11, r14); }},
+    {"xor r11, r14"_s, "4d 31 f3"_s, [](Backend& b) { b.xor_(r11, r14); }},
+    {"mov r11, r14"_s, "4d 89 f3"_s, [](Backend& b) { b.mov(r11, r14); }},
+    {"imul r11, r14"_s, "4d 0f af de"_s, [](Backend& b) { b.imul(r11, r14); }},
+    {"xchg r11, r14"_s, "4d 87 de"_s, [](Backend& b) { b.xchg(r11, r14); }},
+    {"mov rdx, qword ptr [rax + 16]"_s, "48 8b 50 10"_s, [](Backend& b) { b.mov(rdx, rax[16]); }},
+    {"mov qword ptr [rax + 16], rdx"_s, "48 89 50 10"_s, [](Backend& b) { b.mov(rax[16], rdx); }},
+    {"add rdx, qword ptr [rax + 16]"_s, "48 03 50 10"_s, [](Backend& b) { b.add(rdx, rax[16]); }},
+    {"lea rdx, [rax + 16]"_s, "48 8d 50 10"_s, [](Backend& b) { b.lea(rdx, rax[16]); }},
+    {"movzx rdx, byte ptr [rax + 16]"_s, "48 0f b6 50 10"_s, [](Backend& b) { b.movzx8(rdx, rax[16]); }},
+    {"movzx rdx, word ptr [rax + 16]"_s, "48 0f b7 50 10"_s, [](Backend& b) { b.movzx16(rdx, rax[16]); }},
+    {"movsx rdx, byte ptr [rax + 8]"_s, "48 0f be 50 08"_s, [](Backend& b) { b.movsx8(rdx, rax[8]); }},
+    {"movsx rdx, word ptr [rax + 8]"_s, "48 0f bf 50 08"_s, [](Backend& b) { b.movsx16(rdx, rax[8]); }},
+    {"movsxd rdx, dword ptr [rax + 8]"_s, "48 63 50 08"_s, [](Backend& b) { b.movsx32(rdx, rax[8]); }},
+    {"movsx r13, byte ptr [r12 - 200]"_s, "4d 0f be ac 24 38 ff ff ff"_s, [](Backend& b) { b.movsx8(r13, r12[-200]); }},
+    {"movsx r13, word ptr [r12 - 200]"_s, "4d 0f bf ac 24 38 ff ff ff"_s, [](Backend& b) { b.movsx16(r13, r12[-200]); }},
+    {"movsxd r13, dword ptr [r12 - 200]"_s, "4d 63 ac 24 38 ff ff ff"_s, [](Backend& b) { b.movsx32(r13, r12[-200]); }},
+    {"mov edx, dword ptr [rax + 16]"_s, "8b 50 10"_s, [](Backend& b) { b.mov32(rdx, rax[16]); }},
+    {"mov r9, qword ptr [rsp]"_s, "4c 8b 0c 24"_s, [](Backend& b) { b.mov(r9, rsp[0]); }},
+    {"mov qword ptr [rsp], r9"_s, "4c 89 0c 24"_s, [](Backend& b) { b.mov(rsp[0], r9); }},
+    {"add r9, qword ptr [rsp]"_s, "4c 03 0c 24"_s, [](Backend& b) { b.add(r9, rsp[0]); }},
+    {"lea r9, [rsp]"_s, "4c 8d 0c 24"_s, [](Backend& b) { b.lea(r9, rsp[0]); }},
+    {"movzx r9, byte ptr [rsp]"_s, "4c 0f b6 0c 24"_s, [](Backend& b) { b.movzx8(r9, rsp[0]); }},
+    {"movzx r9, word ptr [rsp]"_s, "4c 0f b7 0c 24"_s, [](Backend& b) { b.movzx16(r9, rsp[0]); }},
+    {"mov r9d, dword ptr [rsp]"_s, "44 8b 0c 24"_s, [](Backend& b) { b.mov32(r9, rsp[0]); }},
+    {"mov rdx, qword ptr [rbp]"_s, "48 8b 55 00"_s, [](Backend& b) { b.mov(rdx, rbp[0]); }},
+    {"mov qword ptr [rbp], rdx"_s, "48 89 55 00"_s, [](Backend& b) { b.mov(rbp[0], rdx); }},
+    {"add rdx, qword ptr [rbp]"_s, "48 03 55 00"_s, [](Backend& b) { b.add(rdx, rbp[0]); }},
+    {"lea rdx, [rbp]"_s, "48 8d 55 00"_s, [](Backend& b) { b.lea(rdx, rbp[0]); }},
+    {"movzx rdx, byte ptr [rbp]"_s, "48 0f b6 55 00"_s, [](Backend& b) { b.movzx8(rdx, rbp[0]); }},
+    {"movzx rdx, word ptr [rbp]"_s, "48 0f b7 55 00"_s, [](Backend& b) { b.movzx16(rdx, rbp[0]); }},
+    {"mov edx, dword ptr [rbp]"_s, "8b 55 00"_s, [](Backend& b) { b.mov32(rdx, rbp[0]); }},
+    {"mov r9, qword ptr [r12 + 8]"_s, "4d 8b 4c 24 08"_s, [](Backend& b) { b.mov(r9, r12[8]); }},
+    {"mov qword ptr [r12 + 8], r9"_s, "4d 89 4c 24 08"_s, [](Backend& b) { b.mov(r12[8], r9); }},
+    {"add r9, qword ptr [r12 + 8]"_s, "4d 03 4c 24 08"_s, [](Backend& b) { b.add(r9, r12[8]); }},
+    {"lea r9, [r12 + 8]"_s, "4d 8d 4c 24 08"_s, [](Backend& b) { b.lea(r9, r12[8]); }},
+    {"movzx r9, byte ptr [r12 + 8]"_s, "4d 0f b6 4c 24 08"_s, [](Backend& b) { b.movzx8(r9, r12[8]); }},
+    {"movzx r9, word ptr [r12 + 8]"_s, "4d 0f b7 4c 24 08"_s, [](Backend& b) { b.movzx16(r9, r12[8]); }},
+    {"mov r9d, dword ptr [r12 + 8]"_s, "45 8b 4c 24 08"_s, [](Backend& b) { b.mov32(r9, r12[8]); }},
+    {"mov rdx, qword ptr [r13]"_s, "49 8b 55 00"_s, [](Backend& b) { b.mov(rdx, r13[0]); }},
+    {"mov qword ptr [r13], rdx"_s, "49 89 55 00"_s, [](Backend& b) { b.mov(r13[0], rdx); }},
+    {"add rdx, qword ptr [r13]"_s, "49 03 55 00"_s, [](Backend& b) { b.add(rdx, r13[0]); }},
+    {"lea rdx, [r13]"_s, "49 8d 55 00"_s, [](Backend& b) { b.lea(rdx, r13[0]); }},
+    {"movzx rdx, byte ptr [r13]"_s, "49 0f b6 55 00"_s, [](Backend& b) { b.movzx8(rdx, r13[0]); }},
+    {"movzx rdx, word ptr [r13]"_s, "49 0f b7 55 00"_s, [](Backend& b) { b.movzx16(rdx, r13[0]); }},
+    {"mov edx, dword ptr [r13]"_s, "41 8b 55 00"_s, [](Backend& b) { b.mov32(rdx, r13[0]); }},
+    {"mov r9, qword ptr [r15 - 1000]"_s, "4d 8b 8f 18 fc ff ff"_s, [](Backend& b) { b.mov(r9, r15[-1000]); }},
+    {"mov qword ptr [r15 - 1000], r9"_s, "4d 89 8f 18 fc ff ff"_s, [](Backend& b) { b.mov(r15[-1000], r9); }},
+    {"add r9, qword ptr [r15 - 1000]"_s, "4d 03 8f 18 fc ff ff"_s, [](Backend& b) { b.add(r9, r15[-1000]); }},
+    {"lea r9, [r15 - 1000]"_s, "4d 8d 8f 18 fc ff ff"_s, [](Backend& b) { b.lea(r9, r15[-1000]); }},
+    {"movzx r9, byte ptr [r15 - 1000]"_s, "4d 0f b6 8f 18 fc ff ff"_s, [](Backend& b) { b.movzx8(r9, r15[-1000]); }},
+    {"movzx r9, word ptr [r15 - 1000]"_s, "4d 0f b7 8f 18 fc ff ff"_s, [](Backend& b) { b.movzx16(r9, r15[-1000]); }},
+    {"mov r9d, dword ptr [r15 - 1000]"_s, "45 8b 8f 18 fc ff ff"_s, [](Backend& b) { b.mov32(r9, r15[-1000]); }},
+    {"mov dword ptr [rsi + 8], 1000"_s, "c7 46 08 e8 03 00 00"_s, [](Backend& b) { b.mov(rsi[8], 1000u); }},
+    {"mov byte ptr [rsi + 8], 7"_s, "c6 46 08 07"_s, [](Backend& b) { b.mov(rsi[8], u8(7)); }},
+    {"mov byte ptr [rsi + 8], cl"_s, "88 4e 08"_s, [](Backend& b) { b.mov(rsi[8], cl); }},
+    {"mov byte ptr [rsi + 8], sil"_s, "40 88 76 08"_s, [](Backend& b) { b.mov(rsi[8], sil); }},
+    {"mov cl, byte ptr [rsi + 8]"_s, "8a 4e 08"_s, [](Backend& b) { b.mov(cl, rsi[8]); }},
+    {"mov dil, byte ptr [rsi + 8]"_s, "40 8a 7e 08"_s, [](Backend& b) { b.mov(dil, rsi[8]); }},
+    {"mov ecx, dword ptr [rsi + 8]"_s, "8b 4e 08"_s, [](Backend& b) { b.mov(ecx, rsi[8]); }},
+    {"movzx ecx, byte ptr [rsi + 8]"_s, "0f b6 4e 08"_s, [](Backend& b) { b.movzx(ecx, rsi[8]); }},
+    {"mov dword ptr [r13 + 8], 1000"_s, "41 c7 45 08 e8 03 00 00"_s, [](Backend& b) { b.mov(r13[8], 1000u); }},
+    {"mov byte ptr [r13 + 8], 7"_s, "41 c6 45 08 07"_s, [](Backend& b) { b.mov(r13[8], u8(7)); }},
+    {"mov byte ptr [r13 + 8], cl"_s, "41 88 4d 08"_s, [](Backend& b) { b.mov(r13[8], cl); }},
+    {"mov byte ptr [r13 + 8], sil"_s, "41 88 75 08"_s, [](Backend& b) { b.mov(r13[8], sil); }},
+    {"mov cl, byte ptr [r13 + 8]"_s, "41 8a 4d 08"_s, [](Backend& b) { b.mov(cl, r13[8]); }},
+    {"mov dil, byte ptr [r13 + 8]"_s, "41 8a 7d 08"_s, [](Backend& b) { b.mov(dil, r13[8]); }},
+    {"mov ecx, dword ptr [r13 + 8]"_s, "41 8b 4d 08"_s, [](Backend& b) { b.mov(ecx, r13[8]); }},
+    {"movzx ecx, byte ptr [r13 + 8]"_s, "41 0f b6 4d 08"_s, [](Backend& b) { b.movzx(ecx, r13[8]); }},
+    {"mov byte ptr [rsi + 8], ah"_s, "88 66 08"_s, [](Backend& b) { b.mov(rsi[8], ah); }},
+    {"sete cl"_s, "0f 94 c1"_s, [](Backend& b) { b.sete(lowest8(rcx)); }},
+    {"setne cl"_s, "0f 95 c1"_s, [](Backend& b) { b.setne(lowest8(rcx)); }},
+    {"sete sil"_s, "40 0f 94 c6"_s, [](Backend& b) { b.sete(lowest8(rsi)); }},
+    {"setne sil"_s, "40 0f 95 c6"_s, [](Backend& b) { b.setne(lowest8(rsi)); }},
+    {"sete r9b"_s, "41 0f 94 c1"_s, [](Backend& b) { b.sete(lowest8(r9)); }},
+    {"setne r9b"_s, "41 0f 95 c1"_s, [](Backend& b) { b.setne(lowest8(r9)); }},
+    {"sete r15b"_s, "41 0f 94 c7"_s, [](Backend& b) { b.sete(lowest8(r15)); }},
+    {"setne r15b"_s, "41 0f 95 c7"_s, [](Backend& b) { b.setne(lowest8(r15)); }},
+    {"sete bl"_s, "0f 94 c3"_s, [](Backend& b) { b.sete(bl); }},
+    {"setne dil"_s, "40 0f 95 c7"_s, [](Backend& b) { b.setne(dil); }},
+    {"sub cx, 5"_s, "66 83 e9 05"_s, [](Backend& b) { b.sub(cx, u8(5)); }},
+    {"sub r9w, 5"_s, "66 41 83 e9 05"_s, [](Backend& b) { b.sub(r9w, u8(5)); }},
+    {"shl r9w, 3"_s, "66 41 c1 e1 03"_s, [](Backend& b) { b.shl(r9w, u8(3)); }},
+    {"shr cx, 1"_s, "66 d1 e9"_s, [](Backend& b) { b.shr(cx, u8(1)); }},
+    {"shr r9w, 1"_s, "66 41 d1 e9"_s, [](Backend& b) { b.shr(r9w, u8(1)); }},
+    {"shr r9w, 3"_s, "66 41 c1 e9 03"_s, [](Backend& b) { b.shr(r9w, u8(3)); }},
+    {"push cx"_s, "66 51"_s, [](Backend& b) { b.push(cx); }},
+    {"push r9w"_s, "66 41 51"_s, [](Backend& b) { b.push(r9w); }},
+    {"idiv ecx"_s, "f7 f9"_s, [](Backend& b) { b.idiv(ecx); }},
+    {"idiv r9d"_s, "41 f7 f9"_s, [](Backend& b) { b.idiv(r9d); }},
+    {"cmp ecx, 7"_s, "83 f9 07"_s, [](Backend& b) { b.cmp(ecx, u8(7)); }},
+    {"cmp r9d, 7"_s, "41 83 f9 07"_s, [](Backend& b) { b.cmp(r9d, u8(7)); }},
+    {"add cx, 1000"_s, "66 81 c1 e8 03"_s, [](Backend& b) { b.add(cx, u16(1000)); }},
+    {"add r9w, 1000"_s, "66 41 81 c1 e8 03"_s, [](Backend& b) { b.add(r9w, u16(1000)); }},
+    {"test ecx, edx"_s, "85 d1"_s, [](Backend& b) { b.test(ecx, edx); }},
+    {"test r9d, r10d"_s, "45 85 d1"_s, [](Backend& b) { b.test(r9d, r10d); }},
+    {"test eax, r10d"_s, "44 85 d0"_s, [](Backend& b) { b.test(eax, r10d); }},
+    {"test r9d, eax"_s, "41 85 c1"_s, [](Backend& b) { b.test(r9d, eax); }},
+    {"test cx, dx"_s, "66 85 d1"_s, [](Backend& b) { b.test(cx, dx); }},
+    {"test r9w, r10w"_s, "66 45 85 d1"_s, [](Backend& b) { b.test(r9w, r10w); }},
+    {"cmp cl, 7"_s, "80 f9 07"_s, [](Backend& b) { b.cmp(lowest8(rcx), u8(7)); }},
+    {"cmp sil, 7"_s, "40 80 fe 07"_s, [](Backend& b) { b.cmp(lowest8(rsi), u8(7)); }},
+    {"cmp r9b, 7"_s, "41 80 f9 07"_s, [](Backend& b) { b.cmp(lowest8(r9), u8(7)); }},
+    {"mov cl, byte ptr [rsi + 8]"_s, "8a 4e 08"_s, [](Backend& b) { b.mov(lowest8(rcx), rsi[8]); }},
+    {"mov sil, byte ptr [rsi + 8]"_s, "40 8a 76 08"_s, [](Backend& b) { b.mov(lowest8(rsi), rsi[8]); }},
+    {"mov r9b, byte ptr [rsi + 8]"_s, "44 8a 4e 08"_s, [](Backend& b) { b.mov(lowest8(r9), rsi[8]); }},
+    {"mov sil, byte ptr [r13 + 8]"_s, "41 8a 75 08"_s, [](Backend& b) { b.mov(lowest8(rsi), r13[8]); }},
+    {"mov r9b, byte ptr [r13 + 8]"_s, "45 8a 4d 08"_s, [](Backend& b) { b.mov(lowest8(r9), r13[8]); }},
+    {"mov byte ptr [rsi + 8], cl"_s, "88 4e 08"_s, [](Backend& b) { b.mov(rsi[8], lowest8(rcx)); }},
+    {"mov byte ptr [rsi + 8], dil"_s, "40 88 7e 08"_s, [](Backend& b) { b.mov(rsi[8], lowest8(rdi)); }},
+    {"mov byte ptr [r13 + 8], r9b"_s, "45 88 4d 08"_s, [](Backend& b) { b.mov(r13[8], lowest8(r9)); }},
+    {"mov byte ptr [rsi + 8], r9b"_s, "44 88 4e 08"_s, [](Backend& b) { b.mov(rsi[8], lowest8(r9)); }},
+    {"mov r9d, dword ptr [rsi + 8]"_s, "44 8b 4e 08"_s, [](Backend& b) { b.mov(r9d, rsi[8]); }},
+    {"mov r9d, dword ptr [r13 + 8]"_s, "45 8b 4d 08"_s, [](Backend& b) { b.mov(r9d, r13[8]); }},
+    {"movzx r9d, byte ptr [rsi + 8]"_s, "44 0f b6 4e 08"_s, [](Backend& b) { b.movzx(r9d, rsi[8]); }},
+    {"movzx r9d, byte ptr [r13 + 8]"_s, "45 0f b6 4d 08"_s, [](Backend& b) { b.movzx(r9d, r13[8]); }},
+    {"jb <next>"_s, "0f 82 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(below, rel32(l)); b.label(l); }},
+    {"jae <next>"_s, "0f 83 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(above_equal, rel32(l)); b.label(l); }},
+    {"je <next>"_s, "0f 84 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(equal, rel32(l)); b.label(l); }},
+    {"jne <next>"_s, "0f 85 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(not_equal, rel32(l)); b.label(l); }},
+    {"jbe <next>"_s, "0f 86 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(below_equal, rel32(l)); b.label(l); }},
+    {"ja <next>"_s, "0f 87 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(above, rel32(l)); b.label(l); }},
+    {"jl <next>"_s, "0f 8c 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(less, rel32(l)); b.label(l); }},
+    {"jge <next>"_s, "0f 8d 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(greater_equal, rel32(l)); b.label(l); }},
+    {"jle <next>"_s, "0f 8e 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(less_equal, rel32(l)); b.label(l); }},
+    {"jg <next>"_s, "0f 8f 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jcc(greater, rel32(l)); b.label(l); }},
+    {"jmp <next>"_s, "e9 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.jmp(rel32(l)); b.label(l); }},
+    {"jmp <next>"_s, "eb 00"_s, [](Backend& b) { auto l = b.ph(); b.jmp(rel8(l)); b.label(l); }},
+    {"je <self>"_s, "0f 84 fa ff ff ff"_s, [](Backend& b) { auto l = b.ph(); b.label(l); b.je(rel32(l)); }},
+    {"jne <self>"_s, "75 fe"_s, [](Backend& b) { auto l = b.ph(); b.label(l); b.jne(rel8(l)); }},
+    {"cqo"_s, "48 99"_s, [](Backend& b) { b.cqo(); }},
+    {"ret"_s, "c3"_s, [](Backend& b) { b.ret(); }},
+    {"syscall"_s, "0f 05"_s, [](Backend& b) { b.syscall(); }},
+    {"push 1000"_s, "68 e8 03 00 00"_s, [](Backend& b) { b.push(1000u); }},
+    {"push 7"_s, "6a 07"_s, [](Backend& b) { b.push(u8(7)); }},
+    {"movdqu xmm1, xmmword ptr [rdi]"_s, "f3 0f 6f 0f"_s, [](Backend& b) { b.movdqu(xmm1, rdi[0]); }},
+    {"movdqu xmmword ptr [rdi], xmm1"_s, "f3 0f 7f 0f"_s, [](Backend& b) { b.movdqu(rdi[0], xmm1); }},
+    {"movups xmm1, xmmword ptr [rdi]"_s, "0f 10 0f"_s, [](Backend& b) { b.movups(xmm1, rdi[0]); }},
+    {"movups xmmword ptr [rdi], xmm1"_s, "0f 11 0f"_s, [](Backend& b) { b.movups(rdi[0], xmm1); }},
+    {"movss xmm1, dword ptr [rdi]"_s, "f3 0f 10 0f"_s, [](Backend& b) { b.movss(xmm1, rdi[0]); }},
+    {"movss dword ptr [rdi], xmm1"_s, "f3 0f 11 0f"_s, [](Backend& b) { b.movss(rdi[0], xmm1); }},
+    {"movsd xmm1, qword ptr [rdi]"_s, "f2 0f 10 0f"_s, [](Backend& b) { b.movsd(xmm1, rdi[0]); }},
+    {"movsd qword ptr [rdi], xmm1"_s, "f2 0f 11 0f"_s, [](Backend& b) { b.movsd(rdi[0], xmm1); }},
+    {"vmovdqu ymm1, ymmword ptr [rdi]"_s, "c5 fe 6f 0f"_s, [](Backend& b) { b.vmovdqu(ymm1, rdi[0]); }},
+    {"vmovdqu ymmword ptr [rdi], ymm1"_s, "c5 fe 7f 0f"_s, [](Backend& b) { b.vmovdqu(rdi[0], ymm1); }},
+    {"vmovups ymm1, ymmword ptr [rdi]"_s, "c5 fc 10 0f"_s, [](Backend& b) { b.vmovups(ymm1, rdi[0]); }},
+    {"vmovups ymmword ptr [rdi], ymm1"_s, "c5 fc 11 0f"_s, [](Backend& b) { b.vmovups(rdi[0], ymm1); }},
+    {"vbroadcastss ymm1, dword ptr [rdi]"_s, "c4 e2 7d 18 0f"_s, [](Backend& b) { b.vbroadcastss(ymm1, rdi[0]); }},
+    {"movdqu xmm9, xmmword ptr [rsp + 16]"_s, "f3 44 0f 6f 4c 24 10"_s, [](Backend& b) { b.movdqu(xmm9, rsp[16]); }},
+    {"movdqu xmmword ptr [rsp + 16], xmm9"_s, "f3 44 0f 7f 4c 24 10"_s, [](Backend& b) { b.movdqu(rsp[16], xmm9); }},
+    {"movups xmm9, xmmword ptr [rsp + 16]"_s, "44 0f 10 4c 24 10"_s, [](Backend& b) { b.movups(xmm9, rsp[16]); }},
+    {"movups xmmword ptr [rsp + 16], xmm9"_s, "44 0f 11 4c 24 10"_s, [](Backend& b) { b.movups(rsp[16], xmm9); }},
+    {"movss xmm9, dword ptr [rsp + 16]"_s, "f3 44 0f 10 4c 24 10"_s, [](Backend& b) { b.movss(xmm9, rsp[16]); }},
+    {"movss dword ptr [rsp + 16], xmm9"_s, "f3 44 0f 11 4c 24 10"_s, [](Backend& b) { b.movss(rsp[16], xmm9); }},
+    {"movsd xmm9, qword ptr [rsp + 16]"_s, "f2 44 0f 10 4c 24 10"_s, [](Backend& b) { b.movsd(xmm9, rsp[16]); }},
+    {"movsd qword ptr [rsp + 16], xmm9"_s, "f2 44 0f 11 4c 24 10"_s, [](Backend& b) { b.movsd(rsp[16], xmm9); }},
+    {"vmovdqu ymm9, ymmword ptr [rsp + 16]"_s, "c5 7e 6f 4c 24 10"_s, [](Backend& b) { b.vmovdqu(ymm9, rsp[16]); }},
+    {"vmovdqu ymmword ptr [rsp + 16], ymm9"_s, "c5 7e 7f 4c 24 10"_s, [](Backend& b) { b.vmovdqu(rsp[16], ymm9); }},
+    {"vmovups ymm9, ymmword ptr [rsp + 16]"_s, "c5 7c 10 4c 24 10"_s, [](Backend& b) { b.vmovups(ymm9, rsp[16]); }},
+    {"vmovups ymmword ptr [rsp + 16], ymm9"_s, "c5 7c 11 4c 24 10"_s, [](Backend& b) { b.vmovups(rsp[16], ymm9); }},
+    {"vbroadcastss ymm9, dword ptr [rsp + 16]"_s, "c4 62 7d 18 4c 24 10"_s, [](Backend& b) { b.vbroadcastss(ymm9, rsp[16]); }},
+    {"movdqu xmm2, xmmword ptr [r13 - 8]"_s, "f3 41 0f 6f 55 f8"_s, [](Backend& b) { b.movdqu(xmm2, r13[-8]); }},
+    {"movdqu xmmword ptr [r13 - 8], xmm2"_s, "f3 41 0f 7f 55 f8"_s, [](Backend& b) { b.movdqu(r13[-8], xmm2); }},
+    {"movups xmm2, xmmword ptr [r13 - 8]"_s, "41 0f 10 55 f8"_s, [](Backend& b) { b.movups(xmm2, r13[-8]); }},
+    {"movups xmmword ptr [r13 - 8], xmm2"_s, "41 0f 11 55 f8"_s, [](Backend& b) { b.movups(r13[-8], xmm2); }},
+    {"movss xmm2, dword ptr [r13 - 8]"_s, "f3 41 0f 10 55 f8"_s, [](Backend& b) { b.movss(xmm2, r13[-8]); }},
+    {"movss dword ptr [r13 - 8], xmm2"_s, "f3 41 0f 11 55 f8"_s, [](Backend& b) { b.movss(r13[-8], xmm2); }},
+    {"movsd xmm2, qword ptr [r13 - 8]"_s, "f2 41 0f 10 55 f8"_s, [](Backend& b) { b.movsd(xmm2, r13[-8]); }},
+    {"movsd qword ptr [r13 - 8], xmm2"_s, "f2 41 0f 11 55 f8"_s, [](Backend& b) { b.movsd(r13[-8], xmm2); }},
+    {"vmovdqu ymm2, ymmword ptr [r13 - 8]"_s, "c4 c1 7e 6f 55 f8"_s, [](Backend& b) { b.vmovdqu(ymm2, r13[-8]); }},
+    {"vmovdqu ymmword ptr [r13 - 8], ymm2"_s, "c4 c1 7e 7f 55 f8"_s, [](Backend& b) { b.vmovdqu(r13[-8], ymm2); }},
+    {"vmovups ymm2, ymmword ptr [r13 - 8]"_s, "c4 c1 7c 10 55 f8"_s, [](Backend& b) { b.vmovups(ymm2, r13[-8]); }},
+    {"vmovups ymmword ptr [r13 - 8], ymm2"_s, "c4 c1 7c 11 55 f8"_s, [](Backend& b) { b.vmovups(r13[-8], ymm2); }},
+    {"vbroadcastss ymm2, dword ptr [r13 - 8]"_s, "c4 c2 7d 18 55 f8"_s, [](Backend& b) { b.vbroadcastss(ymm2, r13[-8]); }},
+    {"movdqu xmm10, xmmword ptr [rip]"_s, "f3 44 0f 6f 15 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.movdqu(xmm10, rel32(l)); b.label(l); }},
+    {"vmovdqu ymm3, ymmword ptr [rip]"_s, "c5 fe 6f 1d 00 00 00 00"_s, [](Backend& b) { auto l = b.ph(); b.vmovdqu(ymm3, rel32(l)); b.label(l); }},
+    {"movaps xmm0, xmm1"_s, "0f 28 c1"_s, [](Backend& b) { b.movaps(xmm0, xmm1); }},
+    {"pshufb xmm0, xmm1"_s, "66 0f 38 00 c1"_s, [](Backend& b) { b.pshufb(xmm0, xmm1); }},
+    {"paddd xmm0, xmm1"_s, "66 0f fe c1"_s, [](Backend& b) { b.paddd(xmm0, xmm1); }},
+    {"addps xmm0, xmm1"_s, "0f 58 c1"_s, [](Backend& b) { b.addps(xmm0, xmm1); }},
+    {"addsd xmm0, xmm1"_s, "f2 0f 58 c1"_s, [](Backend& b) { b.addsd(xmm0, xmm1); }},
+    {"cvtss2sd xmm0, xmm1"_s, "f3 0f 5a c1"_s, [](Backend& b) { b.cvtss2sd(xmm0, xmm1); }},
+    {"pshufd xmm0, xmm1, 27"_s, "66 0f 70 c1 1b"_s, [](Backend& b) { b.pshufd(xmm0, xmm1, 27); }},
+    {"cmpleps xmm0, xmm1"_s, "0f c2 c1 02"_s, [](Backend& b) { b.cmpps(xmm0, xmm1, cmp_le); }},
+    {"movaps xmm8, xmm3"_s, "44 0f 28 c3"_s, [](Backend& b) { b.movaps(xmm8, xmm3); }},
+    {"pshufb xmm8, xmm3"_s, "66 44 0f 38 00 c3"_s, [](Backend& b) { b.pshufb(xmm8, xmm3); }},
+    {"paddd xmm8, xmm3"_s, "66 44 0f fe c3"_s, [](Backend& b) { b.paddd(xmm8, xmm3); }},
+    {"paddq xmm8, xmm3"_s, "66 44 0f d4 c3"_s, [](Backend& b) { b.paddq(xmm8, xmm3); }},
+    {"psubd xmm8, xmm3"_s, "66 44 0f fa c3"_s, [](Backend& b) { b.psubd(xmm8, xmm3); }},
+    {"pand xmm8, xmm3"_s, "66 44 0f db c3"_s, [](Backend& b) { b.pand(xmm8, xmm3); }},
+    {"por xmm8, xmm3"_s, "66 44 0f eb c3"_s, [](Backend& b) { b.por(xmm8, xmm3); }},
+    {"pxor xmm8, xmm3"_s, "66 44 0f ef c3"_s, [](Backend& b) { b.pxor(xmm8, xmm3); }},
+    {"pcmpeqb xmm8, xmm3"_s, "66 44 0f 74 c3"_s, [](Backend& b) { b.pcmpeqb(xmm8, xmm3); }},
+    {"pcmpeqd xmm8, xmm3"_s, "66 44 0f 76 c3"_s, [](Backend& b) { b.pcmpeqd(xmm8, xmm3); }},
+    {"pcmpgtd xmm8, xmm3"_s, "66 44 0f 66 c3"_s, [](Backend& b) { b.pcmpgtd(xmm8, xmm3); }},
+    {"addps xmm8, xmm3"_s, "44 0f 58 c3"_s, [](Backend& b) { b.addps(xmm8, xmm3); }},
+    {"subps xmm8, xmm3"_s, "44 0f 5c c3"_s, [](Backend& b) { b.subps(xmm8, xmm3); }},
+    {"mulps xmm8, xmm3"_s, "44 0f 59 c3"_s, [](Backend& b) { b.mulps(xmm8, xmm3); }},
+    {"divps xmm8, xmm3"_s, "44 0f 5e c3"_s, [](Backend& b) { b.divps(xmm8, xmm3); }},
+    {"minps xmm8, xmm3"_s, "44 0f 5d c3"_s, [](Backend& b) { b.minps(xmm8, xmm3); }},
+    {"maxps xmm8, xmm3"_s, "44 0f 5f c3"_s, [](Backend& b) { b.maxps(xmm8, xmm3); }},
+    {"addpd xmm8, xmm3"_s, "66 44 0f 58 c3"_s, [](Backend& b) { b.addpd(xmm8, xmm3); }},
+    {"subpd xmm8, xmm3"_s, "66 44 0f 5c c3"_s, [](Backend& b) { b.subpd(xmm8, xmm3); }},
+    {"mulpd xmm8, xmm3"_s, "66 44 0f 59 c3"_s, [](Backend& b) { b.mulpd(xmm8, xmm3); }},
+    {"divpd xmm8, xmm3"_s, "66 44 0f 5e c3"_s, [](Backend& b) { b.divpd(xmm8, xmm3); }},
+    {"addss xmm8, xmm3"_s, "f3 44 0f 58 c3"_s, [](Backend& b) { b.addss(xmm8, xmm3); }},
+    {"mulss xmm8, xmm3"_s, "f3 44 0f 59 c3"_s, [](Backend& b) { b.mulss(xmm8, xmm3); }},
+    {"addsd xmm8, xmm3"_s, "f2 44 0f 58 c3"_s, [](Backend& b) { b.addsd(xmm8, xmm3); }},
+    {"mulsd xmm8, xmm3"_s, "f2 44 0f 59 c3"_s, [](Backend& b) { b.mulsd(xmm8, xmm3); }},
+    {"cvtss2sd xmm8, xmm3"_s, "f3 44 0f 5a c3"_s, [](Backend& b) { b.cvtss2sd(xmm8, xmm3); }},
+    {"pshufd xmm8, xmm3, 27"_s, "66 44 0f 70 c3 1b"_s, [](Backend& b) { b.pshufd(xmm8, xmm3, 27); }},
+    {"cmpleps xmm8, xmm3"_s, "44 0f c2 c3 02"_s, [](Backend& b) { b.cmpps(xmm8, xmm3, cmp_le); }},
+    {"movaps xmm2, xmm15"_s, "41 0f 28 d7"_s, [](Backend& b) { b.movaps(xmm2, xmm15); }},
+    {"pshufb xmm2, xmm15"_s, "66 41 0f 38 00 d7"_s, [](Backend& b) { b.pshufb(xmm2, xmm15); }},
+    {"paddd xmm2, xmm15"_s, "66 41 0f fe d7"_s, [](Backend& b) { b.paddd(xmm2, xmm15); }},
+    {"addps xmm2, xmm15"_s, "41 0f 58 d7"_s, [](Backend& b) { b.addps(xmm2, xmm15); }},
+    {"addsd xmm2, xmm15"_s, "f2 41 0f 58 d7"_s, [](Backend& b) { b.addsd(xmm2, xmm15); }},
+    {"cvtss2sd xmm2, xmm15"_s, "f3 41 0f 5a d7"_s, [](Backend& b) { b.cvtss2sd(xmm2, xmm15); }},
+    {"pshufd xmm2, xmm15, 27"_s, "66 41 0f 70 d7 1b"_s, [](Backend& b) { b.pshufd(xmm2, xmm15, 27); }},
+    {"cmpleps xmm2, xmm15"_s, "41 0f c2 d7 02"_s, [](Backend& b) { b.cmpps(xmm2, xmm15, cmp_le); }},
+    {"vpshufb ymm0, ymm1, ymm2"_s, "c4 e2 75 00 c2"_s, [](Backend& b) { b.vpshufb(ymm0, ymm1, ymm2); }},
+    {"vpaddd ymm0, ymm1, ymm2"_s, "c5 f5 fe c2"_s, [](Backend& b) { b.vpaddd(ymm0, ymm1, ymm2); }},
+    {"vaddps ymm0, ymm1, ymm2"_s, "c5 f4 58 c2"_s, [](Backend& b) { b.vaddps(ymm0, ymm1, ymm2); }},
+    {"vcmpgt_oqps ymm0, ymm1, ymm2"_s, "c5 f4 c2 c2 1e"_s, [](Backend& b) { b.vcmpps(ymm0, ymm1, ymm2, cmp_gt); }},
+    {"vpshufb ymm8, ymm3, ymm12"_s, "c4 42 65 00 c4"_s, [](Backend& b) { b.vpshufb(ymm8, ymm3, ymm12); }},
+    {"vpaddd ymm8, ymm3, ymm12"_s, "c4 41 65 fe c4"_s, [](Backend& b) { b.vpaddd(ymm8, ymm3, ymm12); }},
+    {"vpaddq ymm8, ymm3, ymm12"_s, "c4 41 65 d4 c4"_s, [](Backend& b) { b.vpaddq(ymm8, ymm3, ymm12); }},
+    {"vpsubd ymm8, ymm3, ymm12"_s, "c4 41 65 fa c4"_s, [](Backend& b) { b.vpsubd(ymm8, ymm3, ymm12); }},
+    {"vpand ymm8, ymm3, ymm12"_s, "c4 41 65 db c4"_s, [](Backend& b) { b.vpand(ymm8, ymm3, ymm12); }},
+    {"vpor ymm8, ymm3, ymm12"_s, "c4 41 65 eb c4"_s, [](Backend& b) { b.vpor(ymm8, ymm3, ymm12); }},
+    {"vpxor ymm8, ymm3, ymm12"_s, "c4 41 65 ef c4"_s, [](Backend& b) { b.vpxor(ymm8, ymm3, ymm12); }},
+    {"vpcmpeqb ymm8, ymm3, ymm12"_s, "c4 41 65 74 c4"_s, [](Backend& b) { b.vpcmpeqb(ymm8, ymm3, ymm12); }},
+    {"vpcmpeqd ymm8, ymm3, ymm12"_s, "c4 41 65 76 c4"_s, [](Backend& b) { b.vpcmpeqd(ymm8, ymm3, ymm12); }},
+    {"vpcmpgtd ymm8, ymm3, ymm12"_s, "c4 41 65 66 c4"_s, [](Backend& b) { b.vpcmpgtd(ymm8, ymm3, ymm12); }},
+    {"vaddps ymm8, ymm3, ymm12"_s, "c4 41 64 58 c4"_s, [](Backend& b) { b.vaddps(ymm8, ymm3, ymm12); }},
+    {"vsubps ymm8, ymm3, ymm12"_s, "c4 41 64 5c c4"_s, [](Backend& b) { b.vsubps(ymm8, ymm3, ymm12); }},
+    {"vmulps ymm8, ymm3, ymm12"_s, "c4 41 64 59 c4"_s, [](Backend& b) { b.vmulps(ymm8, ymm3, ymm12); }},
+    {"vdivps ymm8, ymm3, ymm12"_s, "c4 41 64 5e c4"_s, [](Backend& b) { b.vdivps(ymm8, ymm3, ymm12); }},
+    {"vminps ymm8, ymm3, ymm12"_s, "c4 41 64 5d c4"_s, [](Backend& b) { b.vminps(ymm8, ymm3, ymm12); }},
+    {"vmaxps ymm8, ymm3, ymm12"_s, "c4 41 64 5f c4"_s, [](Backend& b) { b.vmaxps(ymm8, ymm3, ymm12); }},
+    {"vcmpgt_oqps ymm8, ymm3, ymm12"_s, "c4 41 64 c2 c4 1e"_s, [](Backend& b) { b.vcmpps(ymm8, ymm3, ymm12, cmp_gt); }},
+    {"vpshufb ymm2, ymm15, ymm9"_s, "c4 c2 05 00 d1"_s, [](Backend& b) { b.vpshufb(ymm2, ymm15, ymm9); }},
+    {"vpaddd ymm2, ymm15, ymm9"_s, "c4 c1 05 fe d1"_s, [](Backend& b) { b.vpaddd(ymm2, ymm15, ymm9); }},
+    {"vaddps ymm2, ymm15, ymm9"_s, "c4 c1 04 58 d1"_s, [](Backend& b) { b.vaddps(ymm2, ymm15, ymm9); }},
+    {"vcmpgt_oqps ymm2, ymm15, ymm9"_s, "c4 c1 04 c2 d1 1e"_s, [](Backend& b) { b.vcmpps(ymm2, ymm15, ymm9, cmp_gt); }},
+    {"movq xmm1, rax"_s, "66 48 0f 6e c8"_s, [](Backend& b) { b.movq(xmm1, rax); }},
+    {"movq rax, xmm1"_s, "66 48 0f 7e c8"_s, [](Backend& b) { b.movq(rax, xmm1); }},
+    {"pmovmskb eax, xmm1"_s, "66 0f d7 c1"_s, [](Backend& b) { b.pmovmskb(rax, xmm1); }},
+    {"movmskps eax, xmm1"_s, "0f 50 c1"_s, [](Backend& b) { b.movmskps(rax, xmm1); }},
+    {"vpmovmskb eax, ymm1"_s, "c5 fd d7 c1"_s, [](Backend& b) { b.vpmovmskb(rax, ymm1); }},
+    {"vmovmskps eax, ymm1"_s, "c5 fc 50 c1"_s, [](Backend& b) { b.vmovmskps(rax, ymm1); }},
+    {"movq xmm12, r9"_s, "66 4d 0f 6e e1"_s, [](Backend& b) { b.movq(xmm12, r9); }},
+    {"movq r9, xmm12"_s, "66 4d 0f 7e e1"_s, [](Backend& b) { b.movq(r9, xmm12); }},
+    {"pmovmskb r9d, xmm12"_s, "66 45 0f d7 cc"_s, [](Backend& b) { b.pmovmskb(r9, xmm12); }},
+    {"movmskps r9d, xmm12"_s, "45 0f 50 cc"_s, [](Backend& b) { b.movmskps(r9, xmm12); }},
+    {"vpmovmskb r9d, ymm12"_s, "c4 41 7d d7 cc"_s, [](Backend& b) { b.vpmovmskb(r9, ymm12); }},
+    {"vmovmskps r9d, ymm12"_s, "c4 41 7c 50 cc"_s, [](Backend& b) { b.vmovmskps(r9, ymm12); }},
+    {"vzeroupper"_s, "c5 f8 77"_s, [](Backend& b) { b.vzeroupper(); }},
+};
+
+}
+
+void test_backend() {
+  for (auto& e: encodings) {
+    Stream out;
+    Backend b {out};
+    e.emit(b);
+    Print actual;
+    for (u32 i {}; i < len(out); ++i) {
+      if (i)
+        sprint(actual, ' ');
+      sprint(actual, hex(u8(out[i] >> 4)), hex(u8(out[i])));
+    }
+    if (actual.chars.span() != e.bytes) {
+      println(e.text, ": expected "_s, e.bytes, ", got "_s, actual.chars.span());
+      check(false);
+    }
+  }
+  {
+    // An appended block keeps the jumps it resolved itself and hands over
+    // those to labels placed later.
+    Stream out1, out2;
+    Backend b1 {out1}, b2 {out2};
+    auto skip = b1.ph(), end = b1.ph();
+    b1.mov(rax, 1u);
+    b2.jmp(rel8(skip));
+    b2.ret();
+    b2.label(skip);
+    b2.jmp(rel32(end));
+    b2.ret();
+    append(b1, b2);
+    b1.label(end);
+    b1.add(rax, 1);
+    b1.ret();
+    Executable exec {out1.span()};
+    check(exec.as<u64>()() == 2);
+  }
+  {
+    // Relaxed jumps are short where they reach: back to `top`, and forward
+    // to `done`.
+    Stream out;
+    Backend b {out};
+    auto top = b.ph(), far = b.ph(), done = b.ph();
+    b.mov(rax, 0u);
+    b.label(top);
+    b.add(rax, 1);
+    b.cmp(rax, u8(3));
+    b.jcc(less, relaxed(top));
+    b.jmp(relaxed(far));
+    for (u32 i {}; i < 200; ++i)
+      b.literal("\xcc"_s);
+    b.label(far);
+    b.jcc(equal, relaxed(done));
+    b.add(rax, 100);
+    b.label(done);
+    b.ret();
+    b.relax();
+    check(len(out) == 7 + 4 + 4 + 2 + 5 + 200 + 2 + 4 + 1);
+    Executable exec {out.span()};
+    check(exec.as<u64>()() == 3);
+  }
+  {
+    // The first jump reaches its target until the second one grows, and
+    // jumps to placeholders placed later are long.
+    Stream out;
+    Backend b {out};
+    auto near = b.ph(), far = b.ph(), later = b.ph();
+    b.jmp(relaxed(near));
+    b.jmp(relaxed(far));
+    for (u32 i {}; i < 124; ++i)
+      b.literal("\xcc"_s);
+    b.label(near);
+    b.mov(rax, 7u);
+    b.jmp(relaxed(later));
+    for (u32 i {}; i < 200; ++i)
+      b.literal("\xcc"_s);
+    b.label(far);
+    b.ret();
+    b.relax();
+    b.label(later);
+    b.ret();
+    check(len(out) == 5 + 5 + 124 + 7 + 5 + 200 + 1 + 1);
+    Executable exec {out.span()};
+    check(exec.as<u64>()() == 7);
+  }
+  {
+    // A rel8 jump back across a relaxed one that grows is re-patched.
+    Stream out;
+    Backend b {out};
+    auto top = b.ph(), done = b.ph();
+    b.mov(rax, 0u);
+    b.label(top);
+    b.add(rax, 1);
+    b.cmp(rax, u8(3));
+    b.jcc(greater_equal, relaxed(done));
+    b.jmp(rel8(top));
+    for (u32 i {}; i < 200; ++i)
+      b.literal("\xcc"_s);
+    b.label(done);
+    b.ret();
+    check(b.jumps_pending());
+    b.relax();
+    check(!b.jumps_pending());
+    check(len(out) == 7 + 4 + 4 + 6 + 2 + 200 + 1);
+    Executable exec {out.span()};
+    check(exec.as<u64>()() == 3);
+  }
+  {
+    // Small routines share pages, and pages freed are used again.
+    CodeArena arena;
+    static constexpr u32 n = 1000;
+    void* fns[n];
+    u32 sizes[n];
+    for (u32 round {}; round < 2; ++round) {
+      for (u32 i {}; i < n; ++i) {
+        Stream out;
+        Backend b {out};
+        b.mov(rax, i + round);
+        b.ret();
+        fns[i] = arena.add(out.span());
+        sizes[i] = len(out);
+      }
+      arena.seal();
+      for (u32 i {}; i < n; ++i)
+        check(reinterpret_cast<u64 (*)()>(fns[i])() == i + round);
+      for (u32 i {}; i < n; ++i)
+        arena.free(fns[i], sizes[i]);
+      check(len(arena.regions) == 1);
+      u32 pages = u32((arena.end - arena.batch) / arena.page_size);
+      for (auto run: arena.free_pages)
+        pages += run.pages;
+      check(pages == arena.regions[0].pages);
+    }
+  }
+  {
+    // Byte-swaps four u32s with a shuffle mask placed after the code.
+    Stream out;
+    Backend b {out};
+    auto mask = b.ph();
+    b.movdqu(xmm9, rel32(mask));
+    b.movdqu(xmm1, rdi[0]);
+    b.pshufb(xmm1, xmm9);
+    b.movdqu(rdi[0], xmm1);
+    b.ret();
+    b.label(mask);
+    b.literal("\3\2\1\0\7\6\5\4\13\12\11\10\17\16\15\14"_s);
+    Executable exec {out.span()};
+    u32 xs[] {0x01020304, 0xa0b0c0d0, 1, 0xffff0000};
+    exec.as<void, u32*>()(xs);
+    check(xs[0] == 0x04030201 && xs[1] == 0xd0c0b0a0);
+    check(xs[2] == 0x01000000 && xs[3] == 0x0000ffff);
+  }
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx")) {
+    // Which of eight floats are above a threshold, as a bit mask.
+    Stream out;
+    Backend b {out};
+    b.vmovups(ymm0, rdi[0]);
+    b.vbroadcastss(ymm1, rsi[0]);
+    b.vcmpps(ymm2, ymm0, ymm1, cmp_gt);
+    b.vmovmskps(rax, ymm2);
+    b.vzeroupper();
+    b.ret();
+    Executable exec {out.span()};
+    f32 xs[] {0.f, 1.f, -1.f, .5f, .75f, 2.f, .25f, 9.f};
+    f32 threshold = .5f;
+    check(exec.as<u32, f32 const*, f32 const*>()(xs, &threshold) == 0b10110010);
+  }
+  {
+    // Peephole rewrites keep the meaning of the code.
+    auto emit = [](Backend& b) {
+      b.mov(rax, u64(5));
+      b.mov(rdx, u64(-2));
+      b.push(rax);
+      b.pop(rcx);
+      b.push(rdx);
+      b.pop(rdx);
+      b.mov(rcx, rcx);
+      b.add(rsp, -8);
+      b.add(rsp, 8);
+      b.add(rsp, -16);
+      b.add(rsp, 8);
+      b.push(u32(1));
+      b.mov(rax, rcx);
+      b.mov(rcx, rax);
+      b.add(rax, rdx);
+      b.add(rax, rsp[0]);
+      b.add(rsp, 16);
+      b.ret();
+    };
+    for (u32 peephole {}; peephole < 2; ++peephole) {
+      Stream out;
+      Backend b {out};
+      b.peephole = peephole;
+      emit(b);
+      check(peephole ? len(out) == 5 + 7 + 3 + 4 + 2 + 3 + 3 + 4 + 4 + 1 : len(out) > 60);
+      Executable exec {out.span()};
+      check(exec.as<u64>()() == 4);
+    }
+  }
+#ifdef __linux__
+  {
+    // Named routines are listed for perf only while enabled.
+    Stream out;
+    Backend b {out};
+    b.mov(rax, 42u);
+    b.ret();
+    enable_perf_map(true);
+    Executable exec {out.span(), "answer"_s};
+    Executable unnamed {out.span()};
+    disable_perf_map();
+    Executable later {out.span(), "later"_s};
+    check(exec.as<u64>()() == 42);
+
+    char got[256];
+    auto read_back = [&](String const& path) {
+      int fd = open(path.begin(), O_RDONLY);
+      check(fd >= 0);
+      iptr n = ::read(fd, got, sizeof(got));
+      check(n >= 0 && !close(fd) && !unlink(path.begin()));
+      return Str {got, u32(n)};
+    };
+    Print line;
+    auto hex = [](u64 x) { return [=](Print& p) { print_hex(x, p); }; };
+    sprint(line, hex(u64(exec.data)), ' ', hex(len(out)), " answer\n");
+    check(read_back(perf_path("perf", ".map")) == line.chars.span());
+    auto dump = read_back(perf_path("jit", ".dump"));
+    check(len(dump) == 40 + 56 + 7 + len(out));
+    u32 magic, record, size;
+    memcpy(&magic, dump.begin(), 4);
+    memcpy(&record, dump.begin() + 40, 4);
+    memcpy(&size, dump.begin() + 44, 4);
+    check(magic == 0x4a695444 && record == 0 && size == 56 + 7 + len(out));
+    check(Str {dump.begin() + 96, 7} == Str {"answer", 7});
+    check(Str {dump.begin() + 103, len(out)} == out.span());
+  }
+#endif
+  println("Backend tests passed");
 }
@@ -2,8 +2,6 @@
 
 #include "common.hh"
 
-#include <map>
-#include <vector>
 #include <ostream>
 
 namespace lang {
@@ -49,6 +47,54 @@ inline std::ostream& operator<<(std::ostream& os, const reg64& r) {
   return os << reg64_names[r.id];
 }
 
+// The SSE registers.
+struct xmm {
+  u8 id;
+  constexpr explicit xmm(u8 id): id(id) {}
+  constexpr bool operator==(const xmm& b) const { return id == b.id; }
+};
+
+static constexpr xmm xmm0  {0};
+static constexpr xmm xmm1  {1};
+static constexpr xmm xmm2  {2};
+static constexpr xmm xmm3  {3};
+static constexpr xmm xmm4  {4};
+static constexpr xmm xmm5  {5};
+static constexpr xmm xmm6  {6};
+static constexpr xmm xmm7  {7};
+static constexpr xmm xmm8  {8};
+static constexpr xmm xmm9  {9};
+static constexpr xmm xmm10 {10};
+static constexpr xmm xmm11 {11};
+static constexpr xmm xmm12 {12};
+static constexpr xmm xmm13 {13};
+static constexpr xmm xmm14 {14};
+static constexpr xmm xmm15 {15};
+
+// The same registers as a whole 256 bits, for AVX.
+struct ymm {
+  u8 id;
+  constexpr explicit ymm(u8 id): id(id) {}
+  constexpr bool operator==(const ymm& b) const { return id == b.id; }
+};
+
+static constexpr ymm ymm0  {0};
+static constexpr ymm ymm1  {1};
+static constexpr ymm ymm2  {2};
+static constexpr ymm ymm3  {3};
+static constexpr ymm ymm4  {4};
+static constexpr ymm ymm5  {5};
+static constexpr ymm ymm6  {6};
+static constexpr ymm ymm7  {7};
+static constexpr ymm ymm8  {8};
+static constexpr ymm ymm9  {9};
+static constexpr ymm ymm10 {10};
+static constexpr ymm ymm11 {11};
+static constexpr ymm ymm12 {12};
+static constexpr ymm ymm13 {13};
+static constexpr ymm ymm14 {14};
+static constexpr ymm ymm15 {15};
+
 enum reg32 {
   eax = 0,
   ecx = 1,
@@ -58,6 +104,14 @@ enum reg32 {
   ebp = 5,
   esi = 6,
   edi = 7,
+  r8d = 8,
+  r9d = 9,
+  r10d = 10,
+  r11d = 11,
+  r12d = 12,
+  r13d = 13,
+  r14d = 14,
+  r15d = 15,
 };
 
 enum reg16 {
@@ -65,8 +119,23 @@ enum reg16 {
   cx = 1,
   dx = 2,
   bx = 3,
+  sp = 4,
+  bp = 5,
+  si = 6,
+  di = 7,
+  r8w = 8,
+  r9w = 9,
+  r10w = 10,
+  r11w = 11,
+  r12w = 12,
+  r13w = 13,
+  r14w = 14,
+  r15w = 15,
 };
 
+// The byte registers without a REX prefix. ah to bh can't be used with one,
+// so can't be paired with r8 to r15; lreg8 names the low byte of any of the
+// 16 registers.
 enum reg8 {
   al = 0,
   cl = 1,
@@ -87,6 +156,7 @@ struct lreg8 {
   // bpl = 5,
   // sil = 6,
   // dil = 7,
+  // r8b to r15b = 8 to 15
   u8 id;
   lreg8(u8 id): id(id) {}
 };
@@ -98,6 +168,34 @@ enum dreg8 {
   dil = 7,
 };
 
+// Condition codes, as encoded in the low nibble of jcc and setcc.
+enum cond_t: u8 {
+  below = 0x2,
+  above_equal = 0x3,
+  equal = 0x4,
+  not_equal = 0x5,
+  below_equal = 0x6,
+  above = 0x7,
+  less = 0xc,
+  greater_equal = 0xd,
+  less_equal = 0xe,
+  greater = 0xf,
+};
+
+// Float compare predicates. Those past cmp_ord need AVX.
+enum cmp_t: u8 {
+  cmp_eq = 0x0,
+  cmp_lt = 0x1,
+  cmp_le = 0x2,
+  cmp_unord = 0x3,
+  cmp_neq = 0x4,
+  cmp_nlt = 0x5,
+  cmp_nle = 0x6,
+  cmp_ord = 0x7,
+  cmp_ge = 0x1d,
+  cmp_gt = 0x1e,
+};
+
 enum fd_t {
   stderr_ = 0,
   stdout_ = 1
@@ -134,12 +232,18 @@ struct rel32_linkable_address {
   placeholder ph;
 };
 
+// A jump whose size `Backend::relax` picks.
+struct relaxed_linkable_address {
+  placeholder ph;
+};
+
 constexpr rel8_linkable_address rel8(placeholder x) { return {x}; }
 
 constexpr rel32_linkable_address rel32(placeholder x) { return {x}; }
 
+constexpr relaxed_linkable_address relaxed(placeholder x) { return {x}; }
+
 inline lreg8 lowest8(reg64 r) {
-  check(r.id < 8); // TODO: Need to support for extended ones?
   return lreg8(r.id);
 }
 
@@ -147,17 +251,70 @@ struct Backend {
 
   Stream& output;
 
-  u32 placeholder_counter {};
-
   // Create a new unique placeholder.
   placeholder ph();
 
-  // Labels that have been placed in this backend block.
-  std::map<placeholder, offset> labels {};
-
-  // Locations in this backend block that refer to specific placeholders.
-  std::map<placeholder, std::vector<offset>> refs8 {};
-  std::map<placeholder, std::vector<offset>> refs32 {};
+  static constexpr offset unplaced = ~offset(0);
+  static constexpr u32 no_fixup = ~0u;
+
+  // Where each placeholder has been placed in this backend block, indexed
+  // by placeholder, or `unplaced`.
+  List<offset> labels {};
+
+  // A location in this backend block that refers to a placeholder. All are
+  // kept so that `relax` can move code. The fixups of a placeholder not yet
+  // placed are chained through `next`.
+  struct Fixup {
+    u32 at;
+    u32 next;
+    placeholder ph;
+    bool rel8;
+  };
+  List<Fixup> fixups {};
+  // The last fixup of each placeholder not yet placed, or `no_fixup`.
+  List<u32> pending {};
+
+  // Jumps emitted in their short form until `relax` sizes them. `opcode` is
+  // that of the short form.
+  struct RelaxedJump {
+    u32 at;
+    placeholder ph;
+    u8 opcode;
+  };
+  List<RelaxedJump> jumps {};
+
+  // Gives each relaxed jump its short form where the displacement fits, and
+  // the long one elsewhere, moving code to make room. Starting from all
+  // short, jumps are lengthened until none needs to be, since lengthening
+  // one can push another out of reach. Jumps to placeholders not yet placed
+  // are made long. Call this before using the output. Jumps given as rel8
+  // must stay in reach of their labels as code moves.
+  void relax();
+  // Whether relaxed jumps are still in their placeholder short form, which
+  // doesn't jump anywhere; the output can't be used until they're sized.
+  bool jumps_pending() const { return len(jumps); }
+
+  // Rewrites made as instructions are emitted, off by default. Each looks
+  // only at the instruction just before, and only if nothing has been
+  // emitted or placed since:
+  // - `mov r, imm64` takes the shortest encoding of its value, and
+  //   `push imm32` the imm8 one where it fits.
+  // - `add rsp, a; add rsp, b` become one adjustment, or none. The flags
+  //   are those of the sum.
+  // - `push r1; pop r2` become `mov r2, r1`, or nothing.
+  // - `mov r, r` and `mov a, b; mov b, a` lose the redundant move.
+  bool peephole {};
+  // The last instruction emitted, which is the peephole window while the
+  // output ends with it.
+  struct Recent {
+    enum Kind: u8 { None, AddRsp, Push, Move } kind;
+    reg64 a;
+    reg64 b;
+    i32 n;
+    u32 at;
+    u32 end;
+  };
+  Recent recent {};
 
   void label(placeholder x);
 
@@ -180,6 +337,7 @@ struct Backend {
   void idiv(reg32 r);
   void mul(reg64 r);
   void imul(reg64 r);
+  void imul(reg64 r1, reg64 r2);
 
   void jmp(rel8_linkable_address);
   void jmp(rel32_linkable_address);
@@ -189,6 +347,9 @@ struct Backend {
   void jne(rel8_linkable_address);
   void jne(rel32_linkable_address);
   void jge(rel8_linkable_address);
+  void jcc(cond_t c, rel32_linkable_address);
+  void jmp(relaxed_linkable_address);
+  void jcc(cond_t c, relaxed_linkable_address);
 
   void shl(reg64 r, u8 a);
   void shl(reg16 r, u8 a);
@@ -208,9 +369,11 @@ struct Backend {
   void test(reg32 r1, reg32 r2);
   void test(reg64 r1, reg64 r2);
   void cmp(reg64 r1, reg64 r2);
+  void cmp(reg64 r1, indir<reg64> r2);
   void cmp(reg64 r, u8 n);
   void cmp(reg32 r, u8 n);
   void cmp(reg8 r, u8 n);
+  void cmp(lreg8 r, u8 n);
   void sete(reg8 r);
   void sete(lreg8 r);
   void sete(dreg8 r);
@@ -229,15 +392,28 @@ struct Backend {
   void mov(reg64 r, i64 n);
   void mov(reg8 r1, indir<reg64> r2);
   void mov(dreg8 r1, indir<reg64> r2);
+  void mov(lreg8 r1, indir<reg64> r2);
   void mov(indir<reg64> r1, reg64 r2);
   void mov(indir<reg64>, u32);
   void mov(indir<reg64>, u8);
   void mov(indir<reg64>, reg8);
   void mov(indir<reg64>, dreg8);
+  void mov(indir<reg64>, lreg8);
   void mov(reg64 r1, indir<reg64> r2);
   void mov(reg32 r1, indir<reg64> r2);
   void mov(reg64 r, rel32_linkable_address a);
 
+  // Zero-extending byte load.
+  void movzx(reg32 r1, indir<reg64> r2);
+
+  // Zero-extending loads into any of the 16 registers.
+  void movzx8(reg64 r1, indir<reg64> r2);
+  void movzx16(reg64 r1, indir<reg64> r2);
+  void movsx8(reg64 r1, indir<reg64> r2);
+  void movsx16(reg64 r1, indir<reg64> r2);
+  void movsx32(reg64 r1, indir<reg64> r2);
+  void mov32(reg64 r1, indir<reg64> r2);
+
   // Convenient wrappers to prevent some ambiguity errors.
   void mov(indir<reg64> r, char n) { mov(r, u8(n)); }
 
@@ -254,15 +430,154 @@ struct Backend {
   void xor_(reg64 r, u8 n);
   void xor_(reg64 r1, reg64 r2);
 
+  // SSE. Loads and stores need no alignment; loading a scalar clears the
+  // rest of the register.
+  void movdqu(xmm r1, indir<reg64> r2);
+  void movdqu(indir<reg64> r1, xmm r2);
+  void movdqu(xmm r, rel32_linkable_address a);
+  void movups(xmm r1, indir<reg64> r2);
+  void movups(indir<reg64> r1, xmm r2);
+  void movss(xmm r1, indir<reg64> r2);
+  void movss(indir<reg64> r1, xmm r2);
+  void movsd(xmm r1, indir<reg64> r2);
+  void movsd(indir<reg64> r1, xmm r2);
+  void movaps(xmm r1, xmm r2);
+  void movq(xmm r1, reg64 r2);
+  void movq(reg64 r1, xmm r2);
+
+  void pshufb(xmm r1, xmm r2);
+  void pshufd(xmm r1, xmm r2, u8 order);
+  void paddd(xmm r1, xmm r2);
+  void paddq(xmm r1, xmm r2);
+  void psubd(xmm r1, xmm r2);
+  void pand(xmm r1, xmm r2);
+  void por(xmm r1, xmm r2);
+  void pxor(xmm r1, xmm r2);
+  void pcmpeqb(xmm r1, xmm r2);
+  void pcmpeqd(xmm r1, xmm r2);
+  void pcmpgtd(xmm r1, xmm r2);
+  // The top bit of each byte, or of each float, as a mask.
+  void pmovmskb(reg64 r1, xmm r2);
+  void movmskps(reg64 r1, xmm r2);
+
+  void addps(xmm r1, xmm r2);
+  void subps(xmm r1, xmm r2);
+  void mulps(xmm r1, xmm r2);
+  void divps(xmm r1, xmm r2);
+  void minps(xmm r1, xmm r2);
+  void maxps(xmm r1, xmm r2);
+  void addpd(xmm r1, xmm r2);
+  void subpd(xmm r1, xmm r2);
+  void mulpd(xmm r1, xmm r2);
+  void divpd(xmm r1, xmm r2);
+  void addss(xmm r1, xmm r2);
+  void mulss(xmm r1, xmm r2);
+  void addsd(xmm r1, xmm r2);
+  void mulsd(xmm r1, xmm r2);
+  void cvtss2sd(xmm r1, xmm r2);
+  void cmpps(xmm r1, xmm r2, cmp_t c);
+
+  // AVX over all 256 bits, with the result in the first operand.
+  void vmovdqu(ymm r1, indir<reg64> r2);
+  void vmovdqu(indir<reg64> r1, ymm r2);
+  void vmovdqu(ymm r, rel32_linkable_address a);
+  void vmovups(ymm r1, indir<reg64> r2);
+  void vmovups(indir<reg64> r1, ymm r2);
+  void vbroadcastss(ymm r1, indir<reg64> r2);
+
+  // Shuffles bytes within each 128-bit half.
+  void vpshufb(ymm r1, ymm r2, ymm r3);
+  void vpaddd(ymm r1, ymm r2, ymm r3);
+  void vpaddq(ymm r1, ymm r2, ymm r3);
+  void vpsubd(ymm r1, ymm r2, ymm r3);
+  void vpand(ymm r1, ymm r2, ymm r3);
+  void vpor(ymm r1, ymm r2, ymm r3);
+  void vpxor(ymm r1, ymm r2, ymm r3);
+  void vpcmpeqb(ymm r1, ymm r2, ymm r3);
+  void vpcmpeqd(ymm r1, ymm r2, ymm r3);
+  void vpcmpgtd(ymm r1, ymm r2, ymm r3);
+  void vpmovmskb(reg64 r1, ymm r2);
+  void vmovmskps(reg64 r1, ymm r2);
+
+  void vaddps(ymm r1, ymm r2, ymm r3);
+  void vsubps(ymm r1, ymm r2, ymm r3);
+  void vmulps(ymm r1, ymm r2, ymm r3);
+  void vdivps(ymm r1, ymm r2, ymm r3);
+  void vminps(ymm r1, ymm r2, ymm r3);
+  void vmaxps(ymm r1, ymm r2, ymm r3);
+  void vcmpps(ymm r1, ymm r2, ymm r3, cmp_t c);
+
+  // Clears the upper halves, which avoids a slow transition before SSE code
+  // runs, e.g. on returning to the caller.
+  void vzeroupper();
+
   void dump_output();
 };
 
 void append(Backend& b1, const Backend& b2);
 
+// Packs compiled routines into large mapped regions, whose pages are never
+// writable and executable at once. Routines are added in batches: `add`
+// copies code into writable pages, and `seal` makes them executable with one
+// mprotect per run of pages. A batch starts on a fresh page, so that sealed
+// code never needs to be made writable again. Routines stay where they are
+// until freed; a page whose routines are all freed is reused by a later
+// batch. An arena is used from one thread at a time.
+struct CodeArena {
+  struct Region {
+    char* base;
+    u32 pages;
+    // The bytes of routines in each page. A page without any is free.
+    Array<u32> live;
+  };
+
+  struct Run {
+    char* at;
+    u32 pages;
+  };
+
+  u32 page_size;
+  List<Region> regions;
+  List<Run> free_pages;
+  // The current batch is written from `batch` to `at`; the pages up to `end`
+  // are writable.
+  char* batch {};
+  char* at {};
+  char* end {};
+  // Earlier parts of the current batch, in other runs.
+  List<Run> written;
+
+  CodeArena();
+  CodeArena(CodeArena const&) = delete;
+  ~CodeArena();
+
+  // Copies `code` in and returns where it will run once sealed.
+  void* add(Str code);
+  // Makes everything added since the last seal executable.
+  void seal();
+  void free(void* code, u32 size);
+};
+
+// The arena that Executables use unless given another.
+CodeArena& code_arena();
+
+// Names compiled routines for perf. While enabled, each Executable given a
+// name is listed in /tmp/perf-<pid>.map, and with `jitdump` also written
+// with its code to /tmp/jit-<pid>.dump for `perf inject --jit` (record with
+// `perf record -k mono`). While disabled, a name costs one pointer test.
+// Elsewhere than Linux, where there is no perf, this does nothing.
+void enable_perf_map(bool jitdump = false);
+void disable_perf_map();
+
 struct Executable {
+  CodeArena& arena;
   void* data;
   u32 size;
-  Executable(Str);
+  // Adds `code` to the shared arena and seals it. `name` is what perf shows
+  // for it, if enabled.
+  Executable(Str code, Str name = {});
+  // Adds `code` to `arena`, which must be sealed before the code runs.
+  Executable(CodeArena& arena, Str code, Str name = {});
   Executable(Executable const&) = delete;
   ~Executable();
   template <class Ret, class... Arg>
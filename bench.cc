@@ -0,0 +1,542 @@
+#include "columns.hh"
+#include "export.hh"
+#include "format.hh"
+#include "jit-print.hh"
+#include "kernels.hh"
+#include "log.hh"
+#include "validate.hh"
+
+#include <cstdio>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <x86intrin.h>
+#include <unistd.h>
+
+void prog1(lang::Backend&);
+void prog2(lang::Backend&);
+extern void (*prog1_print)(char const*, u32);
+extern void (*prog2_print)(u64 const*);
+
+namespace {
+
+f64 now() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return f64(t.tv_sec) + f64(t.tv_nsec) * 1e-9;
+}
+
+template <class T>
+void put(Stream& s, T const& x) {
+  memcpy(s.reserve(sizeof(T)), &x, sizeof(T));
+  s.size += sizeof(T);
+}
+
+u32 rng_state = 1;
+u32 rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+constexpr Str ran_dod_schema = R"(struct RanDod
+  abs_mean[6] f32
+  rel_mean[6] f32
+  amb_count u32
+  amb_sd[amb_count] i8
+  amb_prn[amb_count] u8
+)"_s;
+
+// `n` back-to-back RanDod records with 0 to 15 ambiguities each.
+String ran_dod_records(u32 n) {
+  Stream s;
+  for (u32 i {}; i < n; ++i) {
+    for (u32 j: range(12))
+      put(s, f32(rng() % 2000) * 0.001f + f32(j));
+    u32 count = rng() % 16;
+    put(s, count);
+    for (u32 j {}; j < 2 * count; ++j)
+      put(s, u8(rng()));
+  }
+  return s.take();
+}
+
+void report(Str name, u32 n, f64 seconds) {
+  println(
+      name, ": "_s, u32(f64(n) / seconds), " records/s, "_s,
+      u32(seconds * 1e9 / f64(n)), " ns/record"_s);
+}
+
+void bench_jit_print() {
+  auto l = parse(ran_dod_schema);
+  auto type = l.type("RanDod"_s);
+  JitPrinter jit {l, "RanDod"_s};
+
+  static constexpr u32 n = 200000;
+  auto records = ran_dod_records(n);
+
+  // Both paths walk the same records; the interpreter is given each record's
+  // start from the JIT'd pass so only printing is timed.
+  List<char const*> starts;
+  Print p;
+  for (char const* it = records.begin(); it != records.end();) {
+    starts.push(it);
+    it = jit(p, it);
+    p.chars.size = 0;
+  }
+
+  auto t0 = now();
+  for (auto it: starts) {
+    print_struct(p, l, type, Str {it, records.end()});
+    if (len(p.chars) > 1 << 20)
+      p.chars.size = 0;
+  }
+  auto t1 = now();
+  for (auto it: starts) {
+    jit(p, it);
+    if (len(p.chars) > 1 << 20)
+      p.chars.size = 0;
+  }
+  auto t2 = now();
+
+  report("print_struct"_s, n, t1 - t0);
+  report("JitPrinter"_s, n, t2 - t1);
+}
+
+// Compiling printers for a chain of structs that each nest the one before,
+// so that the last one pulls in all of them.
+void bench_codegen() {
+  static constexpr u32 structs = 300;
+  Print schema;
+  for (u32 i {}; i < structs; ++i) {
+    sprint(schema, "struct S"_s, i, "\n  count u8\n  xs[count] f32\n"_s);
+    sprint(schema, "  id u32\n  tags[4] u16\n"_s);
+    if (i)
+      sprint(schema, "  prev S"_s, i - 1, '\n');
+    sprint(schema, "  tail u64\n\n"_s);
+  }
+  schema.chars.push('\0');
+  auto l = parse(schema.chars.span());
+  Print root;
+  sprint(root, "S"_s, structs - 1);
+  u32 index = l.struct_index(root.chars.span());
+
+  static constexpr u32 n = 50;
+  u64 bytes {};
+  auto t0 = now();
+  for (u32 i {}; i < n; ++i)
+    bytes += len(compile_printer(l, index));
+  auto t1 = now();
+  println(
+      "compile_printer: "_s, u32((t1 - t0) * 1e9 / (n * structs)),
+      " ns/struct, "_s, bytes / n, " bytes"_s);
+}
+
+// Code size and run time of the example programs with and without peephole
+// rewrites. The programs' print stubs are swapped for no-ops, so that only
+// the emitted code is timed; cycles are those of the time stamp counter.
+void bench_peephole() {
+  auto print1 = ::exchange(prog1_print, [](char const*, u32) {});
+  auto print2 = ::exchange(prog2_print, [](u64 const*) {});
+  Str names[] {"prog1"_s, "prog2"_s};
+  void (*programs[])(lang::Backend&) {prog1, prog2};
+  static constexpr u32 n = 20000;
+  for (u32 i {}; i < 2; ++i) {
+    u32 bytes[2];
+    f64 cycles[2];
+    for (u32 peephole {}; peephole < 2; ++peephole) {
+      Stream out;
+      lang::Backend b {out};
+      b.peephole = peephole;
+      programs[i](b);
+      bytes[peephole] = len(out);
+      lang::Executable exec {out.span()};
+      auto fn = exec.as<void>();
+      // The best of several rounds, as the programs are short.
+      cycles[peephole] = 1e9;
+      for (u32 round {}; round < 10; ++round) {
+        u64 t0 = __rdtsc();
+        for (u32 k {}; k < n; ++k)
+          fn();
+        f64 c = f64(__rdtsc() - t0) / n;
+        cycles[peephole] = c < cycles[peephole] ? c : cycles[peephole];
+      }
+    }
+    println(
+        "peephole "_s, names[i], ": "_s, bytes[0], " -> "_s, bytes[1],
+        " bytes, "_s, u32(cycles[0]), " -> "_s, u32(cycles[1]),
+        " cycles/run"_s);
+  }
+  prog1_print = print1;
+  prog2_print = print2;
+}
+
+// Installing many small routines with a mapping each, as Executable used
+// to, one at a time with Executable(Str), which seals each onto a fresh page,
+// and as one batch in a CodeArena.
+void bench_code_arena() {
+  static constexpr u32 n = 2000;
+  Stream out;
+  lang::Backend b {out};
+  b.mov(lang::rax, 1u);
+  b.ret();
+  auto code = out.span();
+
+  List<void*> fns;
+  auto t0 = now();
+  for (u32 i {}; i < n; ++i) {
+    void* p = mmap(
+        0, len(code), PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memcpy(p, code.begin(), len(code));
+    fns.push(p);
+  }
+  for (auto p: fns)
+    munmap(p, len(code));
+  auto t1 = now();
+  {
+    Array<lang::Executable*> execs(n);
+    for (auto& e: execs)
+      e = new lang::Executable(code);
+    for (auto e: execs)
+      delete e;
+  }
+  auto t2 = now();
+  fns.size = 0;
+  lang::CodeArena arena;
+  for (u32 i {}; i < n; ++i)
+    fns.push(arena.add(code));
+  arena.seal();
+  for (auto p: fns)
+    arena.free(p, len(code));
+  auto t3 = now();
+  println(
+      "install routines: mmap each "_s, u32((t1 - t0) * 1e9 / n),
+      " ns, Executable each "_s, u32((t2 - t1) * 1e9 / n),
+      " ns, arena batch "_s, u32((t3 - t2) * 1e9 / n), " ns"_s);
+}
+
+// Decoding a whole mapped log with 1 to 8 threads. Scaling stops at the
+// number of cores this machine has (core_count()).
+void bench_parallel_decode() {
+  auto l = parse(R"(struct RanDod
+  abs_mean[6] f32
+  rel_mean[6] f32
+  amb_count u32
+  amb_sd[amb_count] i8
+  amb_prn[amb_count] u8
+
+log Log
+  RanDod
+)"_s);
+  auto log = l.log_index("Log"_s);
+
+  static constexpr u32 n = 200000;
+  auto records = ran_dod_records(n);
+  auto type = l.type("RanDod"_s);
+  Stream data;
+  for (char const* it = records.begin(); it != records.end();) {
+    u32 size = struct_size(l, type, it);
+    write_record(data, 0, {it, size});
+    it += size;
+  }
+
+  char path[] = "/tmp/bstruct-bench-XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0);
+  check(write(fd, data.begin(), len(data)) == len(data));
+  check(!close(fd));
+  {
+    LogFile file {l, log, path};
+    println("cores: "_s, core_count());
+    Print p;
+    u32 thread_counts[] {1, 2, 4, 8};
+    for (u32 threads: thread_counts) {
+      auto t0 = now();
+      print_records(file, 0, len(file), threads, p);
+      auto t1 = now();
+      p.chars.size = 0;
+      Print name;
+      sprint(name, "print_records, "_s, threads, " threads"_s);
+      report(name.chars.span(), n, t1 - t0);
+    }
+  }
+  check(!unlink(path));
+}
+
+// Walks the records checked, and unchecked with struct_size.
+void bench_validate() {
+  auto l = parse(ran_dod_schema);
+  auto type = l.type("RanDod"_s);
+  static constexpr u32 n = 200000;
+  auto records = ran_dod_records(n);
+  Validator v {l, type};
+  auto t0 = now();
+  for (char const* it = records.begin(); it != records.end();)
+    it += *v({it, records.end()});
+  auto t1 = now();
+  for (char const* it = records.begin(); it != records.end();)
+    it += struct_size(l, type, it);
+  auto t2 = now();
+  report("Validator"_s, n, t1 - t0);
+  report("struct_size"_s, n, t2 - t1);
+}
+
+void bench_parse() {
+  static constexpr u32 n = 20000;
+  Print schema;
+  for (u32 i {}; i < n; ++i) {
+    sprint(schema, "struct S"_s, i, "\n  x u32\n"_s);
+    if (i)
+      sprint(schema, "  s S"_s, i - 1, '\n');
+    sprint(schema, '\n');
+  }
+  schema.chars.push('\0');
+  auto t0 = now();
+  auto l = parse(schema.chars.span());
+  auto t1 = now();
+  check(len(l.struct_names) == n);
+  println(
+      "parse: "_s, n, " structs in "_s, u32((t1 - t0) * 1e6), " us"_s);
+
+  Stream image;
+  write_schema(l, image);
+  char path[] = "/tmp/bstruct-bench-XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0);
+  check(write(fd, image.begin(), len(image)) == len(image));
+  check(!close(fd));
+  auto t2 = now();
+  auto loaded = load_schema(path);
+  auto t3 = now();
+  check(loaded.struct_index("S19999"_s) == n - 1);
+  println(
+      "load_schema: "_s, n, " structs in "_s, u32((t3 - t2) * 1e6), " us"_s);
+  check(!unlink(path));
+}
+
+// The array printer before bulk formatting: one call per element, each
+// going through print() and snprintf.
+template <class T>
+char const* print_each(Print& p, char const* it, u32 count) {
+  sprint(p, '[');
+  if (count) {
+    print(*(T const*) it, p);
+    for (u32 i = 1; i < count; ++i)
+      sprint(p, ' ', *(T const*) (it += sizeof(T)));
+    it += sizeof(T);
+  }
+  sprint(p, ']');
+  return it;
+}
+
+template <class T>
+void bench_array_format(Str name, u32 length, T (*value)()) {
+  static constexpr u32 arrays = 50000;
+  List<T> values;
+  for (u32 i {}; i < arrays * length; ++i)
+    values.push(value());
+  auto data = reinterpret_cast<char const*>(values.begin());
+
+  Print p;
+  auto run = [&](auto printer) {
+    auto t0 = now();
+    char const* it = data;
+    for (u32 i {}; i < arrays; ++i) {
+      it = printer(p, it, length);
+      if (len(p.chars) > 1 << 20)
+        p.chars.size = 0;
+    }
+    return now() - t0;
+  };
+  auto before = run(print_each<T>);
+  auto after = run(format_array<T>);
+  u32 n = arrays * length;
+  println(
+      name, ": per element "_s, u32(before * 1e9 / n), " ns, bulk "_s,
+      u32(after * 1e9 / n), " ns"_s);
+}
+
+// The scalar printers before native formatting.
+template <class T>
+void snprint(Print& p, char const* fmt, T x) {
+  auto out = p.chars.reserve(32);
+  p.chars.size += u32(snprintf(out, 32, fmt, x));
+}
+
+void bench_scalar_print() {
+  static constexpr u32 n = 200000;
+  List<u32> ints;
+  List<i64> longs;
+  List<f32> floats;
+  List<f64> doubles;
+  for (u32 i {}; i < n; ++i) {
+    ints.push(rng() >> (rng() % 32));
+    longs.push(i64(u64(rng()) << 32 | rng()) >> (rng() % 64));
+    floats.push(f32(rng() % 100000) * 0.01f);
+    doubles.push(f64(rng()) / f64(rng() | 1));
+  }
+
+  Print p;
+  auto t0 = now();
+  for (u32 i {}; i < n; ++i) {
+    snprint(p, "%u", ints[i]);
+    snprint(p, "%lld", (long long) longs[i]);
+    snprint(p, "%.9g", floats[i]);
+    snprint(p, "%.17g", doubles[i]);
+    if (len(p.chars) > 1 << 20)
+      p.chars.size = 0;
+  }
+  auto t1 = now();
+  for (u32 i {}; i < n; ++i) {
+    sprint(p, ints[i], longs[i], floats[i], doubles[i]);
+    if (len(p.chars) > 1 << 20)
+      p.chars.size = 0;
+  }
+  auto t2 = now();
+  println(
+      "u32+i64+f32+f64: snprintf "_s, u32((t1 - t0) * 1e9 / n),
+      " ns, print "_s, u32((t2 - t1) * 1e9 / n), " ns"_s);
+}
+
+void bench_export() {
+  auto l = parse(ran_dod_schema);
+  auto s = l.struct_index("RanDod"_s);
+  auto type = l.type(s);
+  static constexpr u32 n = 200000;
+  auto records = ran_dod_records(n);
+  List<Str> starts;
+  for (char const* it = records.begin(); it != records.end();) {
+    u32 size = struct_size(l, type, it);
+    starts.push({it, size});
+    it += size;
+  }
+
+  Exporter e {l};
+  Print p;
+  auto run = [&](Str name, auto write) {
+    auto t0 = now();
+    for (auto record: starts) {
+      write(record);
+      if (len(p.chars) > 1 << 20)
+        p.chars.size = 0;
+    }
+    report(name, n, now() - t0);
+  };
+  run("print_struct"_s, [&](Str r) { print_struct(p, l, type, r); });
+  run("Exporter::json"_s, [&](Str r) { e.json(p, s, r); });
+  run("Exporter::csv"_s, [&](Str r) { e.csv(p, s, r); });
+}
+
+// Sums one member over every record, from the records themselves and from
+// their columns.
+void bench_columns() {
+  auto l = parse(ran_dod_schema);
+  auto s = l.struct_index("RanDod"_s);
+  auto type = l.type(s);
+  static constexpr u32 n = 200000;
+  auto records = ran_dod_records(n);
+  List<Str> starts;
+  for (char const* it = records.begin(); it != records.end();) {
+    u32 size = struct_size(l, type, it);
+    starts.push({it, size});
+    it += size;
+  }
+
+  auto t0 = now();
+  Columns c {l, s};
+  for (auto record: starts)
+    c.push(record);
+  auto t1 = now();
+  f64 row_sum {};
+  u64 row_count {};
+  for (auto record: starts) {
+    auto it = record.begin();
+    f32 x;
+    memcpy(&x, it + 6 * sizeof(f32), sizeof(x));
+    row_sum += x;
+    u32 count;
+    memcpy(&count, it + 12 * sizeof(f32), sizeof(count));
+    row_count += count;
+  }
+  auto t2 = now();
+  f64 column_sum {};
+  u64 column_count {};
+  auto rel_mean = c["rel_mean"_s].span<f32>();
+  for (u32 i {}; i < n; ++i)
+    column_sum += rel_mean[i * 6];
+  for (u32 count: c["amb_count"_s].span<u32>())
+    column_count += count;
+  auto t3 = now();
+  check(row_sum == column_sum && row_count == column_count);
+  report("Columns::push"_s, n, t1 - t0);
+  println(
+      "rel_mean[0]+amb_count scan: rows "_s, u32((t2 - t1) * 1e9 / n),
+      " ns/record, columns "_s, u32((t3 - t2) * 1e9 / n), " ns/record"_s);
+}
+
+// Stats of a float and an integer column and a filter on the float one,
+// in plain loops and in AVX2.
+void bench_kernels() {
+  auto l = parse(ran_dod_schema);
+  auto s = l.struct_index("RanDod"_s);
+  static constexpr u32 n = 200000;
+  auto records = ran_dod_records(n);
+  Columns c {l, s};
+  auto type = l.type(s);
+  for (char const* it = records.begin(); it != records.end();) {
+    u32 size = struct_size(l, type, it);
+    c.push({it, size});
+    it += size;
+  }
+  auto means = c["abs_mean"_s].span<f32>();
+  auto counts = c["amb_count"_s].span<u32>();
+  Array<u64> selection(selection_words(len(means)));
+
+  bool avx2 = use_avx2;
+  for (u32 pass {}; pass <= u32(avx2); ++pass) {
+    use_avx2 = pass;
+    f64 sum {};
+    auto t0 = now();
+    for (u32 i {}; i < 20; ++i) {
+      sum += stats(means).sum;
+      sum += f64(stats(counts).sum);
+    }
+    auto t1 = now();
+    u64 hits {};
+    for (u32 i {}; i < 20; ++i) {
+      select(means, Greater, 2.5f, selection);
+      hits += selected(selection);
+    }
+    auto t2 = now();
+    u32 values = 20 * len(means);
+    println(
+        pass ? "avx2"_s : "plain"_s, " stats: "_s,
+        u32((t1 - t0) * 1e12 / values), " ps/value, select: "_s,
+        u32((t2 - t1) * 1e12 / values), " ps/value ("_s, u32(sum),
+        ", "_s, hits, ")"_s);
+  }
+  use_avx2 = avx2;
+}
+
+}
+
+void bench() {
+  bench_export();
+  bench_columns();
+  bench_kernels();
+  bench_scalar_print();
+  bench_array_format<i8>("i8[16]"_s, 16, [] { return i8(rng()); });
+  bench_array_format<u32>("u32[8]"_s, 8, [] { return rng() >> (rng() % 32); });
+  bench_array_format<f32>(
+      "f32[6]"_s, 6, [] { return f32(rng() % 2000) * 0.001f + f32(rng() % 7); });
+  bench_array_format<f64>(
+      "f64[6]"_s, 6, [] { return f64(rng()) / f64(rng() | 1); });
+  bench_parse();
+  bench_validate();
+  bench_jit_print();
+  bench_codegen();
+  bench_peephole();
+  bench_code_arena();
+  bench_parallel_decode();
+}
@@ -1,7 +1,10 @@
 #include "backend.hh"
+#include "export.hh"
+#include "log.hh"
 #include "stub.hh"
 
 #include <cstdlib>
+#include <fcntl.h>
 #include <unistd.h>
 #include <type_traits>
 #include <algorithm>
@@ -10,12 +13,8 @@ using namespace lang;
 
 void parse();
 
-char buf[4096 * 4096];
-
 using StringList = ArrayList<char>;
 
-enum Builtin { U32 };
-
 struct Struct {
   StringList names;
   List<u32> array_size;
@@ -101,17 +100,148 @@ void try_program(void (*prog)(Backend&)) {
   Stream out;
   lang::Backend b {out};
   prog(b);
+  check(!b.jumps_pending());
   Executable exec (out);
   auto fn = exec.as<void>();
   println("Try running it..."_s);
   fn();
 }
 
+// Read a schema file, followed by the terminating '\0' the parser expects.
+String read_schema(char const* path) {
+  int fd = open(path, O_RDONLY);
+  check(fd >= 0);
+  Stream s;
+  static constexpr u32 chunk = 1 << 16;
+  while (iptr n = ::read(fd, s.reserve(chunk), chunk)) {
+    check(n > 0);
+    s.size += u32(n);
+  }
+  check(!close(fd));
+  s.push('\0');
+  return s.take();
+}
+
+// A schema file, either compiled (mapped and used in place) or source text.
+Library open_schema(char const* path) {
+  int fd = open(path, O_RDONLY);
+  check(fd >= 0);
+  char magic[8];
+  iptr n = ::read(fd, magic, sizeof(magic));
+  check(n >= 0 && !close(fd));
+  if (is_compiled_schema({magic, u32(n)}))
+    return load_schema(path);
+  auto schema = read_schema(path);
+  return parse({schema.begin(), len(schema) - 1});
+}
+
+void compile_schema(char const* schema_path, char const* out_path) {
+  auto l = open_schema(schema_path);
+  Stream image;
+  write_schema(l, image);
+  int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  check(fd >= 0);
+  check(write(fd, image.begin(), len(image)) == len(image));
+  check(!close(fd));
+}
+
+// Print every record of a log file, reading it straight from the mapping and
+// formatting batches of records on all cores.
+void print_log(char const* schema_path, Str log_name, char const* log_path) {
+  auto l = open_schema(schema_path);
+  LogFile file {l, l.log_index(log_name), log_path};
+  u32 threads = core_count();
+  static constexpr u32 batch = 1 << 16;
+  Print p;
+  for (u32 i {}; i < len(file); i += batch) {
+    u32 end = len(file) - i < batch ? len(file) : i + batch;
+    print_records(file, i, end, threads, p);
+    write_cerr(p.chars);
+    p.chars.size = 0;
+  }
+}
+
+// Export every record of a log file as JSON Lines, or the records of one
+// of its variants as CSV.
+void export_log(
+    Str format, char const* schema_path, Str log_name, char const* log_path,
+    char const* variant) {
+  auto l = open_schema(schema_path);
+  LogFile file {l, l.log_index(log_name), log_path};
+  Exporter e {l};
+  Print p;
+  bool csv = format == "csv"_s;
+  u32 only = csv ? l.struct_index(to_str(variant)) : 0;
+  if (csv)
+    e.csv_header(p, only);
+  for (auto record: file) {
+    u32 s = file.struct_index(record);
+    if (!csv)
+      e.json(p, s, record.data);
+    else if (s == only)
+      e.csv(p, s, record.data);
+    if (len(p.chars) >= 1 << 20) {
+      write_cerr(p.chars);
+      p.chars.size = 0;
+    }
+  }
+  write_cerr(p.chars);
+}
+
+void test_format();
+void test_str_table();
+void test_compiled_schema();
+void test_validate();
+void test_static_schema();
 void test_cpp_generation();
+void test_backend();
+void test_ir();
+void test_jit_print();
+void test_log_reader();
+void test_export();
+void test_columns();
+void test_kernels();
+void bench();
 
-int main() {
+int main(int argc, char** argv) {
+  if (argc > 1 && to_str(argv[1]) == "bench"_s) {
+    // `bench perf` or `bench jitdump` names JIT'd routines for perf.
+    if (argc > 2)
+      enable_perf_map(to_str(argv[2]) == "jitdump"_s);
+    bench();
+    return 0;
+  }
+  if (argc == 5 && to_str(argv[1]) == "json"_s) {
+    export_log("json"_s, argv[2], to_str(argv[3]), argv[4], nullptr);
+    return 0;
+  }
+  if (argc == 6 && to_str(argv[1]) == "csv"_s) {
+    export_log("csv"_s, argv[2], to_str(argv[3]), argv[4], argv[5]);
+    return 0;
+  }
+  if (argc == 4 && to_str(argv[1]) == "compile"_s) {
+    compile_schema(argv[2], argv[3]);
+    return 0;
+  }
+  if (argc == 4) {
+    print_log(argv[1], to_str(argv[2]), argv[3]);
+    return 0;
+  }
+
+  test_format();
+  test_str_table();
   parse();
+  test_compiled_schema();
+  test_validate();
+  test_static_schema();
   test_cpp_generation();
+  test_backend();
+  test_ir();
+  test_jit_print();
+  test_log_reader();
+  test_export();
+  test_columns();
+  test_kernels();
 
   // try_program(prog1);
   // try_program(prog2);
@@ -182,8 +312,4 @@ int main() {
   }
 
   return 0;
-
-  auto n = ::read(0, buf, sizeof(buf));
-  check(n >= 0);
-  check(::write(1, buf, u32(n)) == n);
 }
@@ -0,0 +1,149 @@
+#include "columns.hh"
+
+#include "log.hh"
+#include "validate.hh"
+
+namespace {
+
+// Adds the leaves of struct `s` under `prefix`. Member array lengths name
+// a member of the same struct instance, so each member's column is kept to
+// resolve them.
+void add_columns(Columns& c, u32 s, List<char>& prefix) {
+  auto& l = c.l;
+  auto members = l.struct_member[s];
+  List<u32> member_column;
+  for (auto m: members) {
+    u32 outer = len(prefix);
+    if (outer)
+      prefix.push('.');
+    extend(prefix, l.names[m.name]);
+    member_column.push(len(c.columns));
+    if (m.type >= PrimitiveCount) {
+      // Only fixed arrays of structs can be flattened; see struct_size.
+      check(m.array != MemberArray);
+      u32 count = m.array == FixedArray ? m.length : 1;
+      u32 named = len(prefix);
+      for (u32 j {}; j < count; ++j) {
+        prefix.size = named;
+        if (m.array == FixedArray) {
+          Print index;
+          sprint(index, '.', j);
+          extend(prefix, index.chars.span());
+        }
+        add_columns(c, m.type - PrimitiveCount, prefix);
+      }
+    } else {
+      auto& col = c.columns.emplace();
+      col.name = String(prefix.span());
+      col.type = PrimitiveId(m.type);
+      col.array = m.array;
+      col.width = m.array == FixedArray ? m.length : 1;
+      col.length_column = m.array == MemberArray ? member_column[m.length] : 0;
+    }
+    prefix.size = outer;
+  }
+}
+
+}
+
+Columns::Columns(Library const& l_, u32 struct_index_):
+  l(l_), struct_index(struct_index_) {
+  List<char> prefix;
+  add_columns(*this, struct_index, prefix);
+  scalars.expand(len(columns));
+  scalars.size = len(columns);
+}
+
+void Columns::push(Str record) {
+  char const* it = record.begin();
+  for (u32 i {}; i < len(columns); ++i) {
+    auto& col = columns[i];
+    u32 size = primitive_size(col.type);
+    u64 count = col.width;
+    if (col.array == MemberArray)
+      count = scalars[col.length_column];
+    check(count * size <= u64(record.end() - it));
+    u32 bytes = u32(count * size);
+    if (col.array == NoArray && col.type < F32)
+      scalars[i] = read_integer(col.type, it);
+    extend(col.values, Str {it, bytes});
+    if (col.array == MemberArray)
+      col.ends.push(len(col.values) / size);
+    it += bytes;
+  }
+  ++rows;
+}
+
+MaybeU32 Columns::find(Str name) const {
+  for (u32 i {}; i < len(columns); ++i)
+    if (columns[i].name == name)
+      return MaybeU32::from(i);
+  return {};
+}
+
+Columns transpose(LogFile const& f, u32 struct_index) {
+  Columns c {f.l, struct_index};
+  for (auto record: f)
+    if (f.struct_index(record) == struct_index)
+      c.push(record.data);
+  return c;
+}
+
+void test_columns() {
+  auto l = parse(R"(struct Point
+  x f32
+  y f32
+
+struct Sample
+  id u32
+  at Point
+  path[2] Point
+  count u8
+  amb[count] i8
+  tail u16
+)"_s);
+  Columns c {l, l.struct_index("Sample"_s)};
+  Str names[] {
+      "id"_s, "at.x"_s, "at.y"_s, "path.0.x"_s, "path.0.y"_s, "path.1.x"_s,
+      "path.1.y"_s, "count"_s, "amb"_s, "tail"_s};
+  check(len(c.columns) == 10);
+  for (u32 i {}; i < 10; ++i)
+    check(*c.find(names[i]) == i);
+  check(c["amb"_s].length_column == 7);
+
+  Stream data;
+  auto put = [&](auto x) {
+    memcpy(data.reserve(sizeof(x)), &x, sizeof(x));
+    data.size += u32(sizeof(x));
+  };
+  for (u32 r {}; r < 5; ++r) {
+    data.size = 0;
+    put(r);
+    for (u32 j {}; j < 6; ++j)
+      put(f32(r * 10 + j));
+    put(u8(r));
+    for (u32 j {}; j < r; ++j)
+      put(i8(-i8(j)));
+    put(u16(r + 100));
+    check(len(data) == *validate(l, l.type("Sample"_s), data));
+    c.push(data);
+  }
+
+  check(c.rows == 5);
+  auto ids = c["id"_s].span<u32>();
+  auto xs = c["path.1.x"_s].span<f32>();
+  auto tails = c["tail"_s].span<u16>();
+  for (u32 r {}; r < 5; ++r) {
+    check(ids[r] == r);
+    check(xs[r] == f32(r * 10 + 4));
+    check(tails[r] == r + 100);
+  }
+  auto amb = c["amb"_s].arrays<i8>();
+  check(len(amb) == 5 && len(amb.items) == 0 + 1 + 2 + 3 + 4);
+  for (u32 r {}; r < 5; ++r) {
+    check(len(amb[r]) == r);
+    for (u32 j {}; j < r; ++j)
+      check(amb[r][j] == -i8(j));
+  }
+  println("Columns tests passed");
+}
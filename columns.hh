@@ -0,0 +1,59 @@
+#pragma once
+
+#include "parse.hh"
+
+struct LogFile;
+
+// One primitive leaf of a struct, e.g. `origin.x` of a nested struct or
+// `mean` of a fixed array. `values` holds every record's values back to
+// back, typed by `type`. A fixed array stores `width` values per record.
+// A member array stores `ends`, the end of each record's values counted
+// in values, in the ArrayArray layout.
+struct Column {
+  String name;
+  PrimitiveId type;
+  ArrayType array;
+  u32 width;
+  // For a member array, the column holding its length.
+  u32 length_column;
+  List<char> values;
+  List<u32> ends;
+
+  template <class T>
+  Span<T> span() const {
+    check(sizeof(T) == primitive_size(type));
+    auto base = reinterpret_cast<T const*>(values.begin());
+    return {base, len(values) / u32(sizeof(T))};
+  }
+
+  template <class T>
+  SpanArray<T> arrays() const {
+    check(array == MemberArray);
+    return {span<T>(), ends.span()};
+  }
+};
+
+// Records of one struct type transposed into columns, so that a scan over
+// one member reads only that member's bytes, in a contiguous typed array.
+// Nested structs and fixed arrays of structs are flattened into their
+// primitive leaves when the columns are made; records are then copied
+// member by member without looking anything up.
+struct Columns {
+  Library const& l;
+  u32 struct_index;
+  u32 rows {};
+  List<Column> columns;
+  // Each leaf's value in the record being added, for member array lengths.
+  List<u64> scalars;
+
+  Columns(Library const& l, u32 struct_index);
+
+  // Appends one complete record of this struct type.
+  void push(Str record);
+
+  MaybeU32 find(Str name) const;
+  Column const& operator[](Str name) const { return columns[*find(name)]; }
+};
+
+// Every record of `struct_index` in a log file, as columns.
+Columns transpose(LogFile const& f, u32 struct_index);
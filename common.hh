@@ -12,6 +12,7 @@ void* realloc(void*, usize);
 void free(void*);
 int memcmp(void const*, void const*, usize);
 void* memcpy(void*, void const*, usize);
+void* memmove(void*, void const*, usize);
 [[noreturn]] void abort();
 
 }
@@ -629,11 +630,26 @@ constexpr void copy(T* dst, Span<T> src) {
     new (dst + i) T(src[i]);
 }
 
+// A read-only ArrayArray over storage owned elsewhere.
+template <class T>
+struct SpanArray {
+  Span<T> items;
+  Span<u32> offsets;
+
+  friend u32 len(SpanArray const& array) { return len(array.offsets); }
+  Span<T> operator[](u32 index) const {
+    auto begin = index ? offsets[index - 1] : 0;
+    return {items.begin() + begin, offsets[index] - begin};
+  }
+};
+
 template <class T>
 struct ArrayArray {
   Array<T> items;
   Array<u32> offsets;
 
+  SpanArray<T> view() const { return {items, offsets}; }
+
   friend u32 len(ArrayArray const& array) { return len(array.offsets); }
   Mut<T> operator[](u32 index) {
     auto begin = index ? offsets[index - 1] : 0;
@@ -688,6 +704,8 @@ struct ArrayList {
   ArrayArray<T> take() {
     return {list.take(), ofs.take()};
   }
+
+  SpanArray<T> view() const { return {list.span(), ofs.span()}; }
 };
 
 constexpr struct None {
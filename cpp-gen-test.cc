@@ -171,4 +171,133 @@ int main() {
     String output = compile_and_run(p.chars);
     check(output == "one,two,"_s);
   }
+  {
+    Library lib = parse(R"(
+struct Person
+  id u32
+  len u32
+  name[len] u8
+)"_s);
+    Print p;
+    sprint(
+        p, to_cpp(lib),
+        R"(
+#include <unistd.h>
+int main() {
+  u8 v[] {5, 6, 7};
+  Person p {9, 3, v};
+  char buf[16];
+  char* end = p.serialize(buf);
+  Person q;
+  if (q.deserialize(buf, end) != end || q.deserialize(buf, end - 1))
+    abort();
+  if (q.id != 9 || q.len != 3 || q.name != (u8 const*) buf + 8)
+    abort();
+  PersonView view {buf, unsigned(end - buf)};
+  if (view.serialized_size() != end - buf || view.name().data() != q.name)
+    abort();
+  u8 out[] {u8(view.id()), u8(view.len()), view.name()[0], view.name()[2]};
+  write(1, out, sizeof(out));
+}
+)"_s);
+    String output = compile_and_run(p.chars);
+    check(output == Span((char[]) {9, 3, 5, 7}));
+  }
+  {
+    Library lib = parse(R"(
+struct Header
+  magic u32
+  scale[2] f32
+
+struct Packet
+  count u8
+  words[count] u16
+  crc u32
+)"_s);
+    Print p;
+    sprint(
+        p, to_cpp(lib),
+        R"(
+#include <unistd.h>
+int main() {
+  Header h {0xb5, {0.5f, 2.f}};
+  char hbuf[12];
+  Header h2;
+  if (h2.deserialize(hbuf, h.serialize(hbuf)) != hbuf + 12)
+    abort();
+  if (h2.magic != 0xb5 || h2.scale[1] != 2.f)
+    abort();
+
+  u16 words[] {300, 400};
+  Packet k {2, words, 77};
+  char kbuf[16];
+  char* end = k.serialize(kbuf);
+  PacketView view {kbuf, unsigned(end - kbuf)};
+  Packet k2;
+  if (k2.deserialize(kbuf, end) != end || view.serialized_size() != 9)
+    abort();
+  u8 out[] {u8(view.words()[1] - 300), u8(view.crc()), u8(k2.crc), u8(k2.count)};
+  write(1, out, sizeof(out));
+}
+)"_s);
+    String output = compile_and_run(p.chars);
+    check(output == Span((char[]) {100, 77, 77, 2}));
+  }
+  {
+    Library lib = parse(R"(struct DroppedGpsMessage
+  count u16
+  reason[count] u8
+
+struct RanDod
+  abs_mean[6] f32
+  rel_mean[6] f32
+  amb_count u32
+  amb_sd[amb_count] i8
+  amb_prn[amb_count] u8
+)"_s);
+    Print p;
+    sprint(
+        p, to_cpp(lib),
+        R"(
+#include <unistd.h>
+int main() {
+  u8 reason[] {4, 5};
+  DroppedGpsMessage d {2, reason};
+  char dbuf[4];
+  if (d.serialized_size() != 4 || d.serialize(dbuf) != dbuf + 4)
+    abort();
+
+  i8 sd[] {-1, -2, -3};
+  u8 prn[] {7, 8, 9};
+  RanDod r {{0, 1, 2, 3, 4, 5}, {6, 7, 8, 9, 10, 11}, 3, sd, prn};
+  unsigned n = r.serialized_size();
+  char buf[64];
+  if (n != 58 || r.serialize(buf) != buf + n)
+    abort();
+  RanDod r2;
+  if (r2.deserialize(buf, buf + n) != buf + n || r2.deserialize(buf, buf + n - 1))
+    abort();
+  if (r2.amb_sd != (i8 const*) buf + 52 || r2.amb_prn[2] != 9 || r2.rel_mean[5] != 11)
+    abort();
+  RanDodView v {buf, n};
+  if (v.serialized_size() != n || v.amb_prn()[1] != 8 || v.amb_sd()[0] != -1)
+    abort();
+  write(1, buf, n);
+}
+)"_s);
+    String output = compile_and_run(p.chars);
+    Stream expected;
+    auto put = [&](void const* x, u32 size) {
+      memcpy(expected.reserve(size), x, size);
+      expected.size += size;
+    };
+    for (u32 i: range(12)) {
+      f32 x = f32(i);
+      put(&x, 4);
+    }
+    u32 count = 3;
+    put(&count, 4);
+    put("\377\376\375\7\10\11", 6);
+    check(output == expected.span());
+  }
 }
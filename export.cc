@@ -0,0 +1,309 @@
+#include "export.hh"
+
+#include "format.hh"
+#include "validate.hh"
+
+namespace {
+
+void json_escape(List<char>& out, Str s) {
+  static constexpr char hex[] = "0123456789abcdef";
+  for (char c: s) {
+    if (c == '"' || c == '\\') {
+      out.push('\\');
+      out.push(c);
+    } else if (u8(c) < 0x20) {
+      extend(out, "\\u00"_s);
+      out.push(hex[u8(c) >> 4]);
+      out.push(hex[u8(c) & 15]);
+    } else {
+      out.push(c);
+    }
+  }
+}
+
+void csv_cell(Print& p, bool& first, Str s) {
+  if (!exchange(first, false))
+    p.chars.push(',');
+  bool quote = false;
+  for (char c: s)
+    quote |= c == ',' || c == '"' || c == '\n' || c == '\r';
+  if (!quote)
+    return extend(p.chars, s);
+  p.chars.push('"');
+  for (char c: s) {
+    if (c == '"')
+      p.chars.push('"');
+    p.chars.push(c);
+  }
+  p.chars.push('"');
+}
+
+template <class T>
+char* write_value(char* out, T x, bool json) {
+  if constexpr (T(0.5) != T(0)) {
+    if (json && !__builtin_isfinite(x)) {
+      memcpy(out, "null", 4);
+      return out + 4;
+    }
+  }
+  return format(x, out);
+}
+
+// `count` values starting at `it` separated by `sep`; returns the end of
+// the values.
+template <class T>
+char const* write_values(
+    Print& p, char const* it, u32 count, char sep, bool json) {
+  if (!count)
+    return it;
+  u64 room = u64(count) * (format_max<T> + 1);
+  check(len(p.chars) + room <= ~0u);
+  char* out = p.chars.reserve(u32(room));
+  for (u32 i {}; i < count; ++i, it += sizeof(T)) {
+    T x;
+    memcpy(&x, it, sizeof(T));
+    out = write_value(out, x, json);
+    *out++ = sep;
+  }
+  p.chars.size = u32(out - 1 - p.chars.begin());
+  return it;
+}
+
+constexpr char const* (*value_writer[PrimitiveCount])(
+    Print&, char const*, u32, char, bool) {
+    write_values<u8>,  write_values<u16>, write_values<u32>, write_values<u64>,
+    write_values<i8>,  write_values<i16>, write_values<i32>, write_values<i64>,
+    write_values<f32>, write_values<f64>};
+
+// Integer members, as a possible array length; floats are never lengths.
+u64 load_scalar(PrimitiveId t, char const* it) {
+  return t < F32 ? read_integer(t, it) : 0;
+}
+
+// Where the members of one struct instance keep their scalar values, for
+// the member arrays that follow them.
+struct Frame {
+  List<u64>& scalars;
+  u32 base;
+  Frame(List<u64>& s, u32 n): scalars(s), base(len(s)) {
+    s.expand(base + n);
+    s.size = base + n;
+  }
+  ~Frame() { scalars.size = base; }
+  u64& operator[](u32 i) { return scalars[base + i]; }
+};
+
+u32 member_base(Library const& l, u32 s) {
+  return s ? l.struct_member.offsets[s - 1] : 0;
+}
+
+}
+
+Exporter::Exporter(Library const& l_): l(l_) {
+  ArrayList<char> keys;
+  for (auto& m: l.struct_member.items) {
+    List<char> text;
+    text.push('"');
+    json_escape(text, l.names[m.name]);
+    extend(text, "\":"_s);
+    keys.push(text.span());
+  }
+  json_key = keys.take();
+
+  ArrayList<char> types;
+  for (u32 name: l.struct_names) {
+    List<char> text;
+    extend(text, "{\"_type\":\""_s);
+    json_escape(text, l.names[name]);
+    text.push('"');
+    types.push(text.span());
+  }
+  json_type = types.take();
+}
+
+namespace {
+
+char const* json_struct(
+    Exporter& e, Print& p, u32 s, char const* it, bool top) {
+  auto& l = e.l;
+  auto members = l.struct_member[s];
+  u32 base = member_base(l, s);
+  Frame scalars {e.scalars, len(members)};
+  if (!top)
+    p.chars.push('{');
+  for (u32 i {}; i < len(members); ++i) {
+    auto m = members[i];
+    if (i || top)
+      p.chars.push(',');
+    extend(p.chars, e.json_key[base + i].span());
+    u32 count = m.array == FixedArray ? m.length
+        : m.array == MemberArray ? u32(scalars[m.length])
+        : 1;
+    if (m.type < PrimitiveCount) {
+      auto t = PrimitiveId(m.type);
+      if (m.array == NoArray) {
+        scalars[i] = load_scalar(t, it);
+        it = value_writer[t](p, it, 1, ',', true);
+      } else {
+        p.chars.push('[');
+        it = value_writer[t](p, it, count, ',', true);
+        p.chars.push(']');
+      }
+    } else if (m.array == NoArray) {
+      it = json_struct(e, p, m.type - PrimitiveCount, it, false);
+    } else {
+      p.chars.push('[');
+      for (u32 j {}; j < count; ++j) {
+        if (j)
+          p.chars.push(',');
+        it = json_struct(e, p, m.type - PrimitiveCount, it, false);
+      }
+      p.chars.push(']');
+    }
+  }
+  p.chars.push('}');
+  return it;
+}
+
+void csv_columns(
+    Library const& l, Print& p, u32 s, List<char>& prefix, bool& first) {
+  auto members = l.struct_member[s];
+  for (auto m: members) {
+    u32 outer = len(prefix);
+    extend(prefix, l.names[m.name]);
+    u32 named = len(prefix);
+    bool nested = m.type >= PrimitiveCount;
+    if (m.array == FixedArray) {
+      for (u32 j {}; j < m.length; ++j) {
+        prefix.size = named;
+        Print index;
+        sprint(index, '.', j);
+        extend(prefix, index.chars.span());
+        if (nested) {
+          prefix.push('.');
+          csv_columns(l, p, m.type - PrimitiveCount, prefix, first);
+        } else {
+          csv_cell(p, first, prefix.span());
+        }
+      }
+    } else if (nested) {
+      // Only single nested structs get here (see struct_size).
+      check(m.array == NoArray);
+      prefix.push('.');
+      csv_columns(l, p, m.type - PrimitiveCount, prefix, first);
+    } else {
+      csv_cell(p, first, prefix.span());
+    }
+    prefix.size = outer;
+  }
+}
+
+char const* csv_struct(
+    Exporter& e, Print& p, u32 s, char const* it, bool& first) {
+  auto& l = e.l;
+  auto members = l.struct_member[s];
+  Frame scalars {e.scalars, len(members)};
+  for (u32 i {}; i < len(members); ++i) {
+    auto m = members[i];
+    if (m.type >= PrimitiveCount) {
+      check(m.array != MemberArray);
+      u32 count = m.array == FixedArray ? m.length : 1;
+      for (u32 j {}; j < count; ++j)
+        it = csv_struct(e, p, m.type - PrimitiveCount, it, first);
+      continue;
+    }
+    auto t = PrimitiveId(m.type);
+    if (m.array == FixedArray && !m.length)
+      continue;
+    if (!exchange(first, false))
+      p.chars.push(',');
+    if (m.array == NoArray) {
+      scalars[i] = load_scalar(t, it);
+      it = value_writer[t](p, it, 1, ',', false);
+    } else if (m.array == FixedArray) {
+      it = value_writer[t](p, it, m.length, ',', false);
+    } else {
+      it = value_writer[t](p, it, u32(scalars[m.length]), ' ', false);
+    }
+  }
+  return it;
+}
+
+}
+
+void Exporter::json(Print& p, u32 struct_index, Str record) {
+  extend(p.chars, json_type[struct_index].span());
+  if (!len(l.struct_member[struct_index]))
+    p.chars.push('}');
+  else
+    json_struct(*this, p, struct_index, record.begin(), true);
+  p.chars.push('\n');
+}
+
+void Exporter::csv_header(Print& p, u32 struct_index) {
+  List<char> prefix;
+  bool first = true;
+  csv_columns(l, p, struct_index, prefix, first);
+  p.chars.push('\n');
+}
+
+void Exporter::csv(Print& p, u32 struct_index, Str record) {
+  bool first = true;
+  csv_struct(*this, p, struct_index, record.begin(), first);
+  p.chars.push('\n');
+}
+
+void test_export() {
+  auto l = parse(R"(struct Point
+  x f32
+  y f32
+
+struct Shape
+  id u16
+  origin Point
+  mean[2] f64
+  count u8
+  xs[count] i8
+
+struct Empty
+)"_s);
+  Stream record;
+  auto put = [&](auto x) {
+    memcpy(record.reserve(sizeof(x)), &x, sizeof(x));
+    record.size += u32(sizeof(x));
+  };
+  put(u16(7));
+  put(1.5f);
+  put(__builtin_nanf(""));
+  put(0.1);
+  put(-2.0);
+  put(u8(3));
+  put(i8(-1));
+  put(i8(0));
+  put(i8(5));
+  check(len(record) == *validate(l, l.type("Shape"_s), record));
+
+  Exporter e {l};
+  auto shape = l.struct_index("Shape"_s);
+  Print p;
+  e.json(p, shape, record);
+  e.json(p, l.struct_index("Empty"_s), {});
+  check(p.chars.span() == R"({"_type":"Shape","id":7,"origin":{"x":1.5,"y":null},"mean":[0.1,-2],"count":3,"xs":[-1,0,5]}
+{"_type":"Empty"}
+)"_s);
+
+  p.chars.size = 0;
+  e.csv_header(p, shape);
+  e.csv(p, shape, record);
+  check(p.chars.span() == R"(id,origin.x,origin.y,mean.0,mean.1,count,xs
+7,1.5,nan,0.1,-2,3,-1 0 5
+)"_s);
+
+  p.chars.size = 0;
+  bool first = true;
+  csv_cell(p, first, "a,b"_s);
+  csv_cell(p, first, "say \"hi\""_s);
+  check(p.chars.span() == R"("a,b","say ""hi""")"_s);
+  check(!len(e.scalars));
+  println("Export tests passed");
+}
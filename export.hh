@@ -0,0 +1,29 @@
+#pragma once
+
+#include "parse.hh"
+
+// Writes records of a Library straight from their bytes as JSON Lines or
+// CSV. Member names are escaped once, when the exporter is made, and
+// records are walked front to back, so nothing about a member is looked up
+// per record. Records must be complete, e.g. as indexed by LogFile.
+struct Exporter {
+  Library const& l;
+  // `"name":` for every member of every struct, by index into
+  // l.struct_member.items, and `{"_type":"Name"` for every struct.
+  ArrayArray<char> json_key;
+  ArrayArray<char> json_type;
+  // Values of the scalar members seen so far, for member array lengths.
+  List<u64> scalars;
+
+  explicit Exporter(Library const& l);
+
+  // One JSON object and a newline. Nested structs become nested objects,
+  // arrays become arrays, and non-finite floats become null.
+  void json(Print& p, u32 struct_index, Str record);
+
+  // The column names of `struct_index`: nested structs and fixed arrays are
+  // flattened into one column per value (`origin.x`, `mean.0`); a member
+  // array is one column of space-separated values.
+  void csv_header(Print& p, u32 struct_index);
+  void csv(Print& p, u32 struct_index, Str record);
+};
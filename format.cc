@@ -0,0 +1,496 @@
+#include "format.hh"
+
+#include <cstdio>
+#include <stdlib.h>
+
+namespace {
+
+struct DigitTables {
+  char pairs[200];
+  // Each byte value as text, padded to four bytes so it can be stored with
+  // one unaligned write, and the length of the text.
+  char byte[256][4];
+  u8 byte_len[256];
+  char signed_byte[256][4];
+  u8 signed_byte_len[256];
+};
+
+constexpr u32 small_decimal(char* out, u32 x) {
+  u32 n {};
+  if (x >= 100)
+    out[n++] = char('0' + x / 100);
+  if (x >= 10)
+    out[n++] = char('0' + x / 10 % 10);
+  out[n++] = char('0' + x % 10);
+  return n;
+}
+
+constexpr DigitTables make_digit_tables() {
+  DigitTables t {};
+  for (u32 i {}; i < 100; ++i) {
+    t.pairs[2 * i] = char('0' + i / 10);
+    t.pairs[2 * i + 1] = char('0' + i % 10);
+  }
+  for (u32 i {}; i < 256; ++i) {
+    t.byte_len[i] = u8(small_decimal(t.byte[i], i));
+    i32 s = i < 128 ? i32(i) : i32(i) - 256;
+    if (s < 0) {
+      t.signed_byte[i][0] = '-';
+      t.signed_byte_len[i] = u8(1 + small_decimal(t.signed_byte[i] + 1, u32(-s)));
+    } else {
+      t.signed_byte_len[i] = u8(small_decimal(t.signed_byte[i], u32(s)));
+    }
+  }
+  return t;
+}
+
+constexpr DigitTables digits = make_digit_tables();
+
+constexpr u64 Pow10[20] {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+    10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+    100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull,
+    10000000000000000000ull};
+
+u32 digit_count(u64 x) {
+  // floor(log10(2) * bit length), then one more if x reaches that power.
+  u32 t = u32(64 - __builtin_clzll(x | 1)) * 1233 >> 12;
+  return t + ((x | 1) >= Pow10[t]);
+}
+
+template <class T>
+char* write_unsigned(T x, char* out) {
+  char* end = out + digit_count(x);
+  char* it = end;
+  while (x >= 100) {
+    auto r = x % 100;
+    x /= 100;
+    it -= 2;
+    memcpy(it, digits.pairs + 2 * r, 2);
+  }
+  if (x >= 10)
+    memcpy(it - 2, digits.pairs + 2 * x, 2);
+  else
+    it[-1] = char('0' + x);
+  return end;
+}
+
+template <class U, class S>
+char* write_signed(S x, char* out) {
+  U u = U(x);
+  if (x < 0) {
+    *out++ = '-';
+    u = U(0) - u;
+  }
+  return write_unsigned(u, out);
+}
+
+// Grisu2, after Florian Loitsch, "Printing Floating-Point Numbers Quickly
+// and Accurately with Integers" (2010). The value's rounding interval is
+// scaled by a cached power of ten so that its integer and fractional parts
+// can be taken with a shift, and digits are generated until they fall
+// inside the interval.
+
+struct DiyFp {
+  u64 f;
+  i32 e;
+};
+
+DiyFp mul(DiyFp x, DiyFp y) {
+  auto p = static_cast<unsigned __int128>(x.f) * y.f;
+  u64 h = u64(p >> 64) + (u64(p) >> 63);
+  return {h, x.e + y.e + 64};
+}
+
+DiyFp normalize(DiyFp x) {
+  i32 shift = __builtin_clzll(x.f);
+  return {x.f << shift, x.e - shift};
+}
+
+struct CachedPower {
+  u64 f;
+  i32 e;
+  i32 k;
+};
+
+// 10^k for k = -300, -292, ..., 324, rounded to 64 bits.
+constexpr CachedPower CachedPowers[] {
+    {0xAB70FE17C79AC6CA, -1060, -300}, {0xFF77B1FCBEBCDC4F, -1034, -292},
+    {0xBE5691EF416BD60C, -1007, -284}, {0x8DD01FAD907FFC3C, -980, -276},
+    {0xD3515C2831559A83, -954, -268},  {0x9D71AC8FADA6C9B5, -927, -260},
+    {0xEA9C227723EE8BCB, -901, -252},  {0xAECC49914078536D, -874, -244},
+    {0x823C12795DB6CE57, -847, -236},  {0xC21094364DFB5637, -821, -228},
+    {0x9096EA6F3848984F, -794, -220},  {0xD77485CB25823AC7, -768, -212},
+    {0xA086CFCD97BF97F4, -741, -204},  {0xEF340A98172AACE5, -715, -196},
+    {0xB23867FB2A35B28E, -688, -188},  {0x84C8D4DFD2C63F3B, -661, -180},
+    {0xC5DD44271AD3CDBA, -635, -172},  {0x936B9FCEBB25C996, -608, -164},
+    {0xDBAC6C247D62A584, -582, -156},  {0xA3AB66580D5FDAF6, -555, -148},
+    {0xF3E2F893DEC3F126, -529, -140},  {0xB5B5ADA8AAFF80B8, -502, -132},
+    {0x87625F056C7C4A8B, -475, -124},  {0xC9BCFF6034C13053, -449, -116},
+    {0x964E858C91BA2655, -422, -108},  {0xDFF9772470297EBD, -396, -100},
+    {0xA6DFBD9FB8E5B88F, -369, -92},   {0xF8A95FCF88747D94, -343, -84},
+    {0xB94470938FA89BCF, -316, -76},   {0x8A08F0F8BF0F156B, -289, -68},
+    {0xCDB02555653131B6, -263, -60},   {0x993FE2C6D07B7FAC, -236, -52},
+    {0xE45C10C42A2B3B06, -210, -44},   {0xAA242499697392D3, -183, -36},
+    {0xFD87B5F28300CA0E, -157, -28},   {0xBCE5086492111AEB, -130, -20},
+    {0x8CBCCC096F5088CC, -103, -12},   {0xD1B71758E219652C, -77, -4},
+    {0x9C40000000000000, -50, 4},      {0xE8D4A51000000000, -24, 12},
+    {0xAD78EBC5AC620000, 3, 20},       {0x813F3978F8940984, 30, 28},
+    {0xC097CE7BC90715B3, 56, 36},      {0x8F7E32CE7BEA5C70, 83, 44},
+    {0xD5D238A4ABE98068, 109, 52},     {0x9F4F2726179A2245, 136, 60},
+    {0xED63A231D4C4FB27, 162, 68},     {0xB0DE65388CC8ADA8, 189, 76},
+    {0x83C7088E1AAB65DB, 216, 84},     {0xC45D1DF942711D9A, 242, 92},
+    {0x924D692CA61BE758, 269, 100},    {0xDA01EE641A708DEA, 295, 108},
+    {0xA26DA3999AEF774A, 322, 116},    {0xF209787BB47D6B85, 348, 124},
+    {0xB454E4A179DD1877, 375, 132},    {0x865B86925B9BC5C2, 402, 140},
+    {0xC83553C5C8965D3D, 428, 148},    {0x952AB45CFA97A0B3, 455, 156},
+    {0xDE469FBD99A05FE3, 481, 164},    {0xA59BC234DB398C25, 508, 172},
+    {0xF6C69A72A3989F5C, 534, 180},    {0xB7DCBF5354E9BECE, 561, 188},
+    {0x88FCF317F22241E2, 588, 196},    {0xCC20CE9BD35C78A5, 614, 204},
+    {0x98165AF37B2153DF, 641, 212},    {0xE2A0B5DC971F303A, 667, 220},
+    {0xA8D9D1535CE3B396, 694, 228},    {0xFB9B7CD9A4A7443C, 720, 236},
+    {0xBB764C4CA7A44410, 747, 244},    {0x8BAB8EEFB6409C1A, 774, 252},
+    {0xD01FEF10A657842C, 800, 260},    {0x9B10A4E5E9913129, 827, 268},
+    {0xE7109BFBA19C0C9D, 853, 276},    {0xAC2820D9623BF429, 880, 284},
+    {0x80444B5E7AA7CF85, 907, 292},    {0xBF21E44003ACDD2D, 933, 300},
+    {0x8E679C2F5E44FF8F, 960, 308},    {0xD433179D9C8CB841, 986, 316},
+    {0x9E19DB92B4E31BA9, 1013, 324}};
+
+// The scaled value's binary exponent lands in [Alpha, Gamma], so its
+// integer part fits in 32 bits.
+constexpr i32 Alpha = -60;
+constexpr i32 Gamma = -32;
+
+CachedPower cached_power(i32 e) {
+  i32 f = Alpha - e - 1;
+  i32 k = f * 78913 / (1 << 18) + (f > 0);
+  auto c = CachedPowers[(300 + k + 7) / 8];
+  check(Alpha <= c.e + e + 64 && c.e + e + 64 <= Gamma);
+  return c;
+}
+
+// Move the last digit down while that brings it closer to the value and
+// keeps it inside the interval.
+void round_last(char* buf, u32 n, u64 dist, u64 delta, u64 rest, u64 ten_k) {
+  while (rest < dist && delta - rest >= ten_k
+         && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+    --buf[n - 1];
+    rest += ten_k;
+  }
+}
+
+// Digits of a number in (low, high), closest to w; all three have the
+// same exponent. Adds the exponent of the last digit to `k`.
+u32 generate_digits(char* buf, i32& k, DiyFp low, DiyFp w, DiyFp high) {
+  u64 delta = high.f - low.f;
+  u64 dist = high.f - w.f;
+  u32 shift = u32(-high.e);
+  u64 one = 1ull << shift;
+  u32 integral = u32(high.f >> shift);
+  u64 fraction = high.f & (one - 1);
+
+  u32 n {};
+  for (u32 m = digit_count(integral); m;) {
+    u64 pow10 = Pow10[--m];
+    buf[n++] = char('0' + integral / pow10);
+    integral = u32(integral % pow10);
+    u64 rest = (u64(integral) << shift) + fraction;
+    if (rest <= delta) {
+      k += i32(m);
+      round_last(buf, n, dist, delta, rest, pow10 << shift);
+      return n;
+    }
+  }
+
+  i32 m {};
+  do {
+    fraction *= 10;
+    buf[n++] = char('0' + (fraction >> shift));
+    fraction &= one - 1;
+    delta *= 10;
+    dist *= 10;
+    ++m;
+  } while (fraction > delta);
+  k -= m;
+  round_last(buf, n, dist, delta, fraction, one);
+  return n;
+}
+
+template <class T>
+struct FloatTraits;
+
+template <>
+struct FloatTraits<f64> {
+  using Bits = u64;
+  static constexpr u32 precision = 53;
+  static constexpr i32 bias = 1075;
+  static constexpr u32 max_exponent = 2047;
+  static constexpr i32 sig_digits = 17;
+};
+
+template <>
+struct FloatTraits<f32> {
+  using Bits = u32;
+  static constexpr u32 precision = 24;
+  static constexpr i32 bias = 150;
+  static constexpr u32 max_exponent = 255;
+  static constexpr i32 sig_digits = 9;
+};
+
+// Shortest digits of a positive finite value, which is digits * 10^k.
+template <class T>
+u32 shortest(char* buf, i32& k, u64 mantissa, u32 exponent) {
+  using F = FloatTraits<T>;
+  u64 hidden = 1ull << (F::precision - 1);
+  DiyFp v = exponent
+      ? DiyFp {mantissa | hidden, i32(exponent) - F::bias}
+      : DiyFp {mantissa, 1 - F::bias};
+  // At a power of two the gap below is half the gap above.
+  bool closer = !mantissa && exponent > 1;
+  auto high = normalize({2 * v.f + 1, v.e - 1});
+  DiyFp low = closer ? DiyFp {4 * v.f - 1, v.e - 2} : DiyFp {2 * v.f - 1, v.e - 1};
+  low = {low.f << (low.e - high.e), high.e};
+  auto w = normalize(v);
+
+  auto c = cached_power(high.e);
+  DiyFp scale {c.f, c.e};
+  auto sw = mul(w, scale);
+  auto slow = mul(low, scale);
+  auto shigh = mul(high, scale);
+  k = -c.k;
+  return generate_digits(
+      buf, k, {slow.f + 1, slow.e}, sw, {shigh.f - 1, shigh.e});
+}
+
+// Lays out digits * 10^k like %g: plain when the exponent is in
+// [-4, sig_digits), else as d.ddde±XX.
+char* write_decimal(char* out, char const* d, u32 n, i32 k, i32 sig_digits) {
+  i32 point = i32(n) + k;
+  i32 x = point - 1;
+  if (-4 <= x && x < sig_digits) {
+    if (k >= 0) {
+      memcpy(out, d, n);
+      out += n;
+      for (i32 i {}; i < k; ++i)
+        *out++ = '0';
+    } else if (point > 0) {
+      memcpy(out, d, u32(point));
+      out += point;
+      *out++ = '.';
+      memcpy(out, d + point, n - u32(point));
+      out += n - u32(point);
+    } else {
+      *out++ = '0';
+      *out++ = '.';
+      for (i32 i = point; i < 0; ++i)
+        *out++ = '0';
+      memcpy(out, d, n);
+      out += n;
+    }
+    return out;
+  }
+  *out++ = d[0];
+  if (n > 1) {
+    *out++ = '.';
+    memcpy(out, d + 1, n - 1);
+    out += n - 1;
+  }
+  *out++ = 'e';
+  *out++ = x < 0 ? '-' : '+';
+  u32 e = u32(x < 0 ? -x : x);
+  if (e >= 100)
+    *out++ = char('0' + e / 100);
+  memcpy(out, digits.pairs + 2 * (e % 100), 2);
+  return out + 2;
+}
+
+template <class T>
+char* write_float(T x, char* out) {
+  using F = FloatTraits<T>;
+  typename F::Bits bits;
+  memcpy(&bits, &x, sizeof(x));
+  if (bits >> (sizeof(bits) * 8 - 1))
+    *out++ = '-';
+  u64 mantissa = bits & ((typename F::Bits(1) << (F::precision - 1)) - 1);
+  u32 exponent = u32(bits >> (F::precision - 1)) & F::max_exponent;
+  if (exponent == F::max_exponent) {
+    memcpy(out, mantissa ? "nan" : "inf", 3);
+    return out + 3;
+  }
+  if (!exponent && !mantissa) {
+    *out = '0';
+    return out + 1;
+  }
+  char buf[32];
+  i32 k;
+  u32 n = shortest<T>(buf, k, mantissa, exponent);
+  return write_decimal(out, buf, n, k, F::sig_digits);
+}
+
+}
+
+char* format(u8 x, char* out) {
+  memcpy(out, digits.byte[x], 4);
+  return out + digits.byte_len[x];
+}
+
+char* format(i8 x, char* out) {
+  memcpy(out, digits.signed_byte[u8(x)], 4);
+  return out + digits.signed_byte_len[u8(x)];
+}
+
+char* format(u16 x, char* out) { return write_unsigned(u32(x), out); }
+char* format(u32 x, char* out) { return write_unsigned(x, out); }
+char* format(u64 x, char* out) { return write_unsigned(x, out); }
+char* format(i16 x, char* out) { return write_signed<u32>(i32(x), out); }
+char* format(i32 x, char* out) { return write_signed<u32>(x, out); }
+char* format(i64 x, char* out) { return write_signed<u64>(x, out); }
+char* format(f32 x, char* out) { return write_float(x, out); }
+char* format(f64 x, char* out) { return write_float(x, out); }
+
+template <class T>
+char const* format_array(Print& p, char const* it, u32 count) {
+  auto& chars = p.chars;
+  u64 room = 2 + u64(count) * (format_max<T> + 1);
+  check(len(chars) + room <= ~0u);
+  chars.expand(u32(len(chars) + room));
+  char* out = chars.end();
+  *out++ = '[';
+  for (u32 i {}; i < count; ++i, it += sizeof(T)) {
+    T x;
+    memcpy(&x, it, sizeof(T));
+    out = format(x, out);
+    *out++ = ' ';
+  }
+  // The last separator becomes the closing bracket.
+  out -= !!count;
+  *out++ = ']';
+  chars.size = u32(out - chars.begin());
+  return it;
+}
+
+template char const* format_array<u8>(Print&, char const*, u32);
+template char const* format_array<u16>(Print&, char const*, u32);
+template char const* format_array<u32>(Print&, char const*, u32);
+template char const* format_array<u64>(Print&, char const*, u32);
+template char const* format_array<i8>(Print&, char const*, u32);
+template char const* format_array<i16>(Print&, char const*, u32);
+template char const* format_array<i32>(Print&, char const*, u32);
+template char const* format_array<i64>(Print&, char const*, u32);
+template char const* format_array<f32>(Print&, char const*, u32);
+template char const* format_array<f64>(Print&, char const*, u32);
+
+namespace {
+
+template <class T>
+Str formatted(char (&buf)[32], T x) {
+  return {buf, format(x, buf)};
+}
+
+template <class T>
+void check_integer(T x, char const* fmt) {
+  char buf[32];
+  char expected[32];
+  auto n = snprintf(expected, sizeof(expected), fmt, x);
+  check(formatted(buf, x) == Str {expected, u32(n)});
+}
+
+u64 rng_state = 88172645463325252ull;
+u64 rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+template <class T, class B>
+void check_roundtrip(B bits) {
+  T x;
+  memcpy(&x, &bits, sizeof(x));
+  char buf[32];
+  char* end = format(x, buf);
+  check(u32(end - buf) <= format_max<T>);
+  *end = '\0';
+  T y;
+  if constexpr (sizeof(T) == 4)
+    y = strtof(buf, nullptr);
+  else
+    y = strtod(buf, nullptr);
+  if (x != x) {
+    check(y != y);
+    return;
+  }
+  B back;
+  memcpy(&back, &y, sizeof(y));
+  check(back == bits);
+}
+
+}
+
+void test_format() {
+  char buf[32];
+  for (u32 i {}; i < 256; ++i) {
+    check_integer(u32(u8(i)), "%u");
+    check_integer(i32(i8(i)), "%d");
+  }
+  u64 edges[] {0, 1, 9, 10, 99, 100, 65535, 65536, 4294967295ull,
+      4294967296ull, 9999999999999999999ull, 10000000000000000000ull, ~0ull};
+  for (u64 x: edges) {
+    check_integer((unsigned long long) x, "%llu");
+    check_integer((long long) x, "%lld");
+    check_integer(u32(x), "%u");
+    check_integer(i32(x), "%d");
+  }
+  for (u32 i {}; i < 100000; ++i) {
+    u64 x = rng() >> (rng() % 64);
+    check_integer((unsigned long long) x, "%llu");
+    check_integer((long long) x, "%lld");
+    check_integer(u32(x), "%u");
+    check_integer(i32(x), "%d");
+    char wide[32];
+    check(formatted(buf, u16(x)) == formatted(wide, u32(u16(x))));
+  }
+
+  check(formatted(buf, 0.1f) == "0.1"_s);
+  check(formatted(buf, 0.1) == "0.1"_s);
+  check(formatted(buf, 1.5f) == "1.5"_s);
+  check(formatted(buf, -0.0) == "-0"_s);
+  check(formatted(buf, 100.0) == "100"_s);
+  check(formatted(buf, 1e16) == "10000000000000000"_s);
+  check(formatted(buf, 1e17) == "1e+17"_s);
+  check(formatted(buf, 1e-4f) == "0.0001"_s);
+  check(formatted(buf, 1.25e-5f) == "1.25e-05"_s);
+  check(formatted(buf, 3.4028235e38f) == "3.4028235e+38"_s);
+  check(formatted(buf, 1e-45f) == "1e-45"_s);
+  check(formatted(buf, 5e-324) == "5e-324"_s);
+  check(formatted(buf, 1.7976931348623157e308) == "1.7976931348623157e+308"_s);
+  check(formatted(buf, __builtin_inf()) == "inf"_s);
+  check(formatted(buf, -__builtin_inff()) == "-inf"_s);
+  check(formatted(buf, __builtin_nan("")) == "nan"_s);
+
+  for (u32 i {}; i < 300000; ++i) {
+    check_roundtrip<f32>(u32(rng()));
+    check_roundtrip<f64>(rng());
+  }
+  // Every power of two, where the rounding interval is lopsided.
+  for (u32 e {}; e < 255; ++e)
+    check_roundtrip<f32>(e << 23);
+  for (u64 e {}; e < 2047; ++e)
+    check_roundtrip<f64>(e << 52);
+
+  Print p;
+  u8 bytes[] {0, 7, 42, 255};
+  format_array<u8>(p, reinterpret_cast<char const*>(bytes), 4);
+  format_array<i8>(p, reinterpret_cast<char const*>(bytes), 4);
+  format_array<f32>(p, nullptr, 0);
+  check(p.chars.span() == "[0 7 42 255][0 7 42 -1][]"_s);
+
+  p.chars.size = 0;
+  sprint(
+      p, 0.1f, ' ', 2.5, ' ', -5, ' ', u8(200), ' ', (void*) 0x1234, ' ',
+      (void*) nullptr);
+  check(p.chars.span() == "0.1 2.5 -5 200 0x1234 0x0"_s);
+  println("Format tests passed");
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.hh"
+
+// Decimal formatting straight into a buffer, without snprintf. Each
+// `format` writes the value at `out` and returns the end of the text. It
+// may store up to `format_max<T>` bytes, even past the returned end, so
+// callers reserve that much room first.
+//
+// Integers are written two digits at a time from a lookup table, and
+// 8-bit values with a single table load and store. Floats are written
+// with the shortest digits that read back to the same value (Grisu2),
+// laid out like printf's %g.
+template <class T>
+constexpr u32 format_max = 0;
+template <>
+constexpr u32 format_max<u8> = 4;
+template <>
+constexpr u32 format_max<i8> = 4;
+template <>
+constexpr u32 format_max<u16> = 5;
+template <>
+constexpr u32 format_max<i16> = 6;
+template <>
+constexpr u32 format_max<u32> = 10;
+template <>
+constexpr u32 format_max<i32> = 11;
+template <>
+constexpr u32 format_max<u64> = 20;
+template <>
+constexpr u32 format_max<i64> = 20;
+template <>
+constexpr u32 format_max<f32> = 16;
+template <>
+constexpr u32 format_max<f64> = 25;
+
+char* format(u8 x, char* out);
+char* format(u16 x, char* out);
+char* format(u32 x, char* out);
+char* format(u64 x, char* out);
+char* format(i8 x, char* out);
+char* format(i16 x, char* out);
+char* format(i32 x, char* out);
+char* format(i64 x, char* out);
+char* format(f32 x, char* out);
+char* format(f64 x, char* out);
+
+// Appends "[a b c]" for the `count` values of type T stored at `it`, which
+// need not be aligned, and returns the end of the array. Room for the
+// whole array is reserved once up front.
+template <class T>
+char const* format_array(Print& p, char const* it, u32 count);
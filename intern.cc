@@ -0,0 +1,76 @@
+#include "intern.hh"
+
+namespace {
+
+// FNV-1a.
+u32 hash(Str s) {
+  u32 h = 2166136261u;
+  for (char c: s)
+    h = (h ^ u8(c)) * 16777619u;
+  return h;
+}
+
+void insert(Array<u32>& slots, u32 h, u32 id) {
+  u32 mask = len(slots) - 1;
+  u32 i = h & mask;
+  while (slots[i])
+    i = (i + 1) & mask;
+  slots[i] = id + 1;
+}
+
+}
+
+MaybeU32 StrIndex::find(Str s) const {
+  if (!slots)
+    return {};
+  u32 mask = len(slots) - 1;
+  for (u32 i = hash(s) & mask; slots[i]; i = (i + 1) & mask) {
+    u32 id = slots[i] - 1;
+    if (strs[id] == s)
+      return MaybeU32::from(id);
+  }
+  return {};
+}
+
+u32 StrTable::add(Str s) {
+  if (auto id = find(s))
+    return *id;
+  u32 id = len(strs);
+  strs.push(s);
+  if (2 * len(strs) > len(slots)) {
+    Array<u32> grown(len(slots) ? 2 * len(slots) : 16);
+    for (u32 i {}; i < len(strs); ++i)
+      insert(grown, hash(strs[i]), i);
+    slots = move(grown);
+  } else {
+    insert(slots, hash(s), id);
+  }
+  return id;
+}
+
+void test_str_table() {
+  StrTable t;
+  check(!t.find("a"_s));
+  check(t.add("a"_s) == 0);
+  check(t.add("b"_s) == 1);
+  check(t.add("a"_s) == 0);
+  check(t.add(""_s) == 2);
+  check(*t.find(""_s) == 2);
+
+  // Enough strings to grow the index several times.
+  Print p;
+  for (u32 i {}; i < 1000; ++i) {
+    p.chars.size = 0;
+    sprint(p, "name"_s, i);
+    check(t.add(p.chars.span()) == i + 3);
+  }
+  for (u32 i {}; i < 1000; ++i) {
+    p.chars.size = 0;
+    sprint(p, "name"_s, i);
+    check(*t.find(p.chars.span()) == i + 3);
+    check(t[i + 3] == p.chars.span());
+  }
+  check(!t.find("name1000"_s));
+  check(len(t) == 1003);
+  println("String table tests passed");
+}
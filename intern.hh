@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.hh"
+
+// Read-only lookup over interned strings whose storage is owned elsewhere,
+// such as a StrTable or a compiled schema.
+struct StrIndex {
+  SpanArray<char> strs;
+  Span<u32> slots;  // id + 1, or 0 for an empty slot; a power of two long
+
+  MaybeU32 find(Str s) const;
+
+  friend u32 len(StrIndex const& t) { return len(t.strs); }
+  Str operator[](u32 id) const { return strs[id]; }
+};
+
+// Interned strings. Each distinct string is stored once and numbered in the
+// order it was added; an open-addressing hash index over those numbers
+// (linear probing, kept at most half full) finds a string's id in O(1)
+// expected time.
+struct StrTable {
+  ArrayList<char> strs;
+  Array<u32> slots;
+
+  StrIndex view() const { return {strs.view(), slots}; }
+  MaybeU32 find(Str s) const { return view().find(s); }
+  // Id of `s`, adding it first if it isn't in the table yet.
+  u32 add(Str s);
+
+  friend u32 len(StrTable const& t) { return len(t.strs); }
+  Str operator[](u32 id) const { return strs[id]; }
+};
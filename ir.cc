@@ -0,0 +1,647 @@
+#include "ir.hh"
+
+namespace lang {
+
+namespace {
+
+Ir::Inst inst(Ir::Op op, u32 a = Ir::None, u32 b = Ir::None, i64 imm = 0) {
+  return {op, 8, equal, Ir::None, a, b, imm};
+}
+
+Ir::Value def(Ir& ir, Ir::Inst i) {
+  i.dst = ir.values++;
+  ir.code.push(i);
+  return {i.dst};
+}
+
+}
+
+Ir::Value Ir::arg(u32 index) {
+  check(index < 6 && len(code) == index);
+  return def(*this, inst(Arg, None, None, index));
+}
+
+Ir::Value Ir::constant(u64 x) {
+  return def(*this, inst(Const, None, None, i64(x)));
+}
+
+Ir::Value Ir::load(Value base, i32 ofs, u8 size) {
+  check(size == 1 || size == 2 || size == 4 || size == 8);
+  auto i = inst(Load, base.id, None, ofs);
+  i.size = size;
+  return def(*this, i);
+}
+
+void Ir::store(Value base, i32 ofs, Value x) {
+  code.push(inst(Store, base.id, x.id, ofs));
+}
+
+Ir::Value Ir::add(Value a, Value b) { return def(*this, inst(Add, a.id, b.id)); }
+
+Ir::Value Ir::add(Value a, i32 n) {
+  return def(*this, inst(AddImm, a.id, None, n));
+}
+
+Ir::Value Ir::sub(Value a, Value b) { return def(*this, inst(Sub, a.id, b.id)); }
+
+Ir::Value Ir::mul(Value a, Value b) { return def(*this, inst(Mul, a.id, b.id)); }
+
+void Ir::assign(Value dst, Value src) {
+  auto i = inst(Copy, src.id);
+  i.dst = dst.id;
+  code.push(i);
+}
+
+void Ir::place(Label l) { code.push(inst(Place, None, None, l.id)); }
+
+void Ir::jump(Label l) { code.push(inst(Jump, None, None, l.id)); }
+
+void Ir::branch(cond_t cond, Value a, Value b, Label l) {
+  auto i = inst(Branch, a.id, b.id, l.id);
+  i.cond = cond;
+  code.push(i);
+}
+
+Ir::Value Ir::call(void const* fn, Span<Value> args) {
+  check(len(args) <= 6);
+  u32 first = len(call_args);
+  for (auto x: args)
+    call_args.push(x.id);
+  return def(*this, inst(Call, first, len(args), i64(fn)));
+}
+
+void Ir::ret(Value x) { code.push(inst(Ret, x.id)); }
+
+namespace {
+
+constexpr reg64 arg_regs[] {rdi, rsi, rdx, rcx, r8, r9};
+
+// rax, r10 and r11 are left as scratch registers: rax for call targets and
+// results, the other two for spilled operands. Caller-saved registers come
+// first, as they need no saving.
+constexpr reg64 allocatable[] {
+    rcx, rdx, rsi, rdi, r8, r9, rbx, rbp, r12, r13, r14, r15};
+
+constexpr u16 bit(reg64 r) { return u16(1u << r.id); }
+
+constexpr u16 callee_saved =
+    bit(rbx) | bit(rbp) | bit(r12) | bit(r13) | bit(r14) | bit(r15);
+
+// Calls `f` with each value that `i` reads.
+template <class F>
+void each_use(Ir const& ir, Ir::Inst const& i, F f) {
+  switch (i.op) {
+  case Ir::Load:
+  case Ir::AddImm:
+  case Ir::Copy:
+  case Ir::Ret:
+    f(i.a);
+    break;
+  case Ir::Store:
+  case Ir::Add:
+  case Ir::Sub:
+  case Ir::Mul:
+  case Ir::Branch:
+    f(i.a);
+    f(i.b);
+    break;
+  case Ir::Call:
+    for (u32 k {}; k < i.b; ++k)
+      f(ir.call_args[i.a + k]);
+    break;
+  default:
+    break;
+  }
+}
+
+struct Interval {
+  u32 start;
+  u32 end;
+  bool crosses_call;
+};
+
+Array<Interval> intervals(Ir const& ir) {
+  Array<Interval> live(ir.values);
+  for (auto& iv: live)
+    iv = {Ir::None, 0, false};
+  Array<u32> label_at(ir.labels);
+  for (auto& x: label_at)
+    x = Ir::None;
+
+  u32 n = len(ir.code);
+  for (u32 p {}; p < n; ++p) {
+    auto& i = ir.code[p];
+    auto mention = [&](u32 v) {
+      auto& iv = live[v];
+      iv.start = iv.start == Ir::None || p < iv.start ? p : iv.start;
+      iv.end = p > iv.end ? p : iv.end;
+    };
+    each_use(ir, i, mention);
+    if (i.dst != Ir::None)
+      mention(i.dst);
+    if (i.op == Ir::Arg)
+      live[i.dst].start = 0;
+    if (i.op == Ir::Place)
+      label_at[u32(i.imm)] = p;
+  }
+
+  // Positions only order the code, so a value that is live around a loop
+  // must also hold its register through the rest of the loop: from the
+  // label to the jump back. Nested loops may need another round.
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (u32 j {}; j < n; ++j) {
+      auto& i = ir.code[j];
+      if (i.op != Ir::Jump && i.op != Ir::Branch)
+        continue;
+      u32 h = label_at[u32(i.imm)];
+      check(h != Ir::None);
+      if (h > j)
+        continue;
+      for (auto& iv: live) {
+        if (iv.start == Ir::None)
+          continue;
+        if (iv.start < h && iv.end >= h && iv.end < j) {
+          iv.end = j;
+          changed = true;
+        }
+        if (iv.start > h && iv.start <= j && iv.end > j) {
+          iv.start = h;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // calls[p] is the number of calls before position p.
+  Array<u32> calls(n + 1);
+  for (u32 p {}; p < n; ++p)
+    calls[p + 1] = calls[p] + (ir.code[p].op == Ir::Call);
+  for (auto& iv: live)
+    iv.crosses_call = iv.start != Ir::None && iv.end > iv.start + 1 &&
+                      calls[iv.end] > calls[iv.start + 1];
+  return live;
+}
+
+}
+
+Allocation allocate(Ir const& ir) {
+  auto live = intervals(ir);
+  Allocation a {Array<Location>(ir.values)};
+
+  // Values by the start of their intervals, with ties in value order.
+  List<u32> order;
+  for (u32 v {}; v < ir.values; ++v) {
+    if (live[v].start == Ir::None)
+      continue;
+    order.push(v);
+    for (u32 k = len(order) - 1; k && live[order[k - 1]].start > live[v].start; --k)
+      swap(order[k - 1], order[k]);
+  }
+
+  // Arguments would rather stay where they arrive.
+  Array<u8> hint(ir.values);
+  for (auto& i: ir.code)
+    if (i.op == Ir::Arg)
+      hint[i.dst] = u8(arg_regs[i.imm].id + 1);
+
+  auto spill = [&](u32 v) { a.at[v] = {true, reg64(), a.slots++}; };
+
+  List<u32> active;
+  u16 free {};
+  for (auto r: allocatable)
+    free |= bit(r);
+  for (u32 v: order) {
+    auto& iv = live[v];
+    auto& at = ir.code[iv.start];
+    // An operand that ends where `v` is defined can hand over its register;
+    // lowering takes care when the result overlaps an operand.
+    bool handover = at.dst == v && at.op != Ir::Arg;
+    u32 kept {};
+    for (u32 w: active) {
+      u32 end = live[w].end;
+      if (end < iv.start || (end == iv.start && handover))
+        free |= bit(a.at[w].reg);
+      else
+        active[kept++] = w;
+    }
+    active.size = kept;
+
+    u16 allowed = iv.crosses_call ? callee_saved : u16(~0u);
+    if (u16 options = free & allowed) {
+      reg64 r;
+      if (hint[v] && (options & bit(reg64(u8(hint[v] - 1)))))
+        r = reg64(u8(hint[v] - 1));
+      else
+        for (auto x: allocatable)
+          if (options & bit(x)) {
+            r = x;
+            break;
+          }
+      a.at[v] = {false, r, 0};
+      free &= u16(~bit(r));
+      active.push(v);
+      continue;
+    }
+
+    // Spill whichever of `v` and the active intervals ends last, as that
+    // frees a register for longest.
+    u32 victim = Ir::None;
+    for (u32 k {}; k < len(active); ++k) {
+      u32 w = active[k];
+      if ((allowed & bit(a.at[w].reg)) &&
+          (victim == Ir::None || live[w].end > live[active[victim]].end))
+        victim = k;
+    }
+    if (victim != Ir::None && live[active[victim]].end > iv.end) {
+      u32 w = active[victim];
+      a.at[v] = {false, a.at[w].reg, 0};
+      spill(w);
+      active[victim] = v;
+    } else {
+      spill(v);
+    }
+  }
+
+  for (u32 v {}; v < ir.values; ++v)
+    if (live[v].start != Ir::None && !a.at[v].spilled)
+      a.saved |= u16(bit(a.at[v].reg) & callee_saved);
+  return a;
+}
+
+void parallel_move(Backend& b, Span<Move> moves) {
+  List<Move> pending;
+  for (auto m: moves)
+    if (m.from != m.to)
+      pending.push(m);
+  while (len(pending)) {
+    // Any move whose destination no other move still reads can go first.
+    bool moved = false;
+    for (u32 k {}; k < len(pending) && !moved; ++k) {
+      bool read = false;
+      for (auto& m: pending)
+        read |= m.from == pending[k].to;
+      if (!read) {
+        b.mov(pending[k].to, pending[k].from);
+        pending[k] = pending.last();
+        pending.pop();
+        moved = true;
+      }
+    }
+    if (moved)
+      continue;
+
+    // Only cycles are left. An exchange completes one move of a cycle and
+    // leaves the rest of it one shorter.
+    auto m = pending.last();
+    pending.pop();
+    b.xchg(m.from, m.to);
+    u32 kept {};
+    for (auto x: pending) {
+      if (x.from == m.to)
+        x.from = m.from;
+      else if (x.from == m.from)
+        x.from = m.to;
+      if (x.from != x.to)
+        pending[kept++] = x;
+    }
+    pending.size = kept;
+  }
+}
+
+namespace {
+
+struct Lowering {
+  Ir const& ir;
+  Allocation const& a;
+  Backend& b;
+  List<placeholder> labels {};
+  i32 frame {};
+
+  indir<reg64> slot(Location const& l) { return rsp[i32(8 * l.slot)]; }
+
+  // The register holding `v`, which is `scratch` if `v` is spilled.
+  reg64 use(u32 v, reg64 scratch) {
+    auto& l = a.at[v];
+    if (!l.spilled)
+      return l.reg;
+    b.mov(scratch, slot(l));
+    return scratch;
+  }
+
+  // The register to compute `v` in, before `done` stores it.
+  reg64 target(u32 v, reg64 scratch) {
+    auto& l = a.at[v];
+    return l.spilled ? scratch : l.reg;
+  }
+
+  void done(u32 v, reg64 r) {
+    auto& l = a.at[v];
+    if (l.spilled)
+      b.mov(slot(l), r);
+  }
+
+  void move(reg64 to, reg64 from) {
+    if (to != from)
+      b.mov(to, from);
+  }
+
+  void constant(reg64 r, u64 x) {
+    if (x < 0x80000000)
+      b.mov(r, u32(x));
+    else if (x >= 0xffffffff80000000)
+      b.mov(r, i32(x));
+    else
+      b.mov(r, x);
+  }
+
+  // Saves the callee-saved registers above the spill slots.
+  void save_or_restore(bool save) {
+    u32 k = a.slots;
+    for (u8 r {}; r < n_regs; ++r) {
+      if (!(a.saved & (1u << r)))
+        continue;
+      if (save)
+        b.mov(rsp[i32(8 * k++)], reg64(r));
+      else
+        b.mov(reg64(r), rsp[i32(8 * k++)]);
+    }
+  }
+
+  void prologue() {
+    bool calls = false;
+    for (auto& i: ir.code)
+      calls |= i.op == Ir::Call;
+    u32 words = a.slots + u32(__builtin_popcount(a.saved));
+    // Calls need rsp 16-byte aligned; it is 8 past that on entry.
+    if (calls && words % 2 == 0)
+      ++words;
+    frame = i32(8 * words);
+    if (frame)
+      b.add(rsp, -frame);
+    save_or_restore(true);
+
+    List<Move> moves;
+    for (auto& i: ir.code) {
+      if (i.op != Ir::Arg)
+        continue;
+      auto& l = a.at[i.dst];
+      if (l.spilled)
+        b.mov(slot(l), arg_regs[i.imm]);
+      else
+        moves.push({arg_regs[i.imm], l.reg});
+    }
+    parallel_move(b, moves.span());
+  }
+
+  void arithmetic(Ir::Inst const& i) {
+    auto rd = target(i.dst, r10);
+    auto ra = use(i.a, r10);
+    auto rb = use(i.b, r11);
+    if (rd == rb && ra != rb) {
+      if (i.op == Ir::Sub) {
+        move(r11, rb);
+        rb = r11;
+      } else {
+        swap(ra, rb);
+      }
+    }
+    move(rd, ra);
+    if (i.op == Ir::Add)
+      b.add(rd, rb);
+    else if (i.op == Ir::Sub)
+      b.sub(rd, rb);
+    else
+      b.imul(rd, rb);
+    done(i.dst, rd);
+  }
+
+  void call(Ir::Inst const& i) {
+    List<Move> moves;
+    for (u32 k {}; k < i.b; ++k) {
+      auto& l = a.at[ir.call_args[i.a + k]];
+      if (!l.spilled)
+        moves.push({l.reg, arg_regs[k]});
+    }
+    parallel_move(b, moves.span());
+    for (u32 k {}; k < i.b; ++k) {
+      auto& l = a.at[ir.call_args[i.a + k]];
+      if (l.spilled)
+        b.mov(arg_regs[k], slot(l));
+    }
+    b.mov(rax, u64(i.imm));
+    b.call(rax);
+    auto& d = a.at[i.dst];
+    if (d.spilled)
+      b.mov(slot(d), rax);
+    else
+      move(d.reg, rax);
+  }
+
+  void lower(Ir::Inst const& i) {
+    switch (i.op) {
+    case Ir::Arg:
+      break;
+    case Ir::Const: {
+      auto rd = target(i.dst, r10);
+      constant(rd, u64(i.imm));
+      done(i.dst, rd);
+      break;
+    }
+    case Ir::Load: {
+      auto ra = use(i.a, r10);
+      auto rd = target(i.dst, r10);
+      auto at = ra[i32(i.imm)];
+      if (i.size == 1)
+        b.movzx8(rd, at);
+      else if (i.size == 2)
+        b.movzx16(rd, at);
+      else if (i.size == 4)
+        b.mov32(rd, at);
+      else
+        b.mov(rd, at);
+      done(i.dst, rd);
+      break;
+    }
+    case Ir::Store: {
+      auto ra = use(i.a, r10);
+      auto rx = use(i.b, r11);
+      b.mov(ra[i32(i.imm)], rx);
+      break;
+    }
+    case Ir::Add:
+    case Ir::Sub:
+    case Ir::Mul:
+      arithmetic(i);
+      break;
+    case Ir::AddImm: {
+      auto rd = target(i.dst, r10);
+      auto ra = use(i.a, r10);
+      if (rd == ra)
+        b.add(rd, i32(i.imm));
+      else
+        b.lea(rd, ra[i32(i.imm)]);
+      done(i.dst, rd);
+      break;
+    }
+    case Ir::Copy: {
+      auto rd = target(i.dst, r10);
+      move(rd, use(i.a, rd));
+      done(i.dst, rd);
+      break;
+    }
+    case Ir::Place:
+      b.label(labels[u32(i.imm)]);
+      break;
+    case Ir::Jump:
+      b.jmp(relaxed(labels[u32(i.imm)]));
+      break;
+    case Ir::Branch:
+      b.cmp(use(i.a, r10), use(i.b, r11));
+      b.jcc(i.cond, relaxed(labels[u32(i.imm)]));
+      break;
+    case Ir::Call:
+      call(i);
+      break;
+    case Ir::Ret:
+      move(rax, use(i.a, rax));
+      save_or_restore(false);
+      if (frame)
+        b.add(rsp, frame);
+      b.ret();
+      break;
+    }
+  }
+};
+
+}
+
+void lower(Ir const& ir, Allocation const& a, Backend& b) {
+  Lowering l {ir, a, b};
+  for (u32 k {}; k < ir.labels; ++k)
+    l.labels.push(b.ph());
+  l.prologue();
+  for (auto& i: ir.code)
+    l.lower(i);
+  b.relax();
+}
+
+}
+
+using namespace lang;
+
+namespace {
+
+u64 mix(u64 a, u64 b) { return a * 31 + b; }
+
+u64 weigh(u64 a, u64 b, u64 c, u64 d, u64 e, u64 f) {
+  return a + 2 * b + 3 * c + 5 * d + 7 * e + 11 * f;
+}
+
+}
+
+void test_ir() {
+  {
+    // Sums the u32s above a threshold.
+    Ir f;
+    auto p = f.arg(0), n = f.arg(1), k = f.arg(2);
+    auto sum = f.constant(0);
+    auto end = f.add(p, f.mul(n, f.constant(4)));
+    auto top = f.label(), next = f.label(), done = f.label();
+    f.branch(above_equal, p, end, done);
+    f.place(top);
+    auto x = f.load(p, 0, 4);
+    f.branch(below_equal, x, k, next);
+    f.assign(sum, f.add(sum, x));
+    f.place(next);
+    f.assign(p, f.add(p, 4));
+    f.branch(below, p, end, top);
+    f.place(done);
+    f.ret(sum);
+    check(!allocate(f).slots);
+
+    Stream out;
+    Backend b {out};
+    compile(f, b);
+    Executable exec {out.span()};
+    auto fn = exec.as<u64, u32 const*, u64, u64>();
+    u32 xs[100];
+    u64 expected {};
+    for (u32 i {}; i < 100; ++i) {
+      xs[i] = i * 2654435761u;
+      if (xs[i] > 1u << 31)
+        expected += xs[i];
+    }
+    check(fn(xs, 100, 1u << 31) == expected);
+    check(fn(xs, 0, 0) == 0);
+  }
+  {
+    // More values live at once than there are registers.
+    Ir f;
+    auto p = f.arg(0);
+    Ir::Value xs[20];
+    for (u32 i {}; i < 20; ++i)
+      xs[i] = f.load(p, i32(8 * i), u8(1 << (i % 4)));
+    auto sum = f.constant(~0ull);
+    for (u32 i {}; i < 20; ++i) {
+      auto term = f.mul(xs[i], f.constant(i + 1));
+      f.assign(sum, i % 3 ? f.add(sum, term) : f.sub(sum, term));
+    }
+    f.ret(sum);
+    check(allocate(f).slots);
+
+    Stream out;
+    Backend b {out};
+    compile(f, b);
+    Executable exec {out.span()};
+    u64 data[20];
+    u64 expected = ~0ull;
+    for (u32 i {}; i < 20; ++i) {
+      data[i] = 0x0123456789abcdef * (i + 3);
+      u32 size = 1 << (i % 4);
+      u64 x = size == 8 ? data[i] : data[i] & ((1ull << 8 * size) - 1);
+      expected = i % 3 ? expected + x * (i + 1) : expected - x * (i + 1);
+    }
+    check(exec.as<u64, u64 const*>()(data) == expected);
+  }
+  {
+    // Values live across calls.
+    Ir f;
+    auto x = f.arg(0), y = f.arg(1);
+    auto a = f.add(x, 7);
+    auto r = f.call(mix, y, a);
+    auto s = f.call(mix, r, x);
+    f.ret(f.sub(f.add(s, a), y));
+    auto al = allocate(f);
+    check(!al.slots && al.saved);
+
+    Stream out;
+    Backend b {out};
+    compile(f, b);
+    Executable exec {out.span()};
+    u64 expected = mix(mix(20, 12 + 7), 12) + 12 + 7 - 20;
+    check(exec.as<u64, u64, u64>()(12, 20) == expected);
+  }
+  {
+    // Arguments passed on reversed and rotated, which takes exchanges.
+    for (u32 rotate {}; rotate < 2; ++rotate) {
+      Ir f;
+      Ir::Value v[6];
+      for (u32 i {}; i < 6; ++i)
+        v[i] = f.arg(i);
+      if (rotate)
+        f.ret(f.call(weigh, v[1], v[2], v[3], v[4], v[5], v[0]));
+      else
+        f.ret(f.call(weigh, v[5], v[4], v[3], v[2], v[1], v[0]));
+
+      Stream out;
+      Backend b {out};
+      compile(f, b);
+      Executable exec {out.span()};
+      auto fn = exec.as<u64, u64, u64, u64, u64, u64, u64>();
+      u64 expected = rotate ? weigh(2, 3, 4, 5, 6, 1) : weigh(6, 5, 4, 3, 2, 1);
+      check(fn(1, 2, 3, 4, 5, 6) == expected);
+    }
+  }
+  println("IR tests passed");
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "backend.hh"
+
+namespace lang {
+
+// A function in a small register-based IR, lowered to `Backend` calls by
+// `compile`. Functions take up to six u64 arguments and return a u64, as
+// in the System V ABI, and may call such functions in turn.
+//
+// Values are virtual registers holding a u64. Most are defined once, but
+// `assign` redefines one, which is how a loop carries a variable from one
+// iteration to the next.
+struct Ir {
+  struct Value { u32 id; };
+  struct Label { u32 id; };
+
+  enum Op: u8 {
+    Arg, Const, Load, Store, Add, AddImm, Sub, Mul, Copy,
+    Place, Jump, Branch, Call, Ret,
+  };
+
+  static constexpr u32 None = ~0u;
+
+  struct Inst {
+    Op op;
+    // Load width in bytes.
+    u8 size;
+    cond_t cond;
+    // The value defined, or None.
+    u32 dst;
+    // Operands; for calls, the range of `call_args` used.
+    u32 a;
+    u32 b;
+    // A constant, offset, label, argument index or function address.
+    i64 imm;
+  };
+
+  List<Inst> code;
+  List<u32> call_args;
+  u32 values {};
+  u32 labels {};
+
+  // Arguments are taken before anything else.
+  Value arg(u32 index);
+  Value constant(u64 x);
+  // A zero-extended load of 1, 2, 4 or 8 bytes.
+  Value load(Value base, i32 ofs, u8 size = 8);
+  void store(Value base, i32 ofs, Value x);
+  Value add(Value a, Value b);
+  Value add(Value a, i32 n);
+  Value sub(Value a, Value b);
+  Value mul(Value a, Value b);
+  void assign(Value dst, Value src);
+
+  Label label() { return {labels++}; }
+  void place(Label l);
+  void jump(Label l);
+  // Jump to `l` if `a cond b`.
+  void branch(cond_t cond, Value a, Value b, Label l);
+
+  Value call(void const* fn, Span<Value> args);
+  template <class Ret, class... A, class... V>
+  Value call(Ret (*fn)(A...), V... args) {
+    static_assert(sizeof...(A) == sizeof...(V) && sizeof...(A) > 0);
+    Value operands[] {args...};
+    return call(reinterpret_cast<void const*>(fn), operands);
+  }
+  void ret(Value x);
+};
+
+// Where a value lives for all of its lifetime: a register, or the stack
+// slot at rsp + 8 * slot.
+struct Location {
+  bool spilled;
+  reg64 reg;
+  u32 slot;
+};
+
+struct Allocation {
+  Array<Location> at;
+  u32 slots {};
+  // The callee-saved registers used, by bit.
+  u16 saved {};
+};
+
+// Linear-scan allocation over the 12 registers not used as scratch. Each
+// value gets one interval from its first to its last mention, stretched
+// over the loops it is live in. Values live across a call get callee-saved
+// registers. When none is free, the interval that ends last is spilled.
+Allocation allocate(Ir const& ir);
+
+// Emits the function at the current end of `b`'s output, then relaxes all
+// of `b`'s jumps (see `Backend::relax`).
+void lower(Ir const& ir, Allocation const& a, Backend& b);
+
+inline void compile(Ir const& ir, Backend& b) { lower(ir, allocate(ir), b); }
+
+struct Move {
+  reg64 from;
+  reg64 to;
+};
+
+// Performs `moves` as if all at once, exchanging registers to break cycles.
+// No two moves may have the same destination.
+void parallel_move(Backend& b, Span<Move> moves);
+
+}
@@ -0,0 +1,377 @@
+#include "jit-print.hh"
+
+#include "format.hh"
+
+using namespace lang;
+
+namespace {
+
+// Stubs called from the generated code. Each takes the `Print` and a pointer
+// to the value, and array printers return the end of the array.
+
+void print_literal(Print* p, char const* s, u32 n) {
+  extend(p->chars, Str {s, n});
+}
+
+template <class T>
+void print_one(Print* p, char const* it) {
+  print(*(T const*) it, *p);
+}
+
+template <class T>
+char const* print_many(Print* p, char const* it, u32 count) {
+  return format_array<T>(*p, it, count);
+}
+
+constexpr void (*one_printer[PrimitiveCount])(Print*, char const*) {
+    print_one<u8>,  print_one<u16>, print_one<u32>, print_one<u64>,
+    print_one<i8>,  print_one<i16>, print_one<i32>, print_one<i64>,
+    print_one<f32>, print_one<f64>};
+
+constexpr char const* (*many_printer[PrimitiveCount])(
+    Print*, char const*, u32) {
+    print_many<u8>,  print_many<u16>, print_many<u32>, print_many<u64>,
+    print_many<i8>,  print_many<i16>, print_many<i32>, print_many<i64>,
+    print_many<f32>, print_many<f64>};
+
+template <class F>
+void call_addr(Backend& b, F* f) {
+  b.mov(rax, reinterpret_cast<u64>(f));
+  b.call(rax);
+}
+
+// Where a member lives: `ofs` bytes past the start of section `gen`. A new
+// section starts after every member whose size is only known at runtime.
+struct Location {
+  u32 gen;
+  u32 ofs;
+};
+
+struct Literal {
+  placeholder ph;
+  u32 begin;
+  u32 size;
+};
+
+// Emits one routine per struct type reachable from the root, with the
+// signature `char const* (Print*, char const* it)`. The routine keeps the
+// `Print` in rbx, the current section base in rbp, and the base of every
+// section in a stack slot so length members can be read from any of them.
+struct Compiler {
+  Library const& l;
+  Backend& b;
+  List<placeholder> fn;
+  List<bool> wanted;
+  List<u32> pending;
+  List<Literal> literals;
+  Stream literal_chars;
+
+  Compiler(Library const& l_, Backend& b_): l(l_), b(b_) {
+    for (u32 i {}; i < len(l.struct_names); ++i) {
+      fn.push(b.ph());
+      wanted.push(false);
+    }
+  }
+
+  void want(u32 s) {
+    if (!exchange(wanted[s], true))
+      pending.push(s);
+  }
+
+  MaybeU32 fixed_size(u32 s) const {
+    auto end = l.struct_end[s];
+    return end.after ? MaybeU32 {} : MaybeU32::from(end.offset);
+  }
+
+  void literal(Str a, Str b_ = {}, Str c = {}) {
+    auto ph = b.ph();
+    u32 begin = len(literal_chars);
+    extend(literal_chars, a);
+    extend(literal_chars, b_);
+    extend(literal_chars, c);
+    literals.push({ph, begin, len(literal_chars) - begin});
+    b.mov(rdi, rbx);
+    b.mov(rsi, rel32(ph));
+    b.mov(rdx, len(literal_chars) - begin);
+    call_addr(b, print_literal);
+  }
+
+  // Loads a length into rdx, extended as `read_integer` does.
+  void load_length(Location at, PrimitiveId t) {
+    b.mov(rax, rsp[i32(8 * at.gen)]);
+    auto length = rax[i32(at.ofs)];
+    switch (t) {
+      case U8: return b.movzx8(rdx, length);
+      case U16: return b.movzx16(rdx, length);
+      case U32: return b.mov32(rdx, length);
+      case U64: return b.mov(rdx, length);
+      case I8: return b.movsx8(rdx, length);
+      case I16: return b.movsx16(rdx, length);
+      case I32: return b.movsx32(rdx, length);
+      case I64: return b.mov(rdx, length);
+      default: unreachable;
+    }
+  }
+
+  void compile(u32 s) {
+    auto st = l.type(s);
+
+    u32 gens = 1;
+    for (u32 i: range(st.memberCount)) {
+      auto& m = st.member[i];
+      if (m.array == MemberArray ||
+          (m.type >= PrimitiveCount && !fixed_size(m.type - PrimitiveCount)))
+        ++gens;
+    }
+    i32 frame = i32(8 * (gens | 1));
+
+    b.label(fn[s]);
+    b.push(rbx);
+    b.push(rbp);
+    b.add(rsp, -frame);
+    b.mov(rbx, rdi);
+    b.mov(rbp, rsi);
+    b.mov(rsp[0], rsi);
+
+    literal(l.names[st.name]);
+
+    List<Location> loc;
+    u32 gen {};
+    u32 ofs {};
+    auto next_gen = [&] {
+      b.mov(rbp, rax);
+      b.mov(rsp[i32(8 * ++gen)], rbp);
+      ofs = 0;
+    };
+
+    for (u32 i: range(st.memberCount)) {
+      auto& m = st.member[i];
+      loc.push({gen, ofs});
+      literal(" "_s, l.names[m.name], "="_s);
+
+      if (m.array == NoArray && m.type >= PrimitiveCount) {
+        u32 inner = m.type - PrimitiveCount;
+        want(inner);
+        b.mov(rdi, rbx);
+        b.lea(rsi, rbp[i32(ofs)]);
+        b.call(rel32(fn[inner]));
+        if (auto size = fixed_size(inner))
+          ofs += *size;
+        else
+          next_gen();
+        continue;
+      }
+
+      auto t = PrimitiveId(m.type);
+      check(m.type < PrimitiveCount);
+      if (m.array == NoArray) {
+        b.mov(rdi, rbx);
+        b.lea(rsi, rbp[i32(ofs)]);
+        call_addr(b, one_printer[t]);
+        ofs += primitive_size(t);
+      } else if (m.array == FixedArray) {
+        b.mov(rdi, rbx);
+        b.lea(rsi, rbp[i32(ofs)]);
+        b.mov(rdx, m.length);
+        call_addr(b, many_printer[t]);
+        ofs += primitive_size(t) * m.length;
+      } else if (m.array == MemberArray) {
+        load_length(loc[m.length], PrimitiveId(st.member[m.length].type));
+        b.mov(rdi, rbx);
+        b.lea(rsi, rbp[i32(ofs)]);
+        call_addr(b, many_printer[t]);
+        next_gen();
+      } else
+        unreachable;
+    }
+
+    b.lea(rax, rbp[i32(ofs)]);
+    b.add(rsp, frame);
+    b.pop(rbp);
+    b.pop(rbx);
+    b.ret();
+  }
+
+  void run(u32 root) {
+    want(root);
+    for (u32 i {}; i < len(pending); ++i)
+      compile(pending[i]);
+    for (auto& x: literals) {
+      b.label(x.ph);
+      b.literal({literal_chars.begin() + x.begin, x.size});
+    }
+  }
+};
+
+}
+
+String compile_printer(Library const& l, u32 struct_index) {
+  Stream out;
+  Backend b {out};
+  Compiler {l, b}.run(struct_index);
+  check(!b.jumps_pending());
+  return out.take();
+}
+
+namespace {
+
+// What perf shows for a printer.
+String printer_name(Library const& l, u32 struct_index) {
+  Print p;
+  sprint(p, "print "_s, l.names[l.struct_names[struct_index]]);
+  return p.chars.take();
+}
+
+}
+
+JitPrinter::JitPrinter(Library const& l, u32 struct_index):
+  exec(compile_printer(l, struct_index), printer_name(l, struct_index)) {
+  fn = exec.as<char const*, Print*, char const*>();
+}
+
+JitPrinter::JitPrinter(lang::CodeArena& arena, Library const& l, u32 struct_index):
+  exec(arena, compile_printer(l, struct_index), printer_name(l, struct_index)) {
+  fn = exec.as<char const*, Print*, char const*>();
+}
+
+namespace {
+
+template <class T>
+void put(Stream& s, T const& x) {
+  memcpy(s.reserve(sizeof(T)), &x, sizeof(T));
+  s.size += sizeof(T);
+}
+
+void check_same(Library const& l, Str type, Str data) {
+  Print expected;
+  print_struct(expected, l, l.type(type), data);
+  Print actual;
+  JitPrinter jit {l, type};
+  check(jit(actual, data.begin()) == data.end());
+  check(actual.chars.span() == expected.chars.span());
+}
+
+}
+
+void test_jit_print() {
+  {
+    auto l = parse(R"(struct DroppedGpsMessage
+  count u16
+  reason[count] u8
+  )"_s);
+    check_same(l, "DroppedGpsMessage"_s, "\2\0\7\10"_s);
+  }
+  {
+    auto l = parse(R"(struct Lengths
+  a i8
+  xs[a] u8
+  b i16
+  ys[b] u8
+  c i32
+  zs[c] u16
+  d u64
+  ws[d] u8
+  e i64
+  vs[e] u8
+  )"_s);
+    Stream s;
+    put(s, i8(2));
+    put(s, u8(1));
+    put(s, u8(2));
+    put(s, i16(1));
+    put(s, u8(3));
+    put(s, i32(2));
+    put(s, u16(4));
+    put(s, u16(5));
+    put(s, u64(1));
+    put(s, u8(6));
+    put(s, i64(0));
+    check_same(l, "Lengths"_s, s.span());
+  }
+  {
+    auto l = parse(R"(struct Person
+  age u8
+  weight u8
+  )"_s);
+    check_same(l, "Person"_s, "\33\226"_s);
+  }
+  {
+    auto l = parse(R"(struct RanDod
+  abs_mean[6] f32
+  rel_mean[6] f32
+  amb_count u32
+  amb_sd[amb_count] i8
+  amb_prn[amb_count] u8
+  )"_s);
+    Stream s;
+    for (u32 i: range(12))
+      put(s, f32(i) * 0.25f - 1.f);
+    put(s, 3u);
+    for (i8 x: {i8(-1), i8(0), i8(100)})
+      put(s, x);
+    for (u8 x: {u8(7), u8(8), u8(255)})
+      put(s, x);
+    check_same(l, "RanDod"_s, s.span());
+  }
+  {
+    auto l = parse(R"(struct Point
+  x i32
+  y i32
+
+struct Path
+  count u8
+  origin Point
+  steps[count] i16
+  scale f64
+  id u64
+  )"_s);
+    Stream s;
+    put(s, u8(2));
+    put(s, i32(-5));
+    put(s, i32(9));
+    put(s, i16(-300));
+    put(s, i16(300));
+    put(s, 0.125);
+    put(s, u64(1) << 40);
+    check_same(l, "Path"_s, s.span());
+  }
+  {
+    auto l = parse(R"(struct Blob
+  a u8
+  xs[a] u16
+  b u32
+  ys[b] u8
+  tail u16
+  )"_s);
+    check_same(l, "Blob"_s, "\2\1\0\2\0\3\0\0\0\7\10\11\5\0"_s);
+  }
+  {
+    // Printers built in one arena share a page and are sealed together.
+    auto l = parse(R"(struct A
+  x u8
+
+struct B
+  y u16
+
+struct C
+  a A
+  b B
+  )"_s);
+    lang::CodeArena arena;
+    JitPrinter a {arena, l, l.struct_index("A"_s)};
+    JitPrinter b {arena, l, l.struct_index("B"_s)};
+    JitPrinter c {arena, l, l.struct_index("C"_s)};
+    arena.seal();
+    auto page = [&](JitPrinter const& p) {
+      return reinterpret_cast<uptr>(p.exec.data) / arena.page_size;
+    };
+    check(page(a) == page(b) && page(b) == page(c));
+    auto data = "\5\6\0"_s;
+    Print expected;
+    print_struct(expected, l, l.type("C"_s), data);
+    Print actual;
+    check(c(actual, data.begin()) == data.end());
+    check(actual.chars.span() == expected.chars.span());
+  }
+  println("JIT print tests passed");
+}
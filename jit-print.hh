@@ -0,0 +1,25 @@
+#pragma once
+
+#include "backend.hh"
+#include "parse.hh"
+
+// A printer for one `Library` struct type, compiled to machine code with
+// member offsets, array lengths and formatter calls baked in. Produces the
+// same output as `print_struct`, and likewise takes only validated records.
+struct JitPrinter {
+  lang::Executable exec;
+  char const* (*fn)(Print*, char const*);
+
+  JitPrinter(Library const& l, u32 struct_index);
+  JitPrinter(Library const& l, Str name):
+    JitPrinter(l, l.struct_index(name)) {}
+  // Adds the printer to `arena`, which must be sealed before it is used.
+  // Printers for many types built this way share pages and one seal.
+  JitPrinter(lang::CodeArena& arena, Library const& l, u32 struct_index);
+
+  // Print the record at `it`, returning the end of the record.
+  char const* operator()(Print& p, char const* it) const { return fn(&p, it); }
+  void operator()(Print& p, Str b) const { fn(&p, b.begin()); }
+};
+
+String compile_printer(Library const& l, u32 struct_index);
@@ -0,0 +1,538 @@
+#include "kernels.hh"
+
+#include <immintrin.h>
+
+// Functions using AVX2 intrinsics; only called when use_avx2 is set.
+#define AVX2 __attribute__((target("avx2")))
+
+namespace {
+
+// __builtin_cpu_supports may run before the runtime's own constructors.
+bool cpu_has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+}
+
+bool use_avx2 = cpu_has_avx2();
+
+namespace {
+
+template <class T>
+constexpr bool is_float = T(0.5) != T(0);
+
+template <class T>
+constexpr bool is_signed = T(-1) < T(0);
+
+template <class T>
+constexpr T highest() {
+  if constexpr (is_float<T>)
+    return T(__builtin_inf());
+  else if constexpr (is_signed<T>)
+    return T(~0ull >> (65 - 8 * sizeof(T)));
+  else
+    return T(~T(0));
+}
+
+template <class T>
+constexpr T lowest() {
+  if constexpr (is_float<T>)
+    return -highest<T>();
+  else if constexpr (is_signed<T>)
+    return T(-highest<T>() - 1);
+  else
+    return 0;
+}
+
+template <class T>
+void add_to(Stats<T>& s, T x) {
+  using Sum = typename SumOf<T>::type;
+  if constexpr (is_float<T>) {
+    if (x != x)
+      return;
+    s.sum += Sum(x);
+  } else {
+    s.sum = Sum(u64(s.sum) + u64(x));
+  }
+  ++s.count;
+  s.min = x < s.min ? x : s.min;
+  s.max = x > s.max ? x : s.max;
+}
+
+template <class T>
+Stats<T> stats_plain(Span<T> values) {
+  Stats<T> s {0, highest<T>(), lowest<T>(), 0};
+  for (T x: values)
+    add_to(s, x);
+  return s;
+}
+
+bool holds(Compare op, auto v, auto x) {
+  switch (op) {
+  case Less: return v < x;
+  case LessEqual: return v <= x;
+  case Equal: return v == x;
+  case NotEqual: return v != x;
+  case GreaterEqual: return v >= x;
+  case Greater: return v > x;
+  }
+  unreachable;
+}
+
+template <class T>
+void select_plain(Span<T> values, Compare op, T x, Mut<u64> selection) {
+  u32 words = selection_words(len(values));
+  check(len(selection) >= words);
+  for (u32 w {}; w < words; ++w)
+    selection[w] = 0;
+  for (u32 i {}; i < len(values); ++i)
+    selection[i / 64] |= u64(holds(op, values[i], x)) << (i % 64);
+}
+
+// AVX2 integer lanes, for any T of the given size.
+
+template <class T>
+AVX2 __m256i splat(T x) {
+  if constexpr (sizeof(T) == 1)
+    return _mm256_set1_epi8(char(x));
+  else if constexpr (sizeof(T) == 2)
+    return _mm256_set1_epi16(short(x));
+  else if constexpr (sizeof(T) == 4)
+    return _mm256_set1_epi32(int(x));
+  else
+    return _mm256_set1_epi64x((long long) x);
+}
+
+template <class T>
+AVX2 __m256i load(T const* at) {
+  return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(at));
+}
+
+// Flips the sign bits of unsigned lanes, so that signed compares order them.
+template <class T>
+AVX2 __m256i signed_order(__m256i x) {
+  if constexpr (is_signed<T>)
+    return x;
+  else
+    return _mm256_xor_si256(x, splat(T(T(1) << (8 * sizeof(T) - 1))));
+}
+
+template <u32 size>
+AVX2 __m256i compare_greater(__m256i x, __m256i y) {
+  if constexpr (size == 1)
+    return _mm256_cmpgt_epi8(x, y);
+  else if constexpr (size == 2)
+    return _mm256_cmpgt_epi16(x, y);
+  else if constexpr (size == 4)
+    return _mm256_cmpgt_epi32(x, y);
+  else
+    return _mm256_cmpgt_epi64(x, y);
+}
+
+template <u32 size>
+AVX2 __m256i compare_equal(__m256i x, __m256i y) {
+  if constexpr (size == 1)
+    return _mm256_cmpeq_epi8(x, y);
+  else if constexpr (size == 2)
+    return _mm256_cmpeq_epi16(x, y);
+  else if constexpr (size == 4)
+    return _mm256_cmpeq_epi32(x, y);
+  else
+    return _mm256_cmpeq_epi64(x, y);
+}
+
+// One bit per lane of a compare result, lane 0 lowest.
+template <u32 size>
+AVX2 u64 lane_bits(__m256i mask) {
+  if constexpr (size == 1) {
+    return u32(_mm256_movemask_epi8(mask));
+  } else if constexpr (size == 2) {
+    // Narrow to bytes, which leaves lanes 8 to 15 in the third quarter,
+    // and move them next to lanes 0 to 7.
+    auto bytes = _mm256_packs_epi16(mask, _mm256_setzero_si256());
+    bytes = _mm256_permute4x64_epi64(bytes, 0b1000);
+    return u32(_mm256_movemask_epi8(bytes)) & 0xffff;
+  } else if constexpr (size == 4) {
+    return u32(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+  } else {
+    return u32(_mm256_movemask_pd(_mm256_castsi256_pd(mask)));
+  }
+}
+
+template <class T>
+AVX2 __m256i lane_min(__m256i x, __m256i y) {
+  if constexpr (is_same<T, u8>)
+    return _mm256_min_epu8(x, y);
+  else if constexpr (is_same<T, i8>)
+    return _mm256_min_epi8(x, y);
+  else if constexpr (is_same<T, u16>)
+    return _mm256_min_epu16(x, y);
+  else if constexpr (is_same<T, i16>)
+    return _mm256_min_epi16(x, y);
+  else if constexpr (is_same<T, u32>)
+    return _mm256_min_epu32(x, y);
+  else if constexpr (is_same<T, i32>)
+    return _mm256_min_epi32(x, y);
+  else
+    return _mm256_blendv_epi8(
+        x, y, compare_greater<8>(signed_order<T>(x), signed_order<T>(y)));
+}
+
+template <class T>
+AVX2 __m256i lane_max(__m256i x, __m256i y) {
+  if constexpr (is_same<T, u8>)
+    return _mm256_max_epu8(x, y);
+  else if constexpr (is_same<T, i8>)
+    return _mm256_max_epi8(x, y);
+  else if constexpr (is_same<T, u16>)
+    return _mm256_max_epu16(x, y);
+  else if constexpr (is_same<T, i16>)
+    return _mm256_max_epi16(x, y);
+  else if constexpr (is_same<T, u32>)
+    return _mm256_max_epu32(x, y);
+  else if constexpr (is_same<T, i32>)
+    return _mm256_max_epi32(x, y);
+  else
+    return _mm256_blendv_epi8(
+        x, y, compare_greater<8>(signed_order<T>(y), signed_order<T>(x)));
+}
+
+AVX2 __m256i widen_i32(__m256i x) {
+  return _mm256_add_epi64(
+      _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x)),
+      _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1)));
+}
+
+// What sum_lanes adds to each value, to be taken off the total.
+template <class T>
+constexpr u64 lane_bias = 0;
+template <>
+constexpr u64 lane_bias<i8> = 0x80;
+template <>
+constexpr u64 lane_bias<u16> = u64(-0x8000);
+
+// The lanes summed into four 64-bit lanes, each value plus lane_bias<T>.
+// Bytes are summed by psadbw, which only takes unsigned bytes, and 16-bit
+// lanes by pmaddwd, which only takes signed ones.
+template <class T>
+AVX2 __m256i sum_lanes(__m256i x) {
+  auto zero = _mm256_setzero_si256();
+  if constexpr (is_same<T, u8>)
+    return _mm256_sad_epu8(x, zero);
+  else if constexpr (is_same<T, i8>)
+    return _mm256_sad_epu8(_mm256_xor_si256(x, splat(u8(0x80))), zero);
+  else if constexpr (is_same<T, u16>)
+    return widen_i32(_mm256_madd_epi16(
+        _mm256_xor_si256(x, splat(u16(0x8000))), splat(i16(1))));
+  else if constexpr (is_same<T, i16>)
+    return widen_i32(_mm256_madd_epi16(x, splat(i16(1))));
+  else if constexpr (is_same<T, i32>)
+    return widen_i32(x);
+  else if constexpr (is_same<T, u32>)
+    return _mm256_add_epi64(
+        _mm256_cvtepu32_epi64(_mm256_castsi256_si128(x)),
+        _mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1)));
+  else
+    return x;
+}
+
+template <class T>
+AVX2 Stats<T> stats_avx2(Span<T> values) {
+  constexpr u32 lanes = 32 / sizeof(T);
+  u32 n = len(values) - len(values) % lanes;
+  auto low = splat(highest<T>());
+  auto high = splat(lowest<T>());
+  auto sum = _mm256_setzero_si256();
+  for (u32 i {}; i < n; i += lanes) {
+    auto x = load(&values[i]);
+    low = lane_min<T>(low, x);
+    high = lane_max<T>(high, x);
+    sum = _mm256_add_epi64(sum, sum_lanes<T>(x));
+  }
+
+  using Sum = typename SumOf<T>::type;
+  auto s = stats_plain(Span<T> {values.begin() + n, values.end()});
+  T lows[lanes], highs[lanes];
+  u64 sums[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lows), low);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(highs), high);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), sum);
+  for (u32 i {}; i < lanes; ++i) {
+    s.min = lows[i] < s.min ? lows[i] : s.min;
+    s.max = highs[i] > s.max ? highs[i] : s.max;
+  }
+  u64 total = sums[0] + sums[1] + sums[2] + sums[3] - n * lane_bias<T>;
+  s.sum = Sum(u64(s.sum) + total);
+  s.count += n;
+  return s;
+}
+
+// Floats: min and max return their second operand if either is NaN, so
+// NaNs leave them be; the ordered mask drops NaNs from the sum and count.
+
+AVX2 Stats<f32> stats_avx2(Span<f32> values) {
+  u32 n = len(values) - len(values) % 8;
+  auto low = _mm256_set1_ps(highest<f32>());
+  auto high = _mm256_set1_ps(lowest<f32>());
+  auto sum_low = _mm256_setzero_pd();
+  auto sum_high = _mm256_setzero_pd();
+  auto count = _mm256_setzero_si256();
+  for (u32 i {}; i < n; i += 8) {
+    auto x = _mm256_loadu_ps(&values[i]);
+    low = _mm256_min_ps(x, low);
+    high = _mm256_max_ps(x, high);
+    auto ordered = _mm256_cmp_ps(x, x, _CMP_ORD_Q);
+    count = _mm256_sub_epi32(count, _mm256_castps_si256(ordered));
+    x = _mm256_and_ps(x, ordered);
+    auto x_low = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+    auto x_high = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+    sum_low = _mm256_add_pd(sum_low, x_low);
+    sum_high = _mm256_add_pd(sum_high, x_high);
+  }
+
+  auto s = stats_plain(Span<f32> {values.begin() + n, values.end()});
+  f32 lows[8], highs[8];
+  f64 sums[4];
+  u32 counts[8];
+  _mm256_storeu_ps(lows, low);
+  _mm256_storeu_ps(highs, high);
+  _mm256_storeu_pd(sums, _mm256_add_pd(sum_low, sum_high));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts), count);
+  for (u32 i {}; i < 8; ++i) {
+    s.min = lows[i] < s.min ? lows[i] : s.min;
+    s.max = highs[i] > s.max ? highs[i] : s.max;
+    s.count += counts[i];
+  }
+  s.sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+  return s;
+}
+
+AVX2 Stats<f64> stats_avx2(Span<f64> values) {
+  u32 n = len(values) - len(values) % 4;
+  auto low = _mm256_set1_pd(highest<f64>());
+  auto high = _mm256_set1_pd(lowest<f64>());
+  auto sum = _mm256_setzero_pd();
+  auto count = _mm256_setzero_si256();
+  for (u32 i {}; i < n; i += 4) {
+    auto x = _mm256_loadu_pd(&values[i]);
+    low = _mm256_min_pd(x, low);
+    high = _mm256_max_pd(x, high);
+    auto ordered = _mm256_cmp_pd(x, x, _CMP_ORD_Q);
+    count = _mm256_sub_epi64(count, _mm256_castpd_si256(ordered));
+    sum = _mm256_add_pd(sum, _mm256_and_pd(x, ordered));
+  }
+
+  auto s = stats_plain(Span<f64> {values.begin() + n, values.end()});
+  f64 lows[4], highs[4], sums[4];
+  u64 counts[4];
+  _mm256_storeu_pd(lows, low);
+  _mm256_storeu_pd(highs, high);
+  _mm256_storeu_pd(sums, sum);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts), count);
+  for (u32 i {}; i < 4; ++i) {
+    s.min = lows[i] < s.min ? lows[i] : s.min;
+    s.max = highs[i] > s.max ? highs[i] : s.max;
+    s.count += counts[i];
+  }
+  s.sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+  return s;
+}
+
+// Which of less, equal and greater make `op` hold, and whether to negate
+// that; NotEqual is the one compare that holds for NaN.
+struct CompareBits {
+  u64 less, equal, greater, negate;
+};
+
+constexpr CompareBits compare_bits[] {
+    {~0ull, 0, 0, 0},      // Less
+    {~0ull, ~0ull, 0, 0},  // LessEqual
+    {0, ~0ull, 0, 0},      // Equal
+    {0, ~0ull, 0, ~0ull},  // NotEqual
+    {0, ~0ull, ~0ull, 0},  // GreaterEqual
+    {0, 0, ~0ull, 0},      // Greater
+};
+
+// The selection bits of 64 values.
+template <class T>
+AVX2 u64 select_word(T const* at, T x, CompareBits op) {
+  constexpr u32 lanes = 32 / sizeof(T);
+  constexpr u64 all = ~0ull >> (64 - lanes);
+  u64 bits {};
+  for (u32 i {}; i < 64; i += lanes) {
+    u64 less, equal, greater;
+    if constexpr (is_same<T, f32>) {
+      auto v = _mm256_loadu_ps(at + i);
+      auto c = _mm256_set1_ps(x);
+      less = u32(_mm256_movemask_ps(_mm256_cmp_ps(v, c, _CMP_LT_OQ)));
+      equal = u32(_mm256_movemask_ps(_mm256_cmp_ps(v, c, _CMP_EQ_OQ)));
+      greater = u32(_mm256_movemask_ps(_mm256_cmp_ps(v, c, _CMP_GT_OQ)));
+    } else if constexpr (is_same<T, f64>) {
+      auto v = _mm256_loadu_pd(at + i);
+      auto c = _mm256_set1_pd(x);
+      less = u32(_mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_LT_OQ)));
+      equal = u32(_mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_EQ_OQ)));
+      greater = u32(_mm256_movemask_pd(_mm256_cmp_pd(v, c, _CMP_GT_OQ)));
+    } else {
+      auto v = signed_order<T>(load(at + i));
+      auto c = signed_order<T>(splat(x));
+      less = lane_bits<sizeof(T)>(compare_greater<sizeof(T)>(c, v));
+      equal = lane_bits<sizeof(T)>(compare_equal<sizeof(T)>(c, v));
+      greater = lane_bits<sizeof(T)>(compare_greater<sizeof(T)>(v, c));
+    }
+    u64 hit = (less & op.less) | (equal & op.equal) | (greater & op.greater);
+    bits |= ((hit ^ op.negate) & all) << i;
+  }
+  return bits;
+}
+
+template <class T>
+AVX2 void select_avx2(Span<T> values, Compare op, T x, Mut<u64> selection) {
+  check(len(selection) >= selection_words(len(values)));
+  u32 words = len(values) / 64;
+  for (u32 w {}; w < words; ++w)
+    selection[w] = select_word(&values[w * 64], x, compare_bits[op]);
+  Span<T> rest {values.begin() + words * 64, values.end()};
+  Mut<u64> tail {selection.begin() + words, len(selection) - words};
+  select_plain(rest, op, x, tail);
+}
+
+}
+
+template <class T>
+Stats<T> stats(Span<T> values) {
+  return use_avx2 ? stats_avx2(values) : stats_plain(values);
+}
+
+template <class T>
+void histogram(Span<T> values, f64 lo, f64 hi, Mut<u64> bins) {
+  u32 n = len(bins);
+  check(n && lo < hi);
+  f64 scale = f64(n) / (hi - lo);
+  // Runs of values often fall in the same bin; counting into four tables
+  // in turn keeps each increment from waiting on the last one's store.
+  Array<u64> counts(4 * n);
+  for (u32 i {}; i < len(values); ++i) {
+    f64 at = (f64(values[i]) - lo) * scale;
+    if (at >= 0 && at < f64(n))
+      ++counts[(i & 3) * n + u32(at)];
+  }
+  for (u32 b {}; b < n; ++b)
+    for (u32 table {}; table < 4; ++table)
+      bins[b] += counts[table * n + b];
+}
+
+template <class T>
+void select(Span<T> values, Compare op, T x, Mut<u64> selection) {
+  if (use_avx2)
+    select_avx2(values, op, x, selection);
+  else
+    select_plain(values, op, x, selection);
+}
+
+u64 selected(Span<u64> selection) {
+  u64 count {};
+  for (u64 word: selection)
+    count += u64(__builtin_popcountll(word));
+  return count;
+}
+
+#define KERNELS(T)                                                   \
+  template Stats<T> stats(Span<T>);                                  \
+  template void histogram(Span<T>, f64, f64, Mut<u64>);              \
+  template void select(Span<T>, Compare, T, Mut<u64>);
+
+KERNELS(u8)
+KERNELS(u16)
+KERNELS(u32)
+KERNELS(u64)
+KERNELS(i8)
+KERNELS(i16)
+KERNELS(i32)
+KERNELS(i64)
+KERNELS(f32)
+KERNELS(f64)
+
+namespace {
+
+u32 rng_state = 7;
+u32 rng() {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+template <class T>
+T random_value() {
+  if constexpr (is_float<T>)
+    return rng() % 50 ? T(i32(rng() % 2001) - 1000) * T(0.25)
+        : T(__builtin_nan(""));
+  else
+    return T(u64(rng()) << 32 | rng());
+}
+
+// Checks both kernels against plain C++ on values of every alignment and
+// tail length.
+template <class T>
+void check_kernels() {
+  List<T> values;
+  for (u32 i {}; i < 300; ++i)
+    values.push(random_value<T>());
+  if constexpr (!is_float<T>) {
+    values[5] = highest<T>();
+    values[77] = lowest<T>();
+  }
+  u64 selection[5], expected[5];
+  u32 begins[] {0, 1, 3};
+  u32 sizes[] {0, 1, 31, 64, 65, 130, 296};
+  for (u32 begin: begins) {
+    for (u32 size: sizes) {
+      Span<T> v {values.begin() + begin, size};
+      Stats<T> s {0, highest<T>(), lowest<T>(), 0};
+      for (T x: v)
+        add_to(s, x);
+      T x = size ? v[size / 2] : T(0);
+      for (u32 avx2 {}; avx2 <= u32(cpu_has_avx2()); ++avx2) {
+        use_avx2 = avx2;
+        auto t = stats(v);
+        check(t.count == s.count && t.min == s.min && t.max == s.max);
+        check(t.sum == s.sum);
+        for (u32 op {}; op <= Greater; ++op) {
+          select(v, Compare(op), x, {selection, 5});
+          for (u32 w {}; w < selection_words(size); ++w)
+            expected[w] = 0;
+          for (u32 i {}; i < size; ++i)
+            expected[i / 64] |= u64(holds(Compare(op), v[i], x)) << (i % 64);
+          for (u32 w {}; w < selection_words(size); ++w)
+            check(selection[w] == expected[w]);
+        }
+      }
+    }
+  }
+  use_avx2 = cpu_has_avx2();
+}
+
+}
+
+void test_kernels() {
+  check_kernels<u8>();
+  check_kernels<u16>();
+  check_kernels<u32>();
+  check_kernels<u64>();
+  check_kernels<i8>();
+  check_kernels<i16>();
+  check_kernels<i32>();
+  check_kernels<i64>();
+  check_kernels<f32>();
+  check_kernels<f64>();
+
+  i16 values[] {-5, 0, 1, 9, 10, 99, 100, 200};
+  u64 bins[4] {};
+  histogram(Span<i16> {values}, 0, 100, {bins, 4});
+  check(bins[0] == 4 && bins[1] == 0 && bins[2] == 0 && bins[3] == 1);
+  u64 words[] {0b1011, ~0ull};
+  check(selected(Span<u64> {words}) == 67);
+  println("Kernel tests passed");
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.hh"
+
+// Aggregates and filters over a column of one primitive type, as given by
+// Column::span. Each kernel has an AVX2 loop and a plain one that gives the
+// same results, except that float sums may round differently since the
+// AVX2 loop adds in another order. NaNs are left out of everything,
+// including counts.
+
+// Whether the kernels use AVX2. It starts out as whether the CPU has it;
+// clearing it runs the plain loops, e.g. to compare the two.
+extern bool use_avx2;
+
+// Integers are summed in 64 bits of their own signedness, wrapping on
+// overflow, and floats in f64.
+template <class T>
+struct SumOf { using type = u64; };
+template <>
+struct SumOf<i8> { using type = i64; };
+template <>
+struct SumOf<i16> { using type = i64; };
+template <>
+struct SumOf<i32> { using type = i64; };
+template <>
+struct SumOf<i64> { using type = i64; };
+template <>
+struct SumOf<f32> { using type = f64; };
+template <>
+struct SumOf<f64> { using type = f64; };
+
+// Without any values, min and max are the highest and lowest T (the
+// infinities for floats).
+template <class T>
+struct Stats {
+  u64 count;
+  T min;
+  T max;
+  typename SumOf<T>::type sum;
+
+  f64 mean() const { return f64(sum) / f64(count); }
+};
+
+template <class T>
+Stats<T> stats(Span<T> values);
+
+// Adds each value to one of len(bins) equal bins over [lo, hi). Values
+// outside the range are not counted.
+template <class T>
+void histogram(Span<T> values, f64 lo, f64 hi, Mut<u64> bins);
+
+enum Compare: u8 { Less, LessEqual, Equal, NotEqual, GreaterEqual, Greater };
+
+// Sets bit i % 64 of word i / 64 of `selection` where `values[i] op x`,
+// as C++ compares them, and clears the rest of the words' bits.
+// `selection` has at least selection_words(len(values)) words.
+template <class T>
+void select(Span<T> values, Compare op, T x, Mut<u64> selection);
+
+inline u32 selection_words(u32 count) { return (count + 63) / 64; }
+
+// The number of bits set.
+u64 selected(Span<u64> selection);
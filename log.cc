@@ -0,0 +1,286 @@
+#include "log.hh"
+
+#include "validate.hh"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void write_record(Stream& out, u16 tag, Str record) {
+  memcpy(out.reserve(sizeof(tag)), &tag, sizeof(tag));
+  out.size += sizeof(tag);
+  extend(out, record);
+}
+
+// The buffer holds the bytes in [begin, end). Complete records are handed
+// out in place; when only a partial record is left, it is moved to the
+// front and the rest of the buffer is refilled, so every record is seen as
+// one contiguous `Str`.
+void read_log(
+    Library const& l, u32 log, int fd, Span<Func<Str>> on_variant,
+    u32 capacity) {
+  auto variants = l.log_struct[log];
+  check(len(on_variant) == len(variants));
+  List<Validator> validators;
+  for (u32 s: variants)
+    validators.push(Validator {l, l.type(s)});
+  Array<char> buf(capacity);
+  u32 begin {};
+  u32 end {};
+  for (;;) {
+    for (;;) {
+      Str rest {buf.begin() + begin, buf.begin() + end};
+      u16 tag;
+      if (len(rest) < sizeof(tag))
+        break;
+      memcpy(&tag, rest.base, sizeof(tag));
+      check(tag < len(variants));
+      Str body {rest.base + sizeof(tag), rest.end()};
+      auto size = validators[tag](body);
+      if (!size)
+        break;
+      on_variant[tag]({body.base, *size});
+      begin += u32(sizeof(tag)) + *size;
+    }
+
+    memmove(buf.begin(), buf.begin() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    check(end < capacity);
+
+    iptr n = read(fd, buf.begin() + end, capacity - end);
+    check(n >= 0);
+    if (!n) {
+      check(!end);
+      return;
+    }
+    end += u32(n);
+  }
+}
+
+LogFile::LogFile(Library const& l_, u32 log_, char const* path):
+  l(l_), log(log_) {
+  int fd = open(path, O_RDONLY);
+  check(fd >= 0);
+  struct stat st;
+  check(!fstat(fd, &st));
+  size = u64(st.st_size);
+  if (size) {
+    void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    check(data != MAP_FAILED);
+    check(!madvise(data, size, MADV_SEQUENTIAL));
+    base = static_cast<char const*>(data);
+  }
+  check(!close(fd));
+
+  auto variants = l.log_struct[log];
+  List<Validator> validators;
+  for (u32 s: variants)
+    validators.push(Validator {l, l.type(s)});
+  List<u64> found;
+  u64 at {};
+  while (at < size) {
+    found.push(at);
+    u16 tag;
+    check(size - at >= sizeof(tag));
+    memcpy(&tag, base + at, sizeof(tag));
+    check(tag < len(variants));
+    at += sizeof(tag);
+    u64 rest = size - at;
+    Str body {base + at, u32(rest > ~0u ? ~0u : rest)};
+    auto record = validators[tag](body);
+    check(!!record);
+    at += *record;
+  }
+  starts = found.take();
+}
+
+LogFile::~LogFile() {
+  if (base)
+    munmap(const_cast<char*>(base), size);
+}
+
+LogRecord LogFile::operator[](u32 i) const {
+  u64 begin = starts[i];
+  u64 end = i + 1 < len(starts) ? starts[i + 1] : size;
+  u16 tag;
+  memcpy(&tag, base + begin, sizeof(tag));
+  return {tag, {base + begin + sizeof(tag), base + end}};
+}
+
+namespace {
+
+struct PrintWorker {
+  LogFile const* f;
+  u32 begin;
+  u32 end;
+  Print out;
+  pthread_t thread;
+
+  void run() {
+    for (u32 i = begin; i < end; ++i) {
+      auto record = (*f)[i];
+      print_struct(out, f->l, f->type(record), record.data);
+      out.chars.push('\n');
+    }
+  }
+
+  static void* start(void* self) {
+    static_cast<PrintWorker*>(self)->run();
+    return nullptr;
+  }
+};
+
+// First record at or after byte offset `at`.
+u32 record_at(LogFile const& f, u32 begin, u32 end, u64 at) {
+  while (begin < end) {
+    u32 mid = begin + (end - begin) / 2;
+    if (f.starts[mid] < at)
+      begin = mid + 1;
+    else
+      end = mid;
+  }
+  return begin;
+}
+
+}
+
+u32 core_count() {
+  auto n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? u32(n) : 1;
+}
+
+void print_records(
+    LogFile const& f, u32 begin, u32 end, u32 threads, Print& out) {
+  check(begin <= end && end <= len(f) && threads);
+  u64 first = begin < len(f) ? f.starts[begin] : f.size;
+  u64 last = end < len(f) ? f.starts[end] : f.size;
+
+  Array<PrintWorker> workers(threads);
+  u32 at = begin;
+  for (u32 i {}; i < threads; ++i) {
+    auto& w = workers[i];
+    w.f = &f;
+    w.begin = at;
+    w.end = i + 1 == threads
+        ? end
+        : record_at(f, at, end, first + (last - first) * (i + 1) / threads);
+    at = w.end;
+  }
+
+  // The calling thread takes the first chunk itself.
+  for (u32 i = 1; i < threads; ++i)
+    check(!pthread_create(
+        &workers[i].thread, 0, PrintWorker::start, &workers[i]));
+  workers[0].run();
+  for (u32 i = 1; i < threads; ++i)
+    check(!pthread_join(workers[i].thread, 0));
+
+  u32 total {};
+  for (auto& w: workers)
+    total += len(w.out.chars);
+  out.chars.expand(len(out.chars) + total);
+  for (auto& w: workers)
+    extend(out.chars, w.out.chars.span());
+}
+
+namespace {
+
+template <class T>
+void put(Stream& s, T const& x) {
+  memcpy(s.reserve(sizeof(T)), &x, sizeof(T));
+  s.size += sizeof(T);
+}
+
+}
+
+void test_log_reader() {
+  auto l = parse(R"(struct BadIslLength
+  length u32
+
+struct DroppedGpsMessage
+  count u8
+  reason[count] u8
+
+log LogType
+  DroppedGpsMessage
+  BadIslLength
+)"_s);
+  auto log = l.log_index("LogType"_s);
+  check(len(l.log_struct[log]) == 2);
+
+  Print expected;
+  Stream data;
+  for (u32 i {}; i < 500; ++i) {
+    Stream record;
+    u16 tag = u16(i % 3 == 0);
+    if (tag) {
+      put(record, i);
+    } else {
+      put(record, u8(i % 7));
+      for (u32 j {}; j < i % 7; ++j)
+        put(record, u8(j + i));
+    }
+    write_record(data, tag, record);
+    print_struct(expected, l, l.type(l.log_struct[log][tag]), record);
+    expected.chars.push('\n');
+  }
+
+  int fds[2];
+  check(!pipe(fds));
+  check(write(fds[1], data.begin(), len(data)) == len(data));
+  check(!close(fds[1]));
+
+  struct Seen {
+    Library const& l;
+    Span<u32> variants;
+    Print text;
+    u32 count[2] {};
+    void visit(u32 variant, Str record) {
+      ++count[variant];
+      print_struct(text, l, l.type(variants[variant]), record);
+      text.chars.push('\n');
+    }
+  } seen {l, l.log_struct[log], {}};
+  Func<Str> on_variant[] {
+      [s = &seen](Str r) { s->visit(0, r); },
+      [s = &seen](Str r) { s->visit(1, r); }};
+
+  // A buffer this small forces many partial records across refills.
+  read_log(l, log, fds[0], on_variant, 16);
+  check(!close(fds[0]));
+
+  check(seen.count[0] == 333 && seen.count[1] == 167);
+  check(seen.text.chars.span() == expected.chars.span());
+
+  char path[] = "/tmp/bstruct-log-XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0);
+  check(write(fd, data.begin(), len(data)) == len(data));
+  check(!close(fd));
+  {
+    LogFile file {l, log, path};
+    check(len(file) == 500);
+    check(file[3].tag == 1 && file[4].tag == 0);
+    check(len(file[4].data) == 1 + 4 % 7);
+
+    Print text;
+    for (auto record: file) {
+      print_struct(text, l, file.type(record), record.data);
+      text.chars.push('\n');
+    }
+    check(text.chars.span() == expected.chars.span());
+
+    u32 thread_counts[] {1, 3, 8};
+    for (u32 threads: thread_counts) {
+      Print parallel;
+      print_records(file, 0, len(file), threads, parallel);
+      check(parallel.chars.span() == expected.chars.span());
+    }
+  }
+  check(!unlink(path));
+  println("Log reader tests passed");
+}
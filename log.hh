@@ -0,0 +1,57 @@
+#pragma once
+
+#include "parse.hh"
+
+// Append one framed record (u16 tag, then the struct bytes) to `out`.
+void write_record(Stream& out, u16 tag, Str record);
+
+// Decode every record of log type `log` from `fd`, calling `on_variant[tag]`
+// with the bytes of each record. Reads through a fixed buffer of `capacity`
+// bytes, so memory use doesn't depend on the size of the log; each record
+// must fit in the buffer.
+void read_log(
+    Library const& l, u32 log, int fd, Span<Func<Str>> on_variant,
+    u32 capacity = 1 << 20);
+
+struct LogRecord {
+  u16 tag;
+  Str data;
+};
+
+// A log file mapped read-only, with the start of every record found in one
+// pass on open. Records are views into the mapping; nothing is copied.
+struct LogFile {
+  Library const& l;
+  u32 log;
+  char const* base {};
+  u64 size {};
+  Array<u64> starts;
+
+  LogFile(Library const& l, u32 log, char const* path);
+  LogFile(LogFile const&) = delete;
+  ~LogFile();
+
+  friend u32 len(LogFile const& x) { return len(x.starts); }
+  LogRecord operator[](u32 i) const;
+  u32 struct_index(LogRecord r) const { return l.log_struct[log][r.tag]; }
+  LibraryStruct type(LogRecord r) const { return l.type(struct_index(r)); }
+
+  struct Iterator {
+    LogFile const& f;
+    u32 i;
+    LogRecord operator*() const { return f[i]; }
+    bool operator!=(u32 n) const { return i != n; }
+    void operator++() { ++i; }
+  };
+  Iterator begin() const { return {*this, 0}; }
+  u32 end() const { return len(starts); }
+};
+
+// Print records [begin, end) of `f` into `out`, one per line. The range is
+// split into `threads` chunks of roughly equal bytes, each formatted by its
+// own thread into its own `Print`, and the results are appended in order.
+void print_records(
+    LogFile const& f, u32 begin, u32 end, u32 threads, Print& out);
+
+// Number of online cores, at least 1.
+u32 core_count();
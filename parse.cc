@@ -2,6 +2,7 @@
 
 #include "common.hh"
 #include "array.hh"
+#include "format.hh"
 
 #define tail [[clang::musttail]] return
 #define unreachable abort()
@@ -140,21 +141,29 @@ struct Parser {
   List<u32> indent {};
   enum { Struct, Log } cur_decl {};
 
-  StrList type_names;
+  // Primitives first, so that ids below PrimitiveCount are PrimitiveIds,
+  // then structs and logs in declaration order.
+  StrTable type_names;
   List<u32> struct_type;
+  List<MaybeU32> type_struct;
   StrArrayList struct_member_name;
   ArrayList<Member> struct_member;
   List<u32> log_type;
   ArrayList<u32> log_member_struct;
 
   Str get_type_name(u32 i) const {
-    if (i < PrimitiveCount)
-      return primitive_name(PrimitiveId(i));
-    return type_names[i - PrimitiveCount];
+    return type_names[i];
+  }
+
+  // Index of the struct with type id `type`, or none for a log.
+  MaybeU32 struct_index(u32 type) const {
+    return type_struct[type - PrimitiveCount];
   }
 
   Parser() {
     indent.push(0);
+    for (u32 i {}; i < PrimitiveCount; ++i)
+      type_names.add(primitive_name(PrimitiveId(i)));
   }
 
   template <class... T>
@@ -232,16 +241,17 @@ struct Parser {
     check(!!type);
     spaces(it);
     check(*it == '\n');
-    auto struct_ = find(struct_type.span(), *type);
+    check(*type >= PrimitiveCount);
+    auto struct_ = struct_index(*type);
+    check(!!struct_);
     last_push(log_member_struct, *struct_);
     tail start_line(it + 1);
   }
 
   MaybeU32 find_type(Str name) {
-    auto i = find(span(type_names), name);
-    if (!i)
-      return array_span_find(PrimitiveName, PrimitiveNameEnd, u8(0), PrimitiveCount, name);
-    return *i + PrimitiveCount;
+    if (auto i = type_names.find(name))
+      return *i;
+    return none;
   }
 
   void struct_(char const* it) {
@@ -254,8 +264,8 @@ struct Parser {
     auto cur_struct = str_between(name_begin, it);
     if (find_type(cur_struct))
       return fail("redefinition of "_s, cur_struct);
-    u32 type = len(type_names) + PrimitiveCount;
-    type_names.push(cur_struct);
+    u32 type = type_names.add(cur_struct);
+    type_struct.push(len(struct_type));
     struct_type.push(type);
     struct_member_name.push_empty();
     struct_member.push_empty(0);
@@ -275,8 +285,8 @@ struct Parser {
     auto name = str_between(name_begin, it);
     if (find_type(name))
       return fail("redefinition of "_s, name);
-    auto type = PrimitiveCount + len(type_names);
-    type_names.push(name);
+    auto type = type_names.add(name);
+    type_struct.push(none);
     log_type.push(type);
     log_member_struct.push_empty(0);
     while (*it == ' ')
@@ -373,7 +383,7 @@ PrimitiveId type_primitive(u32 type) {
   return PrimitiveId(type);
 }
 
-void write_member(Stream& s, LibraryStruct, LibraryMember m, u8 arg) {
+void write_member(Stream& s, Library const&, LibraryStruct, LibraryMember m, u8 arg) {
   switch (type_primitive(m.type)) {
     case U8:
       memcpy(s.reserve(1), &arg, 1);
@@ -390,44 +400,39 @@ void write_member(Stream& s, LibraryStruct, LibraryMember m, u8 arg) {
   }
 }
 
+// Lengths of validated records are never negative and fit in the record.
 u32 read_u32(char const* i, PrimitiveId t) {
-  switch (t) {
-    case U8: return u32(*(u8 const*) i);
-    case U32: return *(u32 const*) i;
-    default: unreachable;
-  }
+  u64 x = read_integer(t, i);
+  check(x <= ~0u);
+  return u32(x);
 }
 
-u32 get_field(char const* base, LibraryStruct s, u32 member) {
-  check(member < s.memberCount);
-  u32 ofs {};
-  for (u32 i {}; i < member; ++i) {
-    ofs += PrimitiveSize[type_primitive(s.member[i].type)];
-  }
+u32 get_field(Library const& l, char const* base, LibraryStruct s, u32 member) {
+  auto ofs = member_offset(l, s, member, base);
   return read_u32(base + ofs, type_primitive(s.member[member].type));
 }
 
-uptr array_length(Stream& s, LibraryStruct st, LibraryMember m) {
+uptr array_length(Library const& l, Stream& s, LibraryStruct st, LibraryMember m) {
   if (m.array == FixedArray)
     return m.length;
   if (m.array == MemberArray)
-    return get_field(s.begin(), st, m.length);
+    return get_field(l, s.begin(), st, m.length);
   unreachable;
 }
 
 template <u32 N>
-void write_member(Stream& s, LibraryStruct st, LibraryMember m, u8 const (&arg)[N]) {
+void write_member(Stream& s, Library const& l, LibraryStruct st, LibraryMember m, u8 const (&arg)[N]) {
   check(type_primitive(m.type) == U8);
-  check(array_length(s, st, m) == N);
+  check(array_length(l, s, st, m) == N);
   memcpy(s.reserve(N), &arg, N);
   s.size += N;
 }
 
 template <class... T>
-String make_struct(LibraryStruct s, T&&... args) {
+String make_struct(Library const& l, LibraryStruct s, T&&... args) {
   Stream out;
   auto m = s.member;
-  (write_member(out, s, *m++, forward<T>(args)),...);
+  (write_member(out, l, s, *m++, forward<T>(args)),...);
   return out.take();
 };
 
@@ -459,18 +464,14 @@ char const* print_primitive(Print& p, PrimitiveId t, char const* it) {
 
 char const* print_custom_type(Print& p, Library const& l, u32 t, char const* it);
 
+constexpr char const* (*array_printer[PrimitiveCount])(
+    Print&, char const*, u32) {
+    format_array<u8>,  format_array<u16>, format_array<u32>, format_array<u64>,
+    format_array<i8>,  format_array<i16>, format_array<i32>, format_array<i64>,
+    format_array<f32>, format_array<f64>};
+
 char const* print_array(Print& p, PrimitiveId t, u32 count, char const* it) {
-  sprint(p, '[');
-  auto printer = basic_type_printer(t);
-  if (count) {
-    it = printer(p, it);
-    for (u32 i = 1; i < count; ++i) {
-      sprint(p, ' ');
-      it = printer(p, it);
-    }
-  }
-  sprint(p, ']');
-  return it;
+  return array_printer[t](p, it, count);
 }
 
 char const* print_value(Print& p, Library const& l, LibraryStruct st, u32 type, ArrayType arr, u32 length, char const* it, char const* begin) {
@@ -482,7 +483,7 @@ char const* print_value(Print& p, Library const& l, LibraryStruct st, u32 type,
     u32 real_length = length;
     return print_array(p, type_primitive(type), real_length, it);
   } else if (arr == MemberArray) {
-    u32 real_length = get_field(begin, st, length);
+    u32 real_length = get_field(l, begin, st, length);
     return print_array(p, type_primitive(type), real_length, it);
   } else
     unreachable;
@@ -502,21 +503,24 @@ char const* print_struct(Print& p, Library const& l, LibraryStruct s, char const
   return it;
 }
 
-void print_struct(Print& p, Library const& l, LibraryStruct s, Str b) {
-  print_struct(p, l, s, b.begin());
-}
-
 char const* print_custom_type(Print& p, Library const& l, u32 t, char const* it) {
   return print_struct(p, l, l.type(t), it);
 }
 
-u32 find_or_add(ArrayList<char>& strs, Str str) {
-  auto exist = find(span(strs), str);
-  if (exist)
-    return *exist;
-  auto id = len(strs);
-  strs.push(str);
-  return id;
+// Size of a member if it doesn't depend on the record's contents.
+MaybeU32 static_size(Span<LibraryLayout> struct_end, LibraryMember m) {
+  if (m.array == MemberArray)
+    return none;
+  u32 size {};
+  if (m.type < PrimitiveCount)
+    size = PrimitiveSize[m.type];
+  else {
+    auto end = struct_end[m.type - PrimitiveCount];
+    if (end.after)
+      return none;
+    size = end.offset;
+  }
+  return m.array == FixedArray ? size * m.length : size;
 }
 
 u8 operator""_u8(unsigned long long x) {
@@ -530,7 +534,7 @@ void test_print_value() {
   weight u8
   )"_s);
   auto personType = types.type("Person"_s);
-  auto data = make_struct(personType, 27_u8, 150_u8);
+  auto data = make_struct(types, personType, 27_u8, 150_u8);
   check(data.span() == "\33\226"_s);
 
   Print p;
@@ -544,7 +548,7 @@ void test_print_value_array() {
   name[name_len] u8
   )"_s);
   auto personType = types.type("Person"_s);
-  auto data = make_struct(personType, 5_u8, (u8 const(&)[5]) "AAAAA");
+  auto data = make_struct(types, personType, 5_u8, (u8 const(&)[5]) "AAAAA");
   check(data.span() == "\5\0\0\0\101\101\101\101\101"_s);
 
   Print p;
@@ -552,6 +556,170 @@ void test_print_value_array() {
   check(p.chars.span() == "Person name_len=5 name=[65 65 65 65 65]"_s);
 }
 
+void test_member_layout() {
+  auto types = parse(R"(struct Blob
+  a u8
+  xs[a] u16
+  b u32
+  ys[b] u8
+  tail u16
+
+struct Outer
+  head u8
+  blob Blob
+  fixed[2] u32
+)"_s);
+  auto blob = types.type("Blob"_s);
+  check(!blob.fixed());
+  check(blob.layout[2].after == 2 && blob.layout[2].offset == 0);
+  check(blob.layout[4].after == 4 && blob.layout[4].offset == 0);
+  check(blob.end.after == 4 && blob.end.offset == 2);
+
+  auto data = "\2\1\0\2\0\3\0\0\0\7\10\11\5\0"_s;
+  check(member_offset(types, blob, 3, data.begin()) == 9);
+  check(member_offset(types, blob, 4, data.begin()) == 12);
+  check(struct_size(types, blob, data.begin()) == len(data));
+
+  Print p;
+  print_struct(p, types, blob, data);
+  check(p.chars.span() == "Blob a=2 xs=[1 2] b=3 ys=[7 8 9] tail=5"_s);
+
+  auto outer = types.type("Outer"_s);
+  check(outer.layout[1].after == 0 && outer.layout[1].offset == 1);
+  check(outer.layout[2].after == 2 && outer.layout[2].offset == 0);
+}
+
+}
+
+void print_struct(Print& p, Library const& l, LibraryStruct s, Str b) {
+  print_struct(p, l, s, b.begin());
+}
+
+namespace {
+
+// A dynamic member and where it ends in the record.
+struct Section {
+  u32 member;
+  u32 end;
+};
+
+}
+
+// Offset of `at` given the first `count` dynamic members, in member order,
+// which must include the one it follows.
+static u32 section_base(LibraryLayout at, Section const* sections, u32 count) {
+  if (!at.after)
+    return at.offset;
+  u32 lo {}, hi = count;
+  while (hi - lo > 1) {
+    u32 mid = (lo + hi) / 2;
+    if (sections[mid].member < at.after)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  check(sections[lo].member == at.after - 1);
+  return sections[lo].end + at.offset;
+}
+
+static u32 section_offset(Library const& l, LibraryStruct s, LibraryLayout at, char const* base) {
+  if (!at.after)
+    return at.offset;
+  // The dynamic members before `at` chain back through their layouts. Their
+  // ends are found first to last, so that each length is read at a base
+  // already found.
+  u32 count {};
+  for (u32 k = at.after; k; k = s.layout[k - 1].after)
+    ++count;
+  Section small[16];
+  List<Section> large;
+  Section* sections = count <= 16 ? small : large.reserve(count);
+  u32 i = count;
+  for (u32 k = at.after; k; k = s.layout[k - 1].after)
+    sections[--i].member = k - 1;
+  for (; i < count; ++i) {
+    u32 k = sections[i].member;
+    auto& m = s.member[k];
+    u32 begin = section_base(s.layout[k], sections, i);
+    if (m.array == MemberArray) {
+      u32 length_at = section_base(s.layout[m.length], sections, i);
+      u32 length = read_u32(base + length_at, type_primitive(s.member[m.length].type));
+      sections[i].end = begin + PrimitiveSize[type_primitive(m.type)] * length;
+    } else {
+      check(m.array == NoArray);
+      auto inner = l.type(m.type - PrimitiveCount);
+      sections[i].end = begin + struct_size(l, inner, base + begin);
+    }
+  }
+  return section_base(at, sections, count);
+}
+
+u32 member_offset(Library const& l, LibraryStruct s, u32 member, char const* base) {
+  check(member < s.memberCount);
+  return section_offset(l, s, s.layout[member], base);
+}
+
+u32 struct_size(Library const& l, LibraryStruct s, char const* base) {
+  return section_offset(l, s, s.end, base);
+}
+
+// A schema the size of our generated ones, where each struct nests the
+// previous one; name lookups must stay correct as the tables grow.
+void test_many_structs() {
+  static constexpr u32 n = 3000;
+  Print schema;
+  for (u32 i {}; i < n; ++i) {
+    sprint(schema, "struct S"_s, i, "\n  x"_s, i, " u32\n"_s);
+    if (i)
+      sprint(schema, "  s S"_s, i - 1, '\n');
+    sprint(schema, '\n');
+  }
+  sprint(schema, "log L\n  S0\n  S"_s, n - 1, "\n"_s);
+  schema.chars.push('\0');
+  auto l = parse(schema.chars.span());
+
+  check(len(l.struct_names) == n);
+  Print name;
+  for (u32 i {}; i < n; ++i) {
+    name.chars.size = 0;
+    sprint(name, 'S', i);
+    check(l.struct_index(name.chars.span()) == i);
+  }
+  check(!l.find_struct("S3000"_s));
+  check(!l.find_struct("x0"_s));
+  check(!l.find_struct("L"_s));
+  check(l.log_index("L"_s) == 0);
+  check(l.log_struct[0][1] == n - 1);
+  check(l.struct_end[n - 1].offset == 4 * n);
+}
+
+// Each member array's length is the member before it; offsets must be found
+// in one pass over the arrays, not by resolving each length again.
+void test_many_member_arrays() {
+  static constexpr u32 n = 40;
+  Print schema;
+  sprint(schema, "struct Pairs\n"_s);
+  for (u32 i {}; i < n; ++i)
+    sprint(schema, "  n"_s, i, " u8\n  a"_s, i, "[n"_s, i, "] u8\n"_s);
+  sprint(schema, "  tail u16\n"_s);
+  schema.chars.push('\0');
+  auto l = parse(schema.chars.span());
+  auto pairs = l.type("Pairs"_s);
+
+  Stream data;
+  for (u32 i {}; i < n; ++i) {
+    data.push(char(i % 3));
+    for (u32 j {}; j < i % 3; ++j)
+      data.push(char(j));
+  }
+  data.push('\5');
+  data.push('\0');
+  check(member_offset(l, pairs, 2 * n, data.begin()) == len(data) - 2);
+  check(struct_size(l, pairs, data.begin()) == len(data));
+  Print p;
+  print_struct(p, l, pairs, data.span());
+  auto printed = p.chars.span();
+  check(Str {printed.end() - 7, 7} == " tail=5"_s);
 }
 
 void parse() {
@@ -580,6 +748,9 @@ log LogType
 )"_s);
   test_print_value();
   test_print_value_array();
+  test_member_layout();
+  test_many_structs();
+  test_many_member_arrays();
   println("Parse tests passed");
 }
 
@@ -587,31 +758,70 @@ Library parse(Str schema) {
   Parser p {};
   p.start_line(schema.begin());
 
-  ArrayList<char> names;
+  StrTable names;
   List<u32> struct_names;
   ArrayList<LibraryMember> members;
+  List<LibraryLayout> layout;
+  List<LibraryLayout> struct_end;
   for (auto struct_: range(len(p.struct_type))) {
     auto type = p.struct_type[struct_];
     auto name = p.get_type_name(type);
-    auto name_id = find_or_add(names, name);
-    struct_names.push(name_id);
+    struct_names.push(names.add(name));
 
     auto member_name = p.struct_member_name[struct_];
     auto member_info = p.struct_member[struct_];
     members.push_empty(0);
+    LibraryLayout at {};
     for (auto member: range(len(member_info))) {
       auto name = member_name[member];
-      auto name_id = find_or_add(names, name);
+      auto name_id = names.add(name);
       auto info = member_info[member];
-      last_push(members, LibraryMember {name_id, info.type, info.array, info.length});
+      // Library type ids count structs only; the parser's also count logs.
+      u32 type = info.type;
+      if (type >= PrimitiveCount) {
+        auto index = p.struct_index(type);
+        check(!!index);
+        type = PrimitiveCount + *index;
+      }
+      LibraryMember m {name_id, type, info.array, info.length};
+      last_push(members, m);
+      layout.push(at);
+      if (auto size = static_size(struct_end, m))
+        at.offset += *size;
+      else
+        at = {member + 1, 0};
     }
+    struct_end.push(at);
   }
-  Library ans;
-  ans.names = names.take();
-  ans.struct_names = struct_names.take();
-  ans.struct_member = members.take();
-  
-  return ans;
+
+  List<u32> log_names;
+  ArrayList<u32> log_struct;
+  for (auto log: range(len(p.log_type))) {
+    log_names.push(names.add(p.get_type_name(p.log_type[log])));
+    log_struct.push(p.log_member_struct[log]);
+  }
+
+  Array<::MaybeU32> name_struct(len(names));
+  Array<::MaybeU32> name_log(len(names));
+  for (auto i: range(len(struct_names)))
+    name_struct[struct_names[i]] = i;
+  for (auto i: range(len(log_names)))
+    name_log[log_names[i]] = i;
+
+  Library tables;
+  tables.names = names.view();
+  tables.struct_names = struct_names.span();
+  tables.struct_member = members.view();
+  tables.member_layout = layout.span();
+  tables.struct_end = struct_end.span();
+  tables.log_names = log_names.span();
+  tables.log_struct = log_struct.view();
+  tables.name_struct = name_struct.span();
+  tables.name_log = name_log.span();
+
+  Stream image;
+  write_schema(tables, image);
+  return load_schema(image.take());
 }
 
 void print_to_bstruct(Library const& p, Print& s) {
@@ -629,11 +839,38 @@ void print_to_bstruct(Library const& p, Print& s) {
     }
     sprint(s, '\n');
   }
+  for (auto log: range(len(p.log_names))) {
+    sprint(s, "log "_s, p.names[p.log_names[log]], '\n');
+    for (u32 struct_: p.log_struct[log])
+      sprint(s, "  "_s, p.names[p.struct_names[struct_]], '\n');
+    sprint(s, '\n');
+  }
   s.chars.pop();
 }
 
 u32 primitive_size(PrimitiveId p) { return PrimitiveSize[p]; }
 
+template <class T>
+static u64 load_integer(char const* it) {
+  T x;
+  memcpy(&x, it, sizeof(T));
+  return u64(x);
+}
+
+u64 read_integer(PrimitiveId t, char const* it) {
+  switch (t) {
+    case U8: return load_integer<u8>(it);
+    case U16: return load_integer<u16>(it);
+    case U32: return load_integer<u32>(it);
+    case U64: return load_integer<u64>(it);
+    case I8: return load_integer<i8>(it);
+    case I16: return load_integer<i16>(it);
+    case I32: return load_integer<i32>(it);
+    case I64: return load_integer<i64>(it);
+    default: unreachable;
+  }
+}
+
 Str primitive_name(PrimitiveId i) {
   u32 begin = i ? u32(PrimitiveNameEnd[i - 1]) : 0u;
   return {PrimitiveName + begin, u32(PrimitiveNameEnd[i]) - begin};
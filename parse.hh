@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.hh"
+#include "intern.hh"
 
 enum PrimitiveId: u8 {
   U8, U16, U32, U64, I8, I16, I32, I64, F32, F64, PrimitiveCount
@@ -8,6 +9,9 @@ enum PrimitiveId: u8 {
 
 Str primitive_name(PrimitiveId);
 u32 primitive_size(PrimitiveId);
+// An integer value of type `t` at `it`, which need not be aligned; signed
+// values are sign-extended.
+u64 read_integer(PrimitiveId t, char const* it);
 
 enum ArrayType {
   NoArray,
@@ -22,10 +26,22 @@ struct LibraryMember {
   u32 length;
 };
 
+// Where a member starts: `offset` bytes past the end of member `after - 1`,
+// or past the start of the struct when `after` is 0. Only members whose size
+// is known at runtime (member arrays and dynamically sized structs) start a
+// new section, so fixed-layout structs have `after == 0` throughout.
+struct LibraryLayout {
+  u32 after;
+  u32 offset;
+};
+
 struct LibraryStruct {
   u32 name;
   u32 memberCount;
   LibraryMember const* member;
+  LibraryLayout const* layout;
+  LibraryLayout end;
+  bool fixed() const { return !end.after; }
 };
 
 struct Primitive {
@@ -34,10 +50,49 @@ struct Primitive {
   u32 size() const { return primitive_size(id); }
 };
 
+// The memory a Library's tables point into: a heap copy of a compiled
+// schema, or a read-only mapping of a compiled schema file.
+struct SchemaImage {
+  char const* base {};
+  u64 size {};
+  bool mapped {};
+
+  SchemaImage() = default;
+  SchemaImage(char const* base_, u64 size_, bool mapped_):
+    base(base_), size(size_), mapped(mapped_) {}
+  SchemaImage(SchemaImage&& rhs):
+    base(exchange(rhs.base, nullptr)), size(exchange(rhs.size, 0ull)),
+    mapped(rhs.mapped) {}
+  ~SchemaImage();
+
+  void operator=(SchemaImage rhs) {
+    swap(base, rhs.base);
+    swap(size, rhs.size);
+    swap(mapped, rhs.mapped);
+  }
+};
+
+// A parsed schema. The tables are views into `image`, laid out as in a
+// compiled schema file (see write_schema), so a Library loaded from a file
+// is used in place without any per-table allocation.
 struct Library {
-  ArrayArray<char> names;
-  Array<u32> struct_names;
-  ArrayArray<LibraryMember> struct_member;
+  SchemaImage image;
+
+  StrIndex names;
+  Span<u32> struct_names;
+  SpanArray<LibraryMember> struct_member;
+  Span<LibraryLayout> member_layout;
+  Span<LibraryLayout> struct_end;
+
+  // Each `log` declaration and the struct index of each of its variants. On
+  // the wire a log is a sequence of records, each a little-endian u16 tag
+  // (the variant's position in the declaration) followed by the struct.
+  Span<u32> log_names;
+  SpanArray<u32> log_struct;
+
+  // The struct and the log declared with each name, by name id.
+  Span<MaybeU32> name_struct;
+  Span<MaybeU32> name_log;
 
   struct Type;
 
@@ -62,6 +117,7 @@ struct Library {
       check(member_array());
       return {l, struct_base + library_member().length, struct_base};
     }
+    LibraryLayout layout() const { return l.member_layout[i]; }
     Type type() const;
   };
 
@@ -78,7 +134,10 @@ struct Library {
     Library const& l;
     u32 s;
     u32 struct_base() const { return s ? l.struct_member.offsets[s - 1] : 0; }
-    Member operator[](u32 i) const { return {l, s + i, struct_base()}; }
+    Member operator[](u32 i) const {
+      u32 base = struct_base();
+      return {l, base + i, base};
+    }
     MemberIterator begin() {
       u32 base = struct_base();
       return {l, base, base};
@@ -125,21 +184,54 @@ struct Library {
 
   Structs structs() const { return {*this}; }
 
-  LibraryStruct type(Str name) const {
-    auto index = find_if(struct_names.span(), [&](u32 n) {
-      return names[n] == name;
-    });
-    return type(*index);
+  MaybeU32 find_struct(Str name) const {
+    auto id = names.find(name);
+    return id ? name_struct[*id] : id;
+  }
+
+  u32 struct_index(Str name) const { return *find_struct(name); }
+
+  LibraryStruct type(Str name) const { return type(struct_index(name)); }
+
+  u32 log_index(Str name) const {
+    auto id = names.find(name);
+    return *(id ? name_log[*id] : id);
   }
 
   LibraryStruct type(u32 index) const {
     auto members = struct_member[index];
-    return {struct_names[index], len(members), members.begin()};
+    auto base = index ? struct_member.offsets[index - 1] : 0;
+    return {
+        struct_names[index], len(members), members.begin(),
+        member_layout.begin() + base, struct_end[index]};
   }
 };
 
 Library parse(Str schema);
 
+// Compiled schemas: every table of a Library in one flat, pointer-free
+// image (native byte order), so it can be mapped and used in place.
+void write_schema(Library const& l, Stream& out);
+// Takes ownership of a heap image, e.g. one made by write_schema.
+Library load_schema(String image);
+// Maps a compiled schema file read-only; the pages are shared with every
+// other process that maps the same file.
+Library load_schema(char const* path);
+bool is_compiled_schema(Str data);
+
+// Prints a record that has passed `validate`, which rejects array lengths
+// that are negative or run past the data; they aren't checked again here.
+void print_struct(Print& p, Library const& l, LibraryStruct s, Str b);
+
+// Offset of `member` in the record at `base`, in O(1) for fixed-layout
+// structs and O(number of dynamic sections) otherwise.
+u32 member_offset(Library const& l, LibraryStruct s, u32 member, char const* base);
+// Size of the record at `base`. A section of unknown size ends after a
+// member array of primitives or a single struct, so there is no way to size
+// an array of structs at runtime; a struct can only be repeated a fixed
+// number of times.
+u32 struct_size(Library const& l, LibraryStruct s, char const* base);
+
 void print_to_bstruct(Library const& p, Print& s);
 void to_cpp(Library const& p, Print& s);
 
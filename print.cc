@@ -1,46 +1,50 @@
 #include "common.hh"
+#include "format.hh"
 
 #include <unistd.h>
-#include <cstdio>
 
 void write_cerr(Str str) {
   write(1, str.base, str.size);
 }
 
 template <class T>
-void do_snprint(Print& s, u32 max, char const* fmt, T const& arg) {
-  u32 cur = s.chars.size;
-  s.chars.expand(cur + max);
-  auto it = s.chars.begin() + cur;
-  i32 n_written = snprintf(it, max, fmt, arg);
-  check(n_written >= 0);
-  s.chars.size += static_cast<u32>(n_written);
+void print_formatted(T x, Print& s) {
+  auto end = format(x, s.chars.reserve(format_max<T>));
+  s.chars.size = u32(end - s.chars.begin());
 }
 
-void print(u8 x, Print& s) { do_snprint(s, 4, "%u", u32(x)); }
+void print(u8 x, Print& s) { print_formatted(x, s); }
 
-void print(u16 x, Print& s) { do_snprint(s, 6, "%u", u32(x)); }
+void print(u16 x, Print& s) { print_formatted(x, s); }
 
-void print(u32 x, Print& s) { do_snprint(s, 11, "%u", x); }
+void print(u32 x, Print& s) { print_formatted(x, s); }
 
-void print(u64 x, Print& s) {
-  do_snprint(s, 21, "%llu", (unsigned long long) x);
-}
+void print(u64 x, Print& s) { print_formatted(x, s); }
 
-void print(i8 x, Print& s) { do_snprint(s, 5, "%d", i32(x)); }
+void print(i8 x, Print& s) { print_formatted(x, s); }
 
-void print(i16 x, Print& s) { do_snprint(s, 7, "%d", i32(x)); }
+void print(i16 x, Print& s) { print_formatted(x, s); }
 
-void print(i32 x, Print& s) { do_snprint(s, 12, "%d", x); }
+void print(i32 x, Print& s) { print_formatted(x, s); }
 
-void print(i64 x, Print& s) { do_snprint(s, 22, "%lld", (long long) x); }
+void print(i64 x, Print& s) { print_formatted(x, s); }
 
-void print(f32 x, Print& s) { do_snprint(s, 16, "%.9g", x); }
+void print(f32 x, Print& s) { print_formatted(x, s); }
 
-void print(f64 x, Print& s) { do_snprint(s, 31, "%.17g", x); }
+void print(f64 x, Print& s) { print_formatted(x, s); }
 
 void print(void* x, Print& s) {
-  do_snprint(s, 3 + 2 * sizeof(void*), "%p", x);
+  static constexpr char hex[] = "0123456789abcdef";
+  auto bits = reinterpret_cast<uptr>(x);
+  u32 n = 1;
+  while (n < 2 * sizeof(bits) && bits >> (4 * n))
+    ++n;
+  char* out = s.chars.reserve(2 + n);
+  out[0] = '0';
+  out[1] = 'x';
+  for (u32 i {}; i < n; ++i)
+    out[1 + n - i] = hex[(bits >> (4 * i)) & 15];
+  s.chars.size += 2 + n;
 }
 
 void print_array(
@@ -67,8 +67,74 @@ void print_stub(u64 const* words) {
   write_cerr(s.chars);
 }
 
-void* alloc_stub() {
-  return malloc(8);
+}
+
+// What the program calls to print, as for prog1.
+void (*prog2_print)(u64 const*) = print_stub;
+
+namespace {
+
+// The heap of JIT'd code, one per thread. Objects are bumped out of the
+// current chunk by inline code (see `allocate`), which calls `heap_refill`
+// only once the chunk is full. Continuations are cells, which the code
+// consuming one gives back (see `release`) for the next to reuse, so a
+// running program holds only as many as are live. `heap_reset` drops
+// everything once a program has returned, and keeps the chunks for the
+// next run.
+struct Heap {
+  static constexpr u32 chunk_size = 1 << 16;
+  static constexpr u32 cell_size = 8;
+  // Read and written by JIT'd code.
+  char* at {};
+  char* end {};
+  // Cells given back, each holding the next.
+  char* cells {};
+  // The chunks used this run, and those kept for later.
+  List<char*> used;
+  List<char*> spare;
+
+  ~Heap() {
+    for (auto c: used)
+      free(c);
+    for (auto c: spare)
+      free(c);
+  }
+};
+
+thread_local Heap heap;
+
+void* heap_refill(u64 size) {
+  check(size <= Heap::chunk_size);
+  char* chunk;
+  if (len(heap.spare)) {
+    chunk = last(heap.spare);
+    heap.spare.pop();
+  } else {
+    chunk = (char*) malloc(Heap::chunk_size);
+    check(chunk);
+  }
+  heap.used.push(chunk);
+  heap.at = chunk + size;
+  heap.end = chunk + Heap::chunk_size;
+  return chunk;
+}
+
+void heap_reset() {
+  for (auto c: heap.used)
+    heap.spare.push(c);
+  heap.used.size = 0;
+  heap.at = heap.end = heap.cells = nullptr;
+}
+
+// JIT'd code finds the heap through this, since how thread-locals are
+// reached differs between platforms.
+Heap* current_heap() {
+  return &heap;
+}
+
+// Where field `f` of a Heap is.
+i32 heap_field(char* const& f) {
+  return i32((char const*) &f - (char const*) &heap);
 }
 
 thread_local struct FrameContext* ctx {};
@@ -76,6 +142,8 @@ thread_local struct FrameContext* ctx {};
 struct FrameContext {
   Backend& b;
   u32 track_rsp {};
+  // Where the heap's address is kept on the stack, once loaded.
+  u32 heap_slot {};
   FrameContext(Backend& b_): b(b_) {
     check(exchange(ctx, this) == nullptr);
   }
@@ -141,7 +209,7 @@ object(StackValue keys, std::initializer_list<StackValue> values) {
 
 void print(StackValue v) {
   load(rdi, v);
-  ctx->b.mov(rax, u64(print_stub));
+  ctx->b.mov(rax, u64(prog2_print));
   ctx->b.call(rax);
 }
 
@@ -166,10 +234,74 @@ void call_stateless_function(placeholder fn, StackValue next) {
   b.jmp(rel32(fn));
 }
 
-StackValue pure_continuation(placeholder addr) {
+// Puts the heap's address in rcx. The first use in a frame asks
+// `current_heap` and keeps the address on the stack, so it clobbers the
+// caller-saved registers.
+void load_heap() {
   auto& b = ctx->b;
-  b.mov(rax, u64(alloc_stub));
+  if (!ctx->heap_slot) {
+    b.mov(rax, u64(current_heap));
+    b.call(rax);
+    b.push(rax);
+    ctx->heap_slot = ctx->track_rsp += 8;
+  }
+  load_val(rcx, {ctx->heap_slot});
+}
+
+// Puts `size` bytes from the heap in rax. The bump is inline, but loading
+// the heap and refilling it call out, so this clobbers the caller-saved
+// registers.
+void allocate(u32 size) {
+  auto& b = ctx->b;
+  auto slow = b.ph(), done = b.ph();
+  load_heap();
+  indir<reg64> at {rcx, heap_field(heap.at)};
+  b.mov(rax, at);
+  b.lea(rdx, rax[i32(size)]);
+  b.cmp(rdx, indir<reg64> {rcx, heap_field(heap.end)});
+  b.jcc(above, relaxed(slow));
+  b.mov(at, rdx);
+  b.jmp(relaxed(done));
+  b.label(slow);
+  b.mov(rdi, size);
+  b.mov(rax, u64(heap_refill));
   b.call(rax);
+  b.label(done);
+}
+
+// Puts a cell in rax, reusing one given back if there is one. As
+// `allocate`, this clobbers the caller-saved registers.
+void allocate_cell() {
+  auto& b = ctx->b;
+  auto bump = b.ph(), done = b.ph();
+  load_heap();
+  indir<reg64> cells {rcx, heap_field(heap.cells)};
+  b.mov(rax, cells);
+  b.cmp(rax, u8(0));
+  b.jcc(equal, relaxed(bump));
+  b.mov(rdx, rax[0]);
+  b.mov(cells, rdx);
+  b.jmp(relaxed(done));
+  b.label(bump);
+  allocate(Heap::cell_size);
+  b.label(done);
+}
+
+// Gives back the cell `v`. As `load_heap`, this clobbers the caller-saved
+// registers.
+void release(StackValue v) {
+  auto& b = ctx->b;
+  load_heap();
+  load_val(rax, v);
+  indir<reg64> cells {rcx, heap_field(heap.cells)};
+  b.mov(rdx, cells);
+  b.mov(rax[0], rdx);
+  b.mov(cells, rax);
+}
+
+StackValue pure_continuation(placeholder addr) {
+  auto& b = ctx->b;
+  allocate_cell();
   b.mov(rdi, rel32(addr));
   b.mov(indir<reg64>{rax}, rdi);
   b.push(rax);
@@ -190,6 +322,9 @@ ReceiveContinuation receive_continuation() {
 
 void return_trampoline() {
   auto& b = ctx->b;
+  // No continuation is live once the program returns.
+  b.mov(rax, u64(heap_reset));
+  b.call(rax);
   b.add(rsp, i32(ctx->track_rsp));
   b.ret();
 }
@@ -240,7 +375,10 @@ void prog2(Backend& b) {
 
   { b.label(my_finish);
     FrameContext c {b};
-    receive_continuation();
+    // The continuation is its own data, and is done with here.
+    auto [data, arg] = receive_continuation();
+    release(data);
     return_trampoline(); 
   }
+  b.relax();
 }
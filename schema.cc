@@ -0,0 +1,267 @@
+#include "parse.hh"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// A compiled schema is a header followed by the tables, each at an 8-byte
+// aligned offset from the start of the image. Offsets and counts are the
+// only references, so an image is valid wherever it is mapped.
+constexpr char Magic[8] {'b', 's', 't', 'r', 'u', 'c', 't', '\1'};
+constexpr u32 Version = 1;
+
+enum Table: u32 {
+  NameChars, NameEnds, NameSlots,
+  StructNames, Members, MemberEnds, MemberLayout, StructEnd,
+  LogNames, LogStructs, LogEnds,
+  NameStruct, NameLog,
+  TableCount
+};
+
+struct TableRef {
+  u32 offset;
+  u32 count;
+};
+
+struct Header {
+  char magic[8];
+  u32 version;
+  u32 table_count;
+  TableRef table[TableCount];
+};
+
+template <class T>
+void put_table(Stream& out, u32 start, Header& h, Table t, Span<T> items) {
+  while ((len(out) - start) % 8)
+    out.push('\0');
+  h.table[t] = {len(out) - start, len(items)};
+  auto bytes = reinterpret_cast<char const*>(items.begin());
+  extend(out, Str {bytes, u32(len(items) * sizeof(T))});
+}
+
+template <class T>
+Span<T> get_table(SchemaImage const& image, Header const& h, Table t) {
+  auto ref = h.table[t];
+  check(ref.offset % alignof(T) == 0);
+  check(ref.offset + u64(ref.count) * sizeof(T) <= image.size);
+  return {reinterpret_cast<T const*>(image.base + ref.offset), ref.count};
+}
+
+template <class T>
+SpanArray<T> get_array(
+    SchemaImage const& image, Header const& h, Table items, Table ends) {
+  return {get_table<T>(image, h, items), get_table<u32>(image, h, ends)};
+}
+
+template <class T>
+void check_ends(SpanArray<T> x) {
+  u32 at {};
+  for (u32 end: x.offsets) {
+    check(end >= at);
+    at = end;
+  }
+  check(at == len(x.items));
+}
+
+// Everything the accessors rely on without checking, so that a corrupt
+// file aborts here rather than reading out of bounds later.
+void validate(Library const& l) {
+  u32 names = len(l.names);
+  check_ends(l.names.strs);
+  u32 slots = len(l.names.slots);
+  // A table without names has no slots.
+  check(slots ? slots > names && !(slots & (slots - 1)) : !names);
+  for (u32 slot: l.names.slots)
+    check(slot <= names);
+
+  u32 structs = len(l.struct_names);
+  for (u32 name: l.struct_names)
+    check(name < names);
+  check(len(l.struct_member) == structs && len(l.struct_end) == structs);
+  check_ends(l.struct_member);
+  check(len(l.member_layout) == len(l.struct_member.items));
+  for (u32 s {}; s < structs; ++s) {
+    auto members = l.struct_member[s];
+    u32 base = s ? l.struct_member.offsets[s - 1] : 0;
+    // A section follows a member of unknown size, whose type is checked
+    // before any section refers to it.
+    auto check_section = [&](LibraryLayout at) {
+      if (!at.after)
+        return;
+      auto m = members[at.after - 1];
+      check(m.array == MemberArray ||
+            (m.type >= PrimitiveCount &&
+             l.struct_end[m.type - PrimitiveCount].after));
+    };
+    for (u32 i {}; i < len(members); ++i) {
+      auto m = members[i];
+      check(m.name < names);
+      // Types are declared before use, which also rules out cycles.
+      check(m.type < PrimitiveCount + s);
+      check(m.array <= MemberArray);
+      if (m.array == MemberArray) {
+        check(m.length < i);
+        auto length = members[m.length];
+        check(length.type < F32 && length.array == NoArray);
+      }
+      check(l.member_layout[base + i].after <= i);
+      check_section(l.member_layout[base + i]);
+    }
+    check(l.struct_end[s].after <= len(members));
+    check_section(l.struct_end[s]);
+  }
+
+  u32 logs = len(l.log_names);
+  for (u32 name: l.log_names)
+    check(name < names);
+  check(len(l.log_struct) == logs);
+  check_ends(l.log_struct);
+  for (u32 s: l.log_struct.items)
+    check(s < structs);
+
+  check(len(l.name_struct) == names && len(l.name_log) == names);
+  for (auto s: l.name_struct)
+    check(!s || *s < structs);
+  for (auto log: l.name_log)
+    check(!log || *log < logs);
+}
+
+Library load(SchemaImage image) {
+  check(image.size >= sizeof(Header));
+  Header h;
+  memcpy(&h, image.base, sizeof(h));
+  check(is_compiled_schema({image.base, u32(sizeof(h.magic))}));
+  check(h.version == Version && h.table_count == TableCount);
+
+  Library l;
+  l.names = {get_array<char>(image, h, NameChars, NameEnds),
+      get_table<u32>(image, h, NameSlots)};
+  l.struct_names = get_table<u32>(image, h, StructNames);
+  l.struct_member = get_array<LibraryMember>(image, h, Members, MemberEnds);
+  l.member_layout = get_table<LibraryLayout>(image, h, MemberLayout);
+  l.struct_end = get_table<LibraryLayout>(image, h, StructEnd);
+  l.log_names = get_table<u32>(image, h, LogNames);
+  l.log_struct = get_array<u32>(image, h, LogStructs, LogEnds);
+  l.name_struct = get_table<MaybeU32>(image, h, NameStruct);
+  l.name_log = get_table<MaybeU32>(image, h, NameLog);
+  l.image = move(image);
+  validate(l);
+  return l;
+}
+
+}
+
+SchemaImage::~SchemaImage() {
+  if (mapped)
+    munmap(const_cast<char*>(base), size);
+  else
+    free(const_cast<char*>(base));
+}
+
+void write_schema(Library const& l, Stream& out) {
+  u32 start = len(out);
+  Header h {};
+  memcpy(h.magic, Magic, sizeof(Magic));
+  h.version = Version;
+  h.table_count = TableCount;
+  out.reserve(sizeof(h));
+  out.size += u32(sizeof(h));
+
+  put_table(out, start, h, NameChars, l.names.strs.items);
+  put_table(out, start, h, NameEnds, l.names.strs.offsets);
+  put_table(out, start, h, NameSlots, l.names.slots);
+  put_table(out, start, h, StructNames, l.struct_names);
+  put_table(out, start, h, Members, l.struct_member.items);
+  put_table(out, start, h, MemberEnds, l.struct_member.offsets);
+  put_table(out, start, h, MemberLayout, l.member_layout);
+  put_table(out, start, h, StructEnd, l.struct_end);
+  put_table(out, start, h, LogNames, l.log_names);
+  put_table(out, start, h, LogStructs, l.log_struct.items);
+  put_table(out, start, h, LogEnds, l.log_struct.offsets);
+  put_table(out, start, h, NameStruct, l.name_struct);
+  put_table(out, start, h, NameLog, l.name_log);
+  memcpy(out.begin() + start, &h, sizeof(h));
+}
+
+Library load_schema(String image) {
+  u64 size = len(image);
+  auto base = exchange(image.data, nullptr);
+  image.size = 0;
+  return load({base, size, false});
+}
+
+Library load_schema(char const* path) {
+  int fd = open(path, O_RDONLY);
+  check(fd >= 0);
+  struct stat st;
+  check(!fstat(fd, &st));
+  u64 size = u64(st.st_size);
+  check(size >= sizeof(Header));
+  void* data = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+  check(data != MAP_FAILED);
+  check(!close(fd));
+  return load({static_cast<char const*>(data), size, true});
+}
+
+bool is_compiled_schema(Str data) {
+  return len(data) >= sizeof(Magic)
+      && Str {data.base, sizeof(Magic)} == Str {Magic};
+}
+
+void test_compiled_schema() {
+  auto source = R"(struct Point
+  x f32
+  y f32
+
+struct Path
+  origin Point
+  count u16
+  xs[count] f32
+  tags[2] u8
+
+log Shapes
+  Path
+  Point
+)"_s;
+  auto l = parse(source);
+
+  Stream image;
+  write_schema(l, image);
+  check(is_compiled_schema(image.span()));
+  check(!is_compiled_schema(source));
+
+  char path[] = "/tmp/bstruct-schema-XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0);
+  check(write(fd, image.begin(), len(image)) == len(image));
+  check(!close(fd));
+  {
+    auto mapped = load_schema(path);
+    check(mapped.image.mapped);
+    check(mapped.struct_index("Path"_s) == 1);
+    check(mapped.log_index("Shapes"_s) == 0);
+    check(mapped.log_struct[0][1] == 0);
+
+    Print a, b;
+    sprint(a, to_bstruct(l));
+    sprint(b, to_bstruct(mapped));
+    check(a.chars.span() == b.chars.span());
+
+    // Records print the same whichever way the schema was loaded.
+    char record[] {0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 6};
+    a.chars.size = b.chars.size = 0;
+    print_struct(a, l, l.type("Path"_s), Str {record});
+    print_struct(b, mapped, mapped.type("Path"_s), Str {record});
+    check(a.chars.span() == b.chars.span());
+  }
+  check(!unlink(path));
+
+  auto empty = parse(""_s);
+  check(!len(empty.struct_names) && !len(empty.log_names));
+  check(!empty.find_struct("Path"_s));
+  println("Compiled schema tests passed");
+}
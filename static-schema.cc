@@ -0,0 +1,163 @@
+#include "static-schema.hh"
+
+#include "validate.hh"
+
+namespace {
+
+using Shapes = StaticSchema<R"(struct Point
+  x f32
+  y f32
+
+struct Shape
+  id u16
+  origin Point
+  mean[2] f64
+  count u8
+  xs[count] i8
+  corners[2] Point
+  tail u32
+
+struct Tail
+  n u8
+  xs[n] u16
+
+struct Tails
+  tails[2] Tail
+
+log Drawing
+  Shape
+  Point
+)">;
+
+// Each member array's length is the member before it, so offsets must be
+// found in one pass rather than by resolving each length again.
+using Pairs = StaticSchema<R"(struct Pairs
+  n0 u8
+  a0[n0] u8
+  n1 u8
+  a1[n1] u8
+  n2 u8
+  a2[n2] u8
+  n3 u8
+  a3[n3] u8
+  n4 u8
+  a4[n4] u8
+  n5 u8
+  a5[n5] u8
+  n6 u8
+  a6[n6] u8
+  n7 u8
+  a7[n7] u8
+  n8 u8
+  a8[n8] u8
+  n9 u8
+  a9[n9] u8
+  n10 u8
+  a10[n10] u8
+  n11 u8
+  a11[n11] u8
+  n12 u8
+  a12[n12] u8
+  n13 u8
+  a13[n13] u8
+  n14 u8
+  a14[n14] u8
+  n15 u8
+  a15[n15] u8
+  n16 u8
+  a16[n16] u8
+  n17 u8
+  a17[n17] u8
+  n18 u8
+  a18[n18] u8
+  n19 u8
+  a19[n19] u8
+  n20 u8
+  a20[n20] u8
+  n21 u8
+  a21[n21] u8
+  n22 u8
+  a22[n22] u8
+  n23 u8
+  a23[n23] u8
+  n24 u8
+  a24[n24] u8
+  n25 u8
+  a25[n25] u8
+  n26 u8
+  a26[n26] u8
+  n27 u8
+  a27[n27] u8
+  n28 u8
+  a28[n28] u8
+  n29 u8
+  a29[n29] u8
+  tail u16
+)">::Struct<"Pairs">;
+
+using Point = Shapes::Struct<"Point">;
+using Shape = Shapes::Struct<"Shape">;
+using Tails = Shapes::Struct<"Tails">;
+
+static_assert(Shapes::counts.structs == 4 && Shapes::counts.members == 12);
+static_assert(Point::fixed && Point::fixed_size == 8);
+static_assert(!Shape::fixed && !Tails::fixed);
+static_assert(Shape::index<"xs"> == 4);
+static_assert(Shape::offset<Shape::index<"count">>(nullptr) == 26);
+static_assert(Shape::offset<Shape::index<"xs">>(nullptr) == 27);
+
+}
+
+void test_static_schema() {
+  i8 xs[] {-1, 0, 5};
+  f64 mean[] {0.5, -2};
+  char buf[64] {};
+  Shape::Writer w {buf};
+  w.set<"id">(u16(7));
+  w.at<"origin">().set<"x">(1.5f);
+  w.at<"origin">().set<"y">(2.5f);
+  w.set<"mean">(Span<f64> {mean});
+  w.set<"count">(u8(3));
+  w.set<"xs">(Span<i8> {xs});
+  w.set<"tail">(u32(9));
+  check(w.size() == 2 + 8 + 16 + 1 + 3 + 16 + 4);
+  Str record {buf, w.size()};
+
+  // The same layout as the runtime Library's.
+  auto l = parse(to_str(Shapes::text.chars));
+  auto shape = l.type("Shape"_s);
+  check(struct_size(l, shape, buf) == w.size());
+  check(member_offset(l, shape, 6, buf) == Shape::offset<6>(buf));
+  check(*validate(l, shape, record) == w.size());
+  check(*Shape::validate(record) == w.size());
+  for (u32 size {}; size < len(record); ++size)
+    check(!Shape::validate({buf, size}));
+
+  Shape::Reader r {buf};
+  check(r.size() == w.size());
+  check(r.get<"id">() == 7 && r.get<"tail">() == 9);
+  check(r.get<"origin">().get<"y">() == 2.5f);
+  check(r.get<"mean">()[1] == -2);
+  auto read_xs = r.get<"xs">();
+  check(len(read_xs) == 3 && read_xs[0] == -1 && read_xs[2] == 5);
+
+  char tails[] {1, 5, 0, 0};
+  check(*Tails::validate({tails, 4}) == 4);
+  check(!Tails::validate({tails, 3}));
+  check(*validate(l, l.type("Tails"_s), {tails, 4}) == 4);
+
+  char pairs[128] {};
+  u32 size {};
+  for (u32 i {}; i < 30; ++i) {
+    pairs[size++] = char(i % 3);
+    size += i % 3;
+  }
+  pairs[size++] = 5;
+  size++;
+  check(*Pairs::validate({pairs, size}) == size);
+  check(!Pairs::validate({pairs, size - 1}));
+  Pairs::Reader pr {pairs};
+  check(pr.size() == size && pr.get<"tail">() == 5);
+  check(len(pr.get<"a29">()) == 2);
+  println("Static schema tests passed");
+}
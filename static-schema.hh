@@ -0,0 +1,504 @@
+#pragma once
+
+#include "parse.hh"
+
+// The schema language parsed at compile time, for header-only codecs with
+// no runtime Library and no generated code:
+//
+//   using Shapes = StaticSchema<"struct Point\n  x f32\n  y f32\n">;
+//   using Point = Shapes::Struct<"Point">;
+//   f32 x = Point::Reader {data}.get<"x">();
+//
+// The tables mirror Library's (members, layouts and struct ends), so every
+// offset and size that doesn't depend on a record's contents is a constant,
+// and the others are constants plus the sizes of the member arrays before
+// them. Schema errors fail check() during constant evaluation, which stops
+// the compile.
+
+template <u32 N>
+struct StaticText {
+  char chars[N];
+  constexpr StaticText(char const (&s)[N]) {
+    for (u32 i {}; i < N; ++i)
+      chars[i] = s[i];
+  }
+};
+
+// Part of the schema text, [begin, end).
+struct StaticName {
+  u32 begin;
+  u32 end;
+};
+
+// As LibraryMember, with the name in the schema text.
+struct StaticMember {
+  StaticName name;
+  u32 type;
+  ArrayType array;
+  u32 length;
+};
+
+template <u32 Structs, u32 Members>
+struct StaticTables {
+  StaticName struct_name[Structs + 1] {};
+  // The members of struct s are [struct_member[s], struct_member[s + 1]).
+  u32 struct_member[Structs + 1] {};
+  StaticMember member[Members + 1] {};
+  LibraryLayout layout[Members + 1] {};
+  LibraryLayout end[Structs + 1] {};
+};
+
+struct StaticCounts {
+  u32 structs;
+  u32 members;
+};
+
+constexpr char const* static_primitive_name[PrimitiveCount] {
+    "u8", "u16", "u32", "u64", "i8", "i16", "i32", "i64", "f32", "f64"};
+constexpr u32 static_primitive_size[PrimitiveCount] {
+    1, 2, 4, 8, 1, 2, 4, 8, 4, 8};
+
+constexpr bool static_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+      (c >= '0' && c <= '9') || c == '_';
+}
+
+constexpr bool static_equal(char const* text, StaticName n, char const* s) {
+  for (u32 i = n.begin; i < n.end; ++i, ++s)
+    if (text[i] != *s)
+      return false;
+  return !*s;
+}
+
+constexpr bool static_equal(char const* text, StaticName a, StaticName b) {
+  if (a.end - a.begin != b.end - b.begin)
+    return false;
+  for (u32 i {}; i < a.end - a.begin; ++i)
+    if (text[a.begin + i] != text[b.begin + i])
+      return false;
+  return true;
+}
+
+// Declarations start at column 0 and their members are indented.
+constexpr StaticCounts static_counts(char const* text) {
+  StaticCounts counts {};
+  bool in_struct = false;
+  for (u32 i {}; text[i];) {
+    u32 indent {};
+    for (; text[i] == ' '; ++i)
+      ++indent;
+    if (text[i] && text[i] != '\n') {
+      if (!indent) {
+        StaticName decl {i, i};
+        while (static_name_char(text[decl.end]))
+          ++decl.end;
+        in_struct = static_equal(text, decl, "struct");
+        counts.structs += in_struct;
+      } else {
+        counts.members += in_struct;
+      }
+    }
+    while (text[i] && text[i] != '\n')
+      ++i;
+    if (text[i])
+      ++i;
+  }
+  return counts;
+}
+
+template <u32 Structs, u32 Members>
+constexpr StaticTables<Structs, Members> static_parse(char const* text) {
+  StaticTables<Structs, Members> t;
+  u32 s {};
+  u32 m {};
+  bool in_struct = false;
+  u32 i {};
+  auto spaces = [&] {
+    while (text[i] == ' ')
+      ++i;
+  };
+  auto word = [&] {
+    StaticName n {i, i};
+    while (static_name_char(text[n.end]))
+      ++n.end;
+    check(n.begin != n.end);
+    i = n.end;
+    return n;
+  };
+  auto find_type = [&](StaticName name) {
+    for (u32 p {}; p < PrimitiveCount; ++p)
+      if (static_equal(text, name, static_primitive_name[p]))
+        return p;
+    // Structs declared before the current one.
+    for (u32 k {}; k + 1 < s; ++k)
+      if (static_equal(text, name, t.struct_name[k]))
+        return PrimitiveCount + k;
+    check(false);
+    return 0u;
+  };
+
+  while (text[i]) {
+    u32 line = i;
+    spaces();
+    if (text[i] == '\n') {
+      ++i;
+      continue;
+    }
+    if (i == line) {
+      auto decl = word();
+      spaces();
+      in_struct = static_equal(text, decl, "struct");
+      check(in_struct || static_equal(text, decl, "log"));
+      auto name = word();
+      if (in_struct) {
+        for (u32 p {}; p < PrimitiveCount; ++p)
+          check(!static_equal(text, name, static_primitive_name[p]));
+        for (u32 k {}; k < s; ++k)
+          check(!static_equal(text, name, t.struct_name[k]));
+        t.struct_name[s++] = name;
+        t.struct_member[s] = m;
+      }
+    } else if (in_struct) {
+      auto& member = t.member[m];
+      member.name = word();
+      spaces();
+      StaticName size {};
+      if (text[i] == '[') {
+        ++i;
+        size = word();
+        check(text[i++] == ']');
+        spaces();
+      }
+      member.type = find_type(word());
+      if (size.begin != size.end) {
+        member.array = FixedArray;
+        for (u32 k = t.struct_member[s - 1]; k < m; ++k) {
+          if (static_equal(text, size, t.member[k].name)) {
+            member.array = MemberArray;
+            member.length = k - t.struct_member[s - 1];
+          }
+        }
+        // Only a fixed number of structs can be sized; see struct_size.
+        check(member.array == FixedArray || member.type < PrimitiveCount);
+        for (u32 k = size.begin; member.array == FixedArray && k < size.end;
+             ++k) {
+          check(text[k] >= '0' && text[k] <= '9');
+          member.length = member.length * 10 + u32(text[k] - '0');
+        }
+      }
+      t.struct_member[s] = ++m;
+    }
+    spaces();
+    if (in_struct)
+      check(!text[i] || text[i] == '\n');
+    while (text[i] && text[i] != '\n')
+      ++i;
+    if (text[i])
+      ++i;
+  }
+
+  // As in parse: a member of unknown size starts a new section.
+  for (u32 k {}; k < s; ++k) {
+    LibraryLayout at {};
+    for (u32 j = t.struct_member[k]; j < t.struct_member[k + 1]; ++j) {
+      auto member = t.member[j];
+      t.layout[j] = at;
+      u32 size {};
+      bool fixed = member.array != MemberArray;
+      if (member.type < PrimitiveCount) {
+        size = static_primitive_size[member.type];
+      } else {
+        auto end = t.end[member.type - PrimitiveCount];
+        fixed &= !end.after;
+        size = end.offset;
+      }
+      if (fixed)
+        at.offset += member.array == FixedArray ? size * member.length : size;
+      else
+        at = {j - t.struct_member[k] + 1, 0};
+    }
+    t.end[k] = at;
+  }
+  return t;
+}
+
+template <u32 type>
+struct StaticPrimitive;
+template <>
+struct StaticPrimitive<U8> { using type = u8; };
+template <>
+struct StaticPrimitive<U16> { using type = u16; };
+template <>
+struct StaticPrimitive<U32> { using type = u32; };
+template <>
+struct StaticPrimitive<U64> { using type = u64; };
+template <>
+struct StaticPrimitive<I8> { using type = i8; };
+template <>
+struct StaticPrimitive<I16> { using type = i16; };
+template <>
+struct StaticPrimitive<I32> { using type = i32; };
+template <>
+struct StaticPrimitive<I64> { using type = i64; };
+template <>
+struct StaticPrimitive<F32> { using type = f32; };
+template <>
+struct StaticPrimitive<F64> { using type = f64; };
+
+// The values of a primitive array member, in place; records need not be
+// aligned, so values are copied out.
+template <class T>
+struct StaticArray {
+  char const* base;
+  u32 count;
+
+  friend u32 len(StaticArray const& x) { return x.count; }
+  T operator[](u32 i) const {
+    T x;
+    memcpy(&x, base + i * sizeof(T), sizeof(T));
+    return x;
+  }
+};
+
+template <StaticText Text>
+struct StaticSchema {
+  static constexpr StaticText text = Text;
+  static constexpr StaticCounts counts = static_counts(Text.chars);
+  static constexpr auto tables =
+      static_parse<counts.structs, counts.members>(Text.chars);
+
+  static constexpr u32 find_struct(char const* name) {
+    for (u32 s {}; s < counts.structs; ++s)
+      if (static_equal(Text.chars, tables.struct_name[s], name))
+        return s;
+    check(false);
+    return 0;
+  }
+
+  template <u32 S>
+  struct StructAt;
+
+  template <StaticText Name>
+  using Struct = StructAt<find_struct(Name.chars)>;
+};
+
+template <StaticText Text>
+template <u32 S>
+struct StaticSchema<Text>::StructAt {
+  static constexpr u32 first = tables.struct_member[S];
+  static constexpr u32 member_count = tables.struct_member[S + 1] - first;
+  static constexpr bool fixed = !tables.end[S].after;
+  // The size of every record, if `fixed`.
+  static constexpr u32 fixed_size = tables.end[S].offset;
+
+  template <u32 i>
+  static constexpr StaticMember member = tables.member[first + i];
+
+  static constexpr u32 member_index(char const* name) {
+    for (u32 i {}; i < member_count; ++i)
+      if (static_equal(Text.chars, tables.member[first + i].name, name))
+        return i;
+    check(false);
+    return 0;
+  }
+
+  template <StaticText Name>
+  static constexpr u32 index = member_index(Name.chars);
+
+  // The value of length member i, stored at `at`.
+  template <u32 i>
+  static u64 value(char const* at) {
+    using T = typename StaticPrimitive<member<i>.type>::type;
+    static_assert(T(0.5) == T(0) && member<i>.array == NoArray);
+    T x;
+    memcpy(&x, at, sizeof(T));
+    return u64(x);
+  }
+
+  // A length member's value in the record at `base`.
+  template <u32 i>
+  static u64 length(char const* base) {
+    return value<i>(base + offset<i>(base));
+  }
+
+  template <u32 i>
+  static constexpr u32 count(char const* base) {
+    if constexpr (member<i>.array == MemberArray)
+      return u32(length<member<i>.length>(base));
+    else if constexpr (member<i>.array == FixedArray)
+      return member<i>.length;
+    else
+      return 1;
+  }
+
+  // The bytes of member i, holding `n` items, at `at`.
+  template <u32 i>
+  static u32 extent(char const* at, u64 n) {
+    constexpr auto m = member<i>;
+    if constexpr (m.type < PrimitiveCount) {
+      return u32(n * static_primitive_size[m.type]);
+    } else {
+      using Inner = StructAt<m.type - PrimitiveCount>;
+      if constexpr (Inner::fixed) {
+        return u32(n * Inner::fixed_size);
+      } else {
+        static_assert(m.array == NoArray, "no runtime size (see struct_size)");
+        return Inner::size(at);
+      }
+    }
+  }
+
+  // Where members i to n - 1 end in the record at `base`, given where those
+  // before start in `at`. Each length is read at a start already found, so
+  // this is one pass.
+  template <u32 i, u32 n>
+  static void ends(char const* base, u32* at) {
+    if constexpr (i < n) {
+      constexpr auto m = member<i>;
+      u64 items;
+      if constexpr (m.array == MemberArray)
+        items = value<m.length>(base + at[m.length]);
+      else
+        items = count<i>(nullptr);
+      at[i + 1] = at[i] + extent<i>(base + at[i], items);
+      ends<i + 1, n>(base, at);
+    }
+  }
+
+  // Where member i starts in the record at `base`; constant for members
+  // before the first member array or dynamically sized struct.
+  template <u32 i>
+  static constexpr u32 offset(char const* base) {
+    constexpr auto layout = tables.layout[first + i];
+    if constexpr (!layout.after) {
+      return layout.offset;
+    } else {
+      u32 at[i + 1];
+      at[0] = 0;
+      ends<0, i>(base, at);
+      return at[i];
+    }
+  }
+
+  static constexpr u32 size(char const* base) {
+    constexpr auto layout = tables.end[S];
+    if constexpr (!layout.after) {
+      return layout.offset;
+    } else {
+      u32 at[member_count + 1];
+      at[0] = 0;
+      ends<0, member_count>(base, at);
+      return at[member_count];
+    }
+  }
+
+  // Whether the members from i on fit in `data`, each starting at `at`,
+  // which is moved past them; Validator with its steps unrolled. The start
+  // of each member is kept in `starts`, where lengths are read.
+  template <u32 i>
+  static bool fits(Str data, u64& at, u64* starts) {
+    if constexpr (i == member_count) {
+      return true;
+    } else {
+      constexpr auto m = member<i>;
+      starts[i] = at;
+      u64 left = len(data) - at;
+      if constexpr (m.type >= PrimitiveCount) {
+        using Inner = StructAt<m.type - PrimitiveCount>;
+        u64 inner_starts[Inner::member_count + 1];
+        for (u32 j {}; j < count<i>(nullptr); ++j) {
+          u64 inner {};
+          if (!Inner::template fits<0>(
+                  {data.begin() + at, u32(left)}, inner, inner_starts))
+            return false;
+          at += inner;
+          left -= inner;
+        }
+      } else {
+        u64 n;
+        if constexpr (m.array == MemberArray)
+          n = value<m.length>(data.begin() + starts[m.length]);
+        else
+          n = count<i>(nullptr);
+        if (n > left / static_primitive_size[m.type])
+          return false;
+        at += n * static_primitive_size[m.type];
+      }
+      return fits<i + 1>(data, at, starts);
+    }
+  }
+
+  // Size of the record at the start of `data`, or none if `data` ends
+  // before the record does.
+  static MaybeU32 validate(Str data) {
+    u64 at {};
+    u64 starts[member_count + 1];
+    if (!fits<0>(data, at, starts))
+      return {};
+    return MaybeU32::from(u32(at));
+  }
+
+  // Reads a validated record. get() returns a primitive member by value,
+  // a primitive array as a StaticArray and a nested struct as its Reader.
+  struct Reader {
+    char const* base;
+
+    u32 size() const { return StructAt::size(base); }
+
+    template <StaticText Name>
+    auto get() const {
+      constexpr u32 i = index<Name>;
+      constexpr auto m = member<i>;
+      char const* at = base + offset<i>(base);
+      if constexpr (m.type >= PrimitiveCount) {
+        static_assert(m.array == NoArray, "arrays of structs have no reader");
+        return typename StructAt<m.type - PrimitiveCount>::Reader {at};
+      } else {
+        using T = typename StaticPrimitive<m.type>::type;
+        if constexpr (m.array == NoArray) {
+          T x;
+          memcpy(&x, at, sizeof(T));
+          return x;
+        } else {
+          return StaticArray<T> {at, count<i>(base)};
+        }
+      }
+    }
+  };
+
+  // Writes a record into a buffer large enough for it. Members are set in
+  // order, since where a member goes depends on the lengths before it;
+  // set() takes the exact type of a primitive and a Span for an array,
+  // whose length must already be set.
+  struct Writer {
+    char* base;
+
+    u32 size() const { return StructAt::size(base); }
+
+    template <StaticText Name, class X>
+    void set(X const& x) const {
+      constexpr u32 i = index<Name>;
+      constexpr auto m = member<i>;
+      static_assert(m.type < PrimitiveCount, "nested structs are set by at()");
+      using T = typename StaticPrimitive<m.type>::type;
+      char* at = base + offset<i>(base);
+      if constexpr (m.array == NoArray) {
+        static_assert(is_same<X, T>);
+        memcpy(at, &x, sizeof(T));
+      } else {
+        static_assert(is_same<X, Span<T>>);
+        check(len(x) == count<i>(base));
+        memcpy(at, x.begin(), len(x) * sizeof(T));
+      }
+    }
+
+    template <StaticText Name>
+    auto at() const {
+      constexpr u32 i = index<Name>;
+      constexpr auto m = member<i>;
+      static_assert(m.type >= PrimitiveCount && m.array == NoArray);
+      return typename StructAt<m.type - PrimitiveCount>::Writer {
+          base + offset<i>(base)};
+    }
+  };
+};
@@ -7,21 +7,118 @@ struct ContiguousChunk {
   bool direct() const { return !len_member; }
 };
 
-void to_cpp(Library const& p, Print& s) {
-  u32 total_size = 0;
-  u32 len_member = 0;
-  u32 len_member_size;
+namespace {
+
+// Offset of a member in a view, as a C++ expression over earlier accessors.
+auto view_offset(Library::Members members, LibraryLayout at) {
+  return [=](Print& s) {
+    if (!at.after)
+      return sprint(s, at.offset);
+    sprint(s, members[at.after - 1].name(), "().end()"_s);
+    if (at.offset)
+      sprint(s, " + "_s, at.offset);
+  };
+}
+
+void view_to_cpp(Library::Struct struct_, Print& s) {
+  auto members = struct_.members();
+  sprint(s, "struct "_s, struct_.name(), "View {\n"_s);
+  sprint(s, "  char const* base_;\n  unsigned size_;\n"_s);
+  for (auto member: members) {
+    auto type_name = member.type().name();
+    auto name = member.name();
+    auto ofs = view_offset(members, member.layout());
+    if (member.no_array()) {
+      sprint(
+          s, "  "_s, type_name, ' ', name, "() const { return bstruct_load<"_s,
+          type_name, ">(base_, size_, "_s, ofs, "); }\n"_s);
+      continue;
+    }
+    sprint(
+        s, "  bstruct_array<"_s, type_name, "> "_s, name,
+        "() const { return {base_, size_, "_s, ofs, ", "_s);
+    if (member.fixed_array())
+      sprint(s, member.length_fixed());
+    else
+      sprint(s, member.length_member().name(), "()"_s);
+    sprint(s, "}; }\n"_s);
+  }
+  auto end = struct_.l.struct_end[struct_.i];
+  sprint(
+      s, "  unsigned serialized_size() const { return "_s,
+      view_offset(members, end), "; }\n"_s);
+  sprint(s, "};\n\n"_s);
+}
 
-  List<ContiguousChunk> chunks;
-  List<char> member_names;
+}
 
+void to_cpp(Library const& p, Print& s) {
   sprint(s, "#include <string.h>\n"_s);
   sprint(s, "extern \"C\" [[noreturn]] void abort();\n"_s);
   sprint(s, "using u8 = unsigned char;\n"_s);
+  sprint(s, "using u16 = unsigned short;\n"_s);
   sprint(s, "using u32 = unsigned;\n"_s);
+  sprint(s, "using u64 = unsigned long long;\n"_s);
+  sprint(s, "using i8 = signed char;\n"_s);
+  sprint(s, "using i16 = short;\n"_s);
+  sprint(s, "using i32 = int;\n"_s);
+  sprint(s, "using i64 = long long;\n"_s);
+  sprint(s, "using f32 = float;\n"_s);
+  sprint(s, "using f64 = double;\n"_s);
+  sprint(s, R"(template <class T>
+T bstruct_load(char const* base, unsigned size, unsigned long long ofs) {
+  if (ofs + sizeof(T) > size)
+    abort();
+  T x;
+  memcpy(&x, base + ofs, sizeof(T));
+  return x;
+}
+template <class T>
+struct bstruct_array {
+  char const* base;
+  unsigned long long ofs;
+  unsigned count;
+  bstruct_array(char const* b, unsigned size, unsigned long long o, unsigned n):
+    base(b), ofs(o), count(n) {
+    if (ofs + 1ull * count * sizeof(T) > size)
+      abort();
+  }
+  unsigned size() const { return count; }
+  T const* data() const { return (T const*) (base + ofs); }
+  unsigned end() const { return unsigned(ofs + 1ull * count * sizeof(T)); }
+  T operator[](unsigned i) const {
+    if (i >= count)
+      abort();
+    return bstruct_load<T>(base, end(), ofs + 1ull * i * sizeof(T));
+  }
+};
+)"_s);
+
   for (auto struct_: p.structs()) {
+    u32 total_size = 0;
+    u32 cpp_offset = 0;
+
+    List<ContiguousChunk> chunks;
+    List<char> member_names;
+
+    // Adjacent fixed members share one memcpy as long as they are also
+    // contiguous in the generated C++ struct.
+    auto add_direct = [&](u32 member, u32 align, u32 size) {
+      u32 aligned = (cpp_offset + align - 1) / align * align;
+      if (chunks && chunks.last().direct() && aligned == cpp_offset)
+        chunks.last().size += size;
+      else
+        chunks.push({member, size});
+      total_size += size;
+      cpp_offset = aligned + size;
+    };
+
     sprint(s, "struct "_s, struct_.name(), " {\n"_s);
     auto members = struct_.members();
+
+    // Bytes per unit of each length member, over all the arrays it sizes.
+    Array<u32> len_weight(len(members));
+
     for (auto member: members) {
       auto type = member.type();
       auto type_name = type.name();
@@ -29,43 +126,45 @@ void to_cpp(Library const& p, Print& s) {
       if (member_names)
         extend(member_names, "\\0"_s);
       extend(member_names, name);
+      u32 elem_size = type.primitive().size();
       if (member.no_array()) {
         sprint(s, "  "_s, type_name, ' ', name, ";\n"_s);
-        u32 member_size = type.primitive().size();
-        total_size += member_size;
-        if (chunks && chunks.last().direct())
-          chunks.last().size += member_size;
-        else
-          chunks.push({member.index(), member_size});
+        add_direct(member.index(), elem_size, elem_size);
       } else if (member.fixed_array()) {
         sprint(
             s, "  "_s, type_name, ' ', name, '[', member.length_fixed(),
             "];\n"_s);
-        u32 member_size = type.primitive().size() * member.length_fixed();
-        total_size += member_size;
-        if (chunks && chunks.last().direct())
-          chunks.last().size += member_size;
-        else
-          chunks.push({member.index(), member_size});
+        add_direct(
+            member.index(), elem_size, elem_size * member.length_fixed());
       } else if (member.member_array()) {
         sprint(s, "  "_s, type_name, " const* "_s, name, ";\n"_s);
         u32 len_member_id = member.length_member().index();
-        len_member = len_member_id + 1;
-        len_member_size = type.primitive().size();
-        chunks.push({member.index(), len_member_size, len_member_id + 1});
+        len_weight[len_member_id] += elem_size;
+        chunks.push({member.index(), elem_size, len_member_id + 1});
+        cpp_offset = (cpp_offset + 7) / 8 * 8 + 8;
       } else
         unreachable;
     }
-    sprint(
-        s, "  unsigned serialized_size() const {\n    return "_s, total_size);
-    if (len_member) {
-      sprint(s, " + "_s);
-      check(len_member_size);
-      if (len_member_size != 1)
-        sprint(s, len_member_size, " * "_s);
-      sprint(s, members[len_member - 1].name());
+
+    sprint(s, "  unsigned serialized_size() const {\n    return "_s);
+    bool first = true;
+    if (total_size) {
+      sprint(s, total_size);
+      first = false;
     }
+    for (u32 i: range(len(members))) {
+      if (!len_weight[i])
+        continue;
+      if (!exchange(first, false))
+        sprint(s, " + "_s);
+      if (len_weight[i] != 1)
+        sprint(s, len_weight[i], " * "_s);
+      sprint(s, members[i].name());
+    }
+    if (first)
+      sprint(s, '0');
     sprint(s, ";\n  }\n"_s);
+
     sprint(s, "  char* serialize(char* dst) const {\n"_s);
     sprint(s, "    unsigned n {};\n"_s);
     for (auto& chunk: chunks) {
@@ -83,9 +182,37 @@ void to_cpp(Library const& p, Print& s) {
       sprint(s, "); dst += n;\n"_s);
     }
     sprint(s, "    return dst;\n  };\n"_s);
+
+    // Each fixed chunk is bounds-checked and copied once; member arrays are
+    // checked against their length and then referenced in place.
+    sprint(
+        s,
+        "  char const* deserialize(char const* src, char const* end) {\n"_s);
+    if (find_if(chunks.span(), [](auto& c) { return !c.direct(); }))
+      sprint(s, "    unsigned long long n {};\n"_s);
+    for (auto& chunk: chunks) {
+      auto member = members[chunk.member];
+      auto name = member.name();
+      if (chunk.direct()) {
+        sprint(s, "    if (end - src < "_s, chunk.size, ")\n      return 0;\n"_s);
+        sprint(
+            s, "    memcpy(&"_s, name, ", src, "_s, chunk.size, "); src += "_s,
+            chunk.size, ";\n"_s);
+      } else {
+        sprint(s, "    n = "_s, chunk.size, "ull * "_s);
+        sprint(s, members[chunk.len_member - 1].name(), ";\n"_s);
+        sprint(s, "    if (0ull + (end - src) < n)\n      return 0;\n"_s);
+        sprint(
+            s, "    "_s, name, " = ("_s, member.type().name(),
+            " const*) src; src += n;\n"_s);
+      }
+    }
+    sprint(s, "    return src;\n  }\n"_s);
     sprint(s, "  static constexpr u32 member_count = "_s, len(members), ";\n"_s);
     sprint(s, "  static constexpr char const* member_names = \""_s, member_names.span(), "\";\n"_s);
     sprint(s, "};\n\n"_s);
+
+    view_to_cpp(struct_, s);
   }
   s.chars.pop();
 }
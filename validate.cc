@@ -0,0 +1,165 @@
+#include "validate.hh"
+
+namespace {
+
+void skip(List<Validator::Step>& steps, u64 size) {
+  if (!size)
+    return;
+  if (len(steps) && last(steps.span()).op == Validator::Skip) {
+    size += last(steps.span()).size;
+    steps.size--;
+  }
+  check(size <= ~0u);
+  steps.push({Validator::Skip, U8, u32(size), 0});
+}
+
+void add_steps(
+    List<Validator::Step>& steps, u32& slots, Library const& l,
+    LibraryStruct s) {
+  // The slot of each member that gives the length of a later one.
+  List<MaybeU32> slot;
+  for (u32 i {}; i < s.memberCount; ++i)
+    slot.push({});
+  for (u32 i {}; i < s.memberCount; ++i) {
+    auto m = s.member[i];
+    if (m.array == MemberArray && !slot[m.length])
+      slot[m.length] = slots++;
+  }
+
+  for (u32 i {}; i < s.memberCount; ++i) {
+    auto m = s.member[i];
+    u64 count = m.array == FixedArray ? m.length : 1;
+    if (m.type >= PrimitiveCount) {
+      // Structs come singly or in fixed arrays, as struct_size requires.
+      check(m.array != MemberArray);
+      auto inner = l.type(m.type - PrimitiveCount);
+      if (inner.fixed()) {
+        skip(steps, count * inner.end.offset);
+        continue;
+      }
+      for (u64 j {}; j < count; ++j)
+        add_steps(steps, slots, l, inner);
+      continue;
+    }
+    auto t = PrimitiveId(m.type);
+    if (slot[i]) {
+      check(m.array == NoArray);
+      steps.push({Validator::ReadLength, t, primitive_size(t), *slot[i]});
+    } else if (m.array == MemberArray) {
+      steps.push({Validator::SkipArray, t, primitive_size(t), *slot[m.length]});
+    } else {
+      skip(steps, count * primitive_size(t));
+    }
+  }
+}
+
+}
+
+Validator::Validator(Library const& l, LibraryStruct s) {
+  u32 slots {};
+  add_steps(steps, slots, l, s);
+  lengths = Array<u64>(slots);
+}
+
+MaybeU32 Validator::operator()(Str data) {
+  // `at` never passes `end`, so `end - at` is what is left.
+  u64 end = len(data);
+  u64 at {};
+  for (auto step: steps) {
+    switch (step.op) {
+    case Skip:
+      if (end - at < step.size)
+        return {};
+      at += step.size;
+      break;
+    case ReadLength:
+      if (end - at < step.size)
+        return {};
+      lengths[step.slot] = read_integer(step.type, data.begin() + at);
+      at += step.size;
+      break;
+    case SkipArray: {
+      u64 count = lengths[step.slot];
+      if (count > (end - at) / step.size)
+        return {};
+      at += count * step.size;
+      break;
+    }
+    }
+  }
+  return MaybeU32::from(u32(at));
+}
+
+MaybeU32 validate(Library const& l, LibraryStruct s, Str data) {
+  return Validator {l, s}(data);
+}
+
+void test_validate() {
+  auto l = parse(R"(struct Point
+  x f32
+  y f32
+
+struct Tail
+  n u8
+  xs[n] u16
+
+struct Shape
+  id u16
+  origin Point
+  count u64
+  values[count] i8
+  tail Tail
+  end u32
+
+struct Tails
+  tails[2] Tail
+)"_s);
+  Stream record;
+  auto put = [&](auto x) {
+    memcpy(record.reserve(sizeof(x)), &x, sizeof(x));
+    record.size += u32(sizeof(x));
+  };
+  put(u16(7));
+  put(1.5f);
+  put(2.5f);
+  put(u64(3));
+  put(i8(-1));
+  put(i8(0));
+  put(i8(1));
+  put(u8(2));
+  put(u16(10));
+  put(u16(20));
+  put(u32(9));
+
+  auto shape = l.type("Shape"_s);
+  Validator v {l, shape};
+  // Skip id and origin, read count, skip values, read n, skip xs, skip end.
+  check(len(v.steps) == 6 && len(v.lengths) == 2);
+  check(*v(record) == 30 && len(record) == 30);
+  check(struct_size(l, shape, record.begin()) == 30);
+  for (u32 size {}; size < len(record); ++size)
+    check(!v({record.begin(), size}));
+  put(u8(0));
+  check(*validate(l, shape, record) == 30);
+
+  // A length that would overflow the size must not wrap around.
+  u64 huge = ~0ull / 2;
+  memcpy(record.begin() + 10, &huge, sizeof(huge));
+  check(!v(record));
+
+  // Nor may a negative one, as the printers take lengths to be unsigned.
+  auto signed_length = parse(R"(struct Signed
+  n i16
+  xs[n] u8
+)"_s);
+  check(!validate(signed_length, signed_length.type("Signed"_s), "\377\377\0\0"_s));
+  check(*validate(signed_length, signed_length.type("Signed"_s), "\1\0\0"_s) == 3);
+
+  record.size = 0;
+  put(u8(1));
+  put(u16(5));
+  put(u8(0));
+  check(*validate(l, l.type("Tails"_s), record) == 4);
+  check(!validate(l, l.type("Tails"_s), {record.begin(), 3}));
+  println("Validator tests passed");
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "parse.hh"
+
+// Checks that one record of a struct lies within a buffer, in one pass
+// over the record. The struct is compiled once into a flat list of steps:
+// nested structs and fixed arrays of structs are inlined, runs of members
+// of fixed size become one step, and only the members that give array
+// lengths are read. Checking a record is then one loop over the steps,
+// with no recursion and nothing looked up. Code that reads validated
+// records, like print_struct, needs no bounds checks of its own.
+struct Validator {
+  enum Op: u8 { Skip, ReadLength, SkipArray };
+  struct Step {
+    Op op;
+    // Of the length member, for ReadLength.
+    PrimitiveId type;
+    // Bytes to skip, or the size of a SkipArray element.
+    u32 size;
+    // Where ReadLength keeps a length, and where SkipArray finds it.
+    u32 slot;
+  };
+  List<Step> steps;
+  // The lengths read from the record being checked, so a Validator must
+  // not be shared between threads.
+  Array<u64> lengths;
+
+  Validator(Library const& l, LibraryStruct s);
+
+  // Size of the record at the start of `data`, or none if `data` ends
+  // before the record does. A negative length, sign-extended as read, is
+  // more than any data holds, so is rejected the same way.
+  MaybeU32 operator()(Str data);
+};
+
+// Compiles `s` and checks one record; make a Validator to check many.
+MaybeU32 validate(Library const& l, LibraryStruct s, Str data);